@@ -0,0 +1,145 @@
+# Content-addressed cache for the static analyzers. The result of scanning a
+# file (hooks and keywords of a C file, SQL feature flags, lines of code,
+# version guard intervals, ...) only depends on the file's content and on the
+# scanning code, so it is stored under the SHA-256 of the content, the name of
+# the scan and the analyzer's version. Re-running an analyzer only scans files
+# that changed; everything else, and so the CSV files, is rebuilt from the
+# cache. Analyzers bump their version whenever a scan returns something
+# different, which invalidates all of their old results.
+#
+# The cache is an SQLite database (analysis_cache.db). Every process keeps its
+# own connection, and writes wait on locks, so the parallel drivers' worker
+# processes can share it.
+#
+# Usage:
+#   python3 analysis_cache.py stats
+#   python3 analysis_cache.py clear [analyzer]
+
+import argparse
+import hashlib
+import json
+import os
+import sqlite3
+
+default_cache_db = "analysis_cache.db"
+
+schema = [
+  "CREATE TABLE IF NOT EXISTS results (analyzer TEXT NOT NULL, version TEXT NOT NULL, content_hash TEXT NOT NULL, result TEXT NOT NULL, PRIMARY KEY (analyzer, version, content_hash))"
+]
+
+# (process id, database path) -> connection
+connections = {}
+
+def connect(db_path=default_cache_db):
+  key = (os.getpid(), db_path)
+  if key not in connections:
+    conn = sqlite3.connect(db_path, timeout=60)
+    conn.execute("PRAGMA journal_mode=WAL")
+    conn.execute("PRAGMA synchronous=NORMAL")
+    for statement in schema:
+      conn.execute(statement)
+    conn.commit()
+    connections[key] = conn
+  return connections[key]
+
+def hash_bytes(data):
+  return hashlib.sha256(data).hexdigest()
+
+# Combines several hashes (or any strings) into one key, e.g. the hashes of
+# every file a whole-tree analysis reads.
+def hash_strings(strings):
+  return hash_bytes("\n".join(strings).encode("utf-8"))
+
+def lookup(analyzer, version, content_hash, db_path=default_cache_db):
+  row = connect(db_path).execute("SELECT result FROM results WHERE analyzer = ? AND version = ? AND content_hash = ?", (analyzer, version, content_hash)).fetchone()
+  return None if row is None else json.loads(row[0])
+
+def store(analyzer, version, content_hash, result, db_path=default_cache_db):
+  conn = connect(db_path)
+  with conn:
+    conn.execute("INSERT OR REPLACE INTO results VALUES (?, ?, ?, ?)", (analyzer, version, content_hash, json.dumps(result)))
+
+# Returns compute() from the cache, or computes and stores it. compute must
+# return something JSON can store; tuples come back as lists. With db_path
+# None, nothing is cached.
+def cached(analyzer, version, content_hash, compute, db_path=default_cache_db):
+  if db_path is None:
+    return compute()
+  result = lookup(analyzer, version, content_hash, db_path)
+  if result is None:
+    result = compute()
+    store(analyzer, version, content_hash, result, db_path)
+    result = json.loads(json.dumps(result))
+  return result
+
+# Decodes a file the way open() in text mode does, with universal newlines.
+def decode_text(data):
+  return data.decode("utf-8").replace("\r\n", "\n").replace("\r", "\n")
+
+# Returns scan(text) for the file at path, from the cache if a file with the
+# same content has been scanned before.
+def scan_file(analyzer, version, path, scan, db_path=default_cache_db):
+  source_file = open(path, "rb")
+  data = source_file.read()
+  source_file.close()
+  return cached(analyzer, version, hash_bytes(data), lambda: scan(decode_text(data)), db_path)
+
+# Like scan_file, but never holds the whole file in memory: scan gets the
+# open file and reads it line by line.
+def scan_file_lines(analyzer, version, path, scan, db_path=default_cache_db):
+  def compute():
+    source_file = open(path, "r", errors="replace")
+    result = scan(source_file)
+    source_file.close()
+    return result
+  return cached(analyzer, version, get_file_hash(path) if db_path is not None else None, compute, db_path)
+
+def get_file_hash(path):
+  sha = hashlib.sha256()
+  source_file = open(path, "rb")
+  for chunk in iter(lambda: source_file.read(1 << 20), b""):
+    sha.update(chunk)
+  source_file.close()
+  return sha.hexdigest()
+
+# Hash of every file under dir, with their relative paths.
+def get_tree_hash(dir):
+  entries = []
+  for root, _, files in os.walk(dir):
+    for name in files:
+      path = os.path.join(root, name)
+      entries.append(os.path.relpath(path, dir) + " " + get_file_hash(path))
+  entries.sort()
+  return hash_strings(entries)
+
+#####################################################################
+# MAINTENANCE
+#####################################################################
+
+def print_stats(db_path):
+  conn = connect(db_path)
+  rows = conn.execute("SELECT analyzer, version, COUNT(*), SUM(LENGTH(result)) FROM results GROUP BY analyzer, version ORDER BY analyzer, version").fetchall()
+  for (analyzer, version, num_results, num_bytes) in rows:
+    print(analyzer.ljust(40) + ("v" + version).ljust(6) + str(num_results).rjust(8) + " results " + str(num_bytes // 1024).rjust(8) + " KB")
+
+def clear(db_path, analyzer=None):
+  conn = connect(db_path)
+  with conn:
+    if analyzer is None:
+      conn.execute("DELETE FROM results")
+    else:
+      conn.execute("DELETE FROM results WHERE analyzer = ? OR analyzer LIKE ?", (analyzer, analyzer + ".%"))
+  conn.execute("VACUUM")
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Content-addressed cache of static analysis results.')
+  parser.add_argument('command', choices=['stats', 'clear'])
+  parser.add_argument('analyzer', nargs='?', help='analyzer to clear (default: all)')
+  parser.add_argument('-d', '--db', action='store', default=default_cache_db, help='cache database (default analysis_cache.db)')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['command'] == 'stats':
+    print_stats(args_dict['db'])
+  else:
+    clear(args_dict['db'], args_dict['analyzer'])
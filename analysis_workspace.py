@@ -0,0 +1,179 @@
+# Shared workspace for the static analyzers (extension_info.py,
+# source_code_analysis.py and function_info.py). On their own, each of them
+# downloads Postgres and every extension again and deletes everything when it
+# is done. The workspace materializes the Postgres sources and the sources of
+# every extension once, under a directory versioned by the Postgres version,
+# and keeps them between runs:
+#
+#   analysis_workspace/pg-15.3/postgresql-15.3/
+#   analysis_workspace/pg-15.3/extensions/<extension>/
+#
+# An extension is downloaded again only when its download location in
+# extn_info changes, or with --refresh. analyze-all runs the three analyzers
+# against the workspace in one pass over the extensions and writes all of
+# their CSV files. With the analysis cache (analysis_cache.py), only files
+# that changed since the last run are scanned again.
+#
+# Usage:
+#   python3 analysis_workspace.py materialize --jobs=16
+#   python3 analysis_workspace.py analyze-all --jobs=16
+#   python3 analysis_workspace.py analyze extension_info function_info
+#   python3 analysis_workspace.py clean
+
+import argparse
+from datetime import datetime
+from functools import partial
+import importlib
+import json
+import os
+import subprocess
+import sys
+import extension_info as ei
+import parallel_driver
+
+workspace_root = "analysis_workspace"
+analyzer_names = ["extension_info", "source_code_analysis", "function_info"]
+
+# Written to an extension's directory once it is downloaded; records where it
+# was downloaded from.
+source_marker_file = ".source"
+download_keys = ["download_method", "download_url", "pgxn_location", "folder_name"]
+
+def get_workspace_dir(postgres_version=ei.postgres_version):
+  return ei.current_working_dir + "/" + workspace_root + "/pg-" + postgres_version
+
+def get_postgres_source_dir(workspace_dir, postgres_version=ei.postgres_version):
+  return workspace_dir + "/postgresql-" + postgres_version
+
+def get_extn_dir(workspace_dir, extn_name):
+  return parallel_driver.get_extn_work_dir(workspace_dir + "/extensions", extn_name)
+
+#####################################################################
+# MATERIALIZING
+#####################################################################
+
+def get_download_source(extn_name):
+  extn_entry = ei.extn_db[extn_name]
+  return {key: extn_entry[key] for key in download_keys if key in extn_entry}
+
+def is_materialized(workspace_dir, extn_name):
+  marker_path = get_extn_dir(workspace_dir, extn_name) + "/" + source_marker_file
+  if not os.path.exists(marker_path):
+    return False
+  marker_file = open(marker_path, "r")
+  source = json.load(marker_file)
+  marker_file.close()
+  return source == get_download_source(extn_name)
+
+def materialize_postgres(workspace_dir, postgres_version=ei.postgres_version):
+  if os.path.isdir(get_postgres_source_dir(workspace_dir, postgres_version)):
+    return
+  print("Downloading Postgres " + postgres_version + " sources")
+  subprocess.run("mkdir -p " + workspace_dir + "/extensions", shell=True, cwd=ei.current_working_dir)
+  tarball = "postgresql-" + postgres_version + ".tar.gz"
+  url = "https://ftp.postgresql.org/pub/source/v" + postgres_version + "/" + tarball
+  subprocess.run("wget " + url, cwd=workspace_dir, shell=True)
+  subprocess.run("tar -xf " + tarball, cwd=workspace_dir, shell=True)
+  subprocess.run("rm -f " + tarball, cwd=workspace_dir, shell=True)
+  if not os.path.isdir(get_postgres_source_dir(workspace_dir, postgres_version)):
+    sys.exit("Could not download the Postgres " + postgres_version + " sources.")
+
+# Downloads one extension into a clean directory. Contrib and preinstalled
+# extensions have nothing to download.
+def materialize_extn(workspace_dir, terminal_path, extn_name):
+  extn_entry = ei.extn_db[extn_name]
+  extension_dir = get_extn_dir(workspace_dir, extn_name)
+  subprocess.run("rm -rf " + extension_dir + " && mkdir -p " + extension_dir, shell=True, cwd=ei.current_working_dir)
+  terminal_file = open(terminal_path, "a")
+  ei.download_extn(extn_name, terminal_file, extension_dir)
+  terminal_file.close()
+
+  if extn_entry["download_method"] in ["git", "tar", "zip"] and not os.path.isdir(extension_dir + "/" + extn_entry["folder_name"]):
+    raise RuntimeError("Download of " + extn_name + " failed, see " + terminal_path)
+  marker_file = open(extension_dir + "/" + source_marker_file, "w")
+  json.dump(get_download_source(extn_name), marker_file)
+  marker_file.close()
+  return []
+
+# Returns the extensions that could not be downloaded.
+def materialize(workspace_dir, extns_list, num_jobs, refresh=False):
+  materialize_postgres(workspace_dir)
+  missing = list(filter(lambda x: refresh or not is_materialized(workspace_dir, x), extns_list))
+  print(str(len(extns_list) - len(missing)) + "/" + str(len(extns_list)) + " extensions already in " + workspace_dir)
+  if len(missing) == 0:
+    return []
+  terminal_path = workspace_dir + "/download.txt"
+  return parallel_driver.run_analysis(missing, partial(materialize_extn, workspace_dir, terminal_path), [], num_jobs)
+
+def clean(workspace_dir):
+  subprocess.run("rm -rf " + workspace_dir, shell=True, cwd=ei.current_working_dir)
+
+#####################################################################
+# ANALYSIS
+#####################################################################
+
+# Points the analyzers at the workspace's Postgres sources and one shared
+# output directory. Worker processes are forked afterwards and inherit this.
+def setup_analyzers(names, workspace_dir, use_cache=True):
+  testing_output_dir = "testing-output-" + datetime.now().strftime("%m-%d-%Y_%H:%M")
+  subprocess.run("mkdir -p " + testing_output_dir, shell=True, cwd=ei.current_working_dir)
+  output_files = []
+  for name in names:
+    analyzer = importlib.import_module(name)
+    analyzer.postgres_source_dir = get_postgres_source_dir(workspace_dir, analyzer.postgres_version)
+    analyzer.testing_output_dir = testing_output_dir
+    if not use_cache:
+      analyzer.analysis_cache_db = None
+    output_files += analyzer.output_files
+  return output_files
+
+def analyze_extn(workspace_dir, names, extn_name):
+  print("Analyzing " + extn_name + "...")
+  rows = []
+  for name in names:
+    rows += importlib.import_module(name).analyze_extn_sources(extn_name, get_extn_dir(workspace_dir, extn_name))
+  return rows
+
+def analyze(workspace_dir, names, extns_list, num_jobs, refresh=False, use_cache=True):
+  failed = materialize(workspace_dir, extns_list, num_jobs, refresh)
+  extns_list = list(filter(lambda x: x not in failed, extns_list))
+  output_files = setup_analyzers(names, workspace_dir, use_cache)
+  return failed + parallel_driver.run_analysis(extns_list, partial(analyze_extn, workspace_dir, names), output_files, num_jobs)
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Shared source workspace for the static analyzers.')
+  parser.add_argument('command', choices=['materialize', 'analyze-all', 'analyze', 'clean'])
+  parser.add_argument('analyzers', nargs='*', help='analyzers to run with analyze (' + ", ".join(analyzer_names) + ')')
+  parser.add_argument('-j', '--jobs', action='store', help='number of extensions downloaded or analyzed in parallel (default: number of CPUs, fewer when source_code_analysis runs, see its --jobs)')
+  parser.add_argument('-l', '--list', action='store', help='text file with the extensions to use (default: all of extn_info)')
+  parser.add_argument('--refresh', action='store_true', help='download every extension again')
+  parser.add_argument('--no-cache', action='store_true', help='scan every file again instead of using analysis_cache.db')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  workspace_dir = get_workspace_dir()
+  extns_list = sorted(ei.extn_db.keys())
+  if args_dict['list'] is not None:
+    list_file = open(args_dict['list'], "r")
+    extns_list = list(filter(lambda x: x != "", map(lambda x: x.strip("\n"), list_file.readlines())))
+    list_file.close()
+
+  if args_dict['command'] == 'clean':
+    clean(workspace_dir)
+  elif args_dict['command'] == 'materialize':
+    num_jobs = parallel_driver.default_num_jobs if args_dict['jobs'] is None else int(args_dict['jobs'])
+    materialize(workspace_dir, extns_list, num_jobs, args_dict['refresh'])
+  else:
+    names = analyzer_names if args_dict['command'] == 'analyze-all' else args_dict['analyzers']
+    for name in names:
+      if name not in analyzer_names:
+        sys.exit("Unknown analyzer " + name + ".")
+    if len(names) == 0:
+      sys.exit("No analyzers given.")
+    num_jobs = parallel_driver.default_num_jobs if args_dict['jobs'] is None else int(args_dict['jobs'])
+    if "source_code_analysis" in names:
+      pmd_job_memory_mb = importlib.import_module("source_code_analysis").pmd_job_memory_mb
+      os.environ.setdefault("PMD_JAVA_OPTS", "-Xmx" + str(pmd_job_memory_mb) + "m")
+      if args_dict['jobs'] is None:
+        num_jobs = parallel_driver.get_memory_bound_num_jobs(pmd_job_memory_mb)
+    analyze(workspace_dir, names, extns_list, num_jobs, args_dict['refresh'], not args_dict['no_cache'])
@@ -0,0 +1,423 @@
+# Profiles the background workers of C extensions: how many workers they
+# register, and how often those workers wake up when the server is idle.
+# Idle wakeups of the workers of every preloaded extension add up to a CPU
+# cost on every host, whether or not the extensions are used.
+#
+# The sources are tokenized like hook_installations.py does, and the scan
+# records:
+#   - RegisterBackgroundWorker (static, from _PG_init) and
+#     RegisterDynamicBackgroundWorker registrations, with the bgw_function_name,
+#     bgw_library_name and bgw_restart_time of the registered worker, and the
+#     bound of the for loop they are in, if any
+#   - WaitLatch, WaitLatchOrSocket, WaitEventSetWait and pg_usleep calls, with
+#     their timeout and the outermost loop they sit in
+#   - the functions each function calls, and whether from inside a loop
+#
+# A worker's wakeup rate follows from its main loop: the first loop with a
+# timed wait in its entry point, or in a function the entry point calls
+# before any loop. The waits of that loop run one after the other, so one
+# iteration takes the sum of their timeouts. Timed waits anywhere else (in
+# helpers called from the loop, or in other loops) may only run on some
+# iterations, and are listed as conditional instead of setting the rate.
+# Waits without WL_TIMEOUT only wake up on events, and count as 0. Timeouts
+# and loop bounds are evaluated with shmem_footprint.py's evaluator, so GUCs
+# are at their boot values. extension_info.py writes the profiles to
+# bgworker_profile.csv.
+#
+# Usage:
+#   python3 bgworker_profile.py scan pgextworkdir/pg_cron
+#   python3 bgworker_profile.py total --list=extn_lists/preloaded.txt
+
+import argparse
+import csv
+import os
+import sys
+import hook_installations
+import shmem_footprint
+
+default_profile_file = "bgworker_profile.csv"
+
+profile_header = ["Extension Name", "Static Workers", "Dynamic Workers", "Entry Points", "Restart Times", "Wakeups Per Second", "Unresolved"]
+
+registration_calls = ["RegisterBackgroundWorker", "RegisterDynamicBackgroundWorker"]
+
+# Index of the events and timeout arguments of each wait, and the timeout's
+# unit in milliseconds. Waits without an events argument always time out.
+wait_calls = {
+  "WaitLatch": (1, 2, 1),
+  "WaitLatchOrSocket": (1, 3, 1),
+  "WaitEventSetWait": (None, 1, 1),
+  "pg_usleep": (None, 0, 0.001)
+}
+
+string_copy_calls = ["snprintf", "sprintf", "strcpy", "strlcpy", "strncpy"]
+
+bgworker_constants = {
+  "BGW_NEVER_RESTART": -1,
+  "BGW_MAXLEN": 96
+}
+
+#####################################################################
+# SCANNING
+#####################################################################
+
+# Returns the values of the tokens between tokens[i] == "(" and its closing
+# parenthesis, and the index after it.
+def get_parenthesized(tokens, i):
+  depth = 0
+  for j in range(i, len(tokens)):
+    if tokens[j][1] == "(":
+      depth += 1
+    elif tokens[j][1] == ")":
+      depth -= 1
+      if depth == 0:
+        return list(map(lambda x: x[1], tokens[i + 1:j])), j + 1
+  return list(map(lambda x: x[1], tokens[i + 1:])), len(tokens)
+
+# Returns the number of iterations of a for loop header as tokens
+# ("i = 1; i <= N; i++" or "int i = 1; ..." gives (N) - (1) + 1), or None.
+def get_loop_bound(header):
+  clauses = [[]]
+  for value in header:
+    if value == ";":
+      clauses.append([])
+    else:
+      clauses[-1].append(value)
+  if len(clauses) != 3:
+    return None
+  start = ["0"]
+  if "=" in clauses[0] and clauses[0].index("=") < len(clauses[0]) - 1:
+    start = clauses[0][clauses[0].index("=") + 1:]
+  for operator in ["<", "<="]:
+    if operator in clauses[1]:
+      bound = ["("] + clauses[1][clauses[1].index(operator) + 1:] + [")", "-", "("] + start + [")"]
+      return bound + ["+", "1"] if operator == "<=" else bound
+  return None
+
+def new_function():
+  return {"calls": [], "waits": []}
+
+# Scans one C file. Returns a dict with:
+#   registrations: [call, registering function, entry point, library,
+#     restart time tokens, loop bound tokens, in loop, line]
+#   functions: {function: {"calls": [[function, in loop]], "waits": [[call,
+#     times out, timeout tokens, milliseconds per unit, outermost loop, line]]}}
+# Outermost loops are numbered from 1 in source order; waits outside loops
+# have None.
+# tokens, if given, are the file's tokens from hook_installations.tokenize.
+def scan_c_bgworkers(text, tokens=None):
+  tokens = hook_installations.tokenize(text) if tokens is None else tokens
+  registrations = []
+  functions = {}
+  brace_depth = 0
+  candidate = None
+  function = None
+  # Fields assigned to each BackgroundWorker variable of the function, and
+  # the last value assigned to each local variable.
+  worker_fields = {}
+  assignments = {}
+  # Enclosing loops as [brace depth of the body or None for a body without
+  # braces, loop bound tokens, number of the outermost loop].
+  loops = []
+  num_outer_loops = 0
+  pending_loop = None
+  i = 0
+  while i < len(tokens):
+    kind, value, line = tokens[i]
+    prev_value = tokens[i - 1][1] if i > 0 else None
+    next_value = tokens[i + 1][1] if i + 1 < len(tokens) else None
+
+    if kind == "define":
+      while i < len(tokens) and tokens[i][0] != "end_define":
+        i += 1
+      i += 1
+      continue
+
+    if brace_depth == 0:
+      if value == "(" and i > 0 and tokens[i - 1][0] == "identifier" and candidate is None:
+        candidate = prev_value
+      elif value == ";":
+        candidate = None
+      elif value == "{":
+        function = candidate if prev_value == ")" else None
+        candidate = None
+        worker_fields = {}
+        assignments = {}
+        loops = []
+        if function is not None:
+          functions.setdefault(function, new_function())
+        brace_depth = 1
+      i += 1
+      continue
+
+    if value == "{":
+      brace_depth += 1
+      if pending_loop is not None:
+        num_outer_loops += 1 if len(loops) == 0 else 0
+        loops.append([brace_depth, pending_loop[1], num_outer_loops])
+        pending_loop = None
+    elif value == "}":
+      while len(loops) > 0 and loops[-1][0] == brace_depth:
+        loops.pop()
+      brace_depth -= 1
+      if brace_depth == 0:
+        function = None
+    elif value == ";":
+      while len(loops) > 0 and loops[-1][0] is None:
+        loops.pop()
+    if pending_loop is not None and value != "{":
+      # Loop body without braces, which ends at the next ";".
+      num_outer_loops += 1 if len(loops) == 0 else 0
+      loops.append([None, pending_loop[1], num_outer_loops])
+      pending_loop = None
+
+    if function is None:
+      i += 1
+      continue
+    in_loop = len(loops) > 0
+
+    if kind == "identifier" and value in ["for", "while"] and next_value == "(":
+      header, end = get_parenthesized(tokens, i + 1)
+      # The while of a do ... while is not a loop of its own.
+      if not (value == "while" and end < len(tokens) and tokens[end][1] == ";"):
+        pending_loop = [value, get_loop_bound(header) if value == "for" else None]
+      i = end
+      continue
+    if kind == "identifier" and value == "do" and next_value == "{":
+      pending_loop = [value, None]
+      i += 1
+      continue
+
+    if kind == "identifier" and next_value == "(":
+      functions[function]["calls"].append([value, in_loop])
+
+    if kind == "identifier" and next_value == "=" and prev_value not in [".", "->"]:
+      assignment, _ = shmem_footprint.get_until_semicolon(tokens, i + 2)
+      assignments[value] = assignment
+    if kind == "identifier" and value.startswith("bgw_") and prev_value in [".", "->"] and next_value == "=" and i >= 2:
+      field_value, _ = shmem_footprint.get_until_semicolon(tokens, i + 2)
+      worker_fields.setdefault(tokens[i - 2][1], {})[value] = field_value
+    elif kind == "identifier" and value in string_copy_calls and next_value == "(":
+      args, _ = shmem_footprint.get_call_args(tokens, i + 1)
+      if len(args) >= 2 and len(args[0]) >= 3 and args[0][-1].startswith("bgw_") and args[0][-2] in [".", "->"]:
+        literal = args[-1]
+        if len(literal) == 1 and literal[0].startswith("\"") and "%" not in literal[0]:
+          worker_fields.setdefault(args[0][-3], {})[args[0][-1]] = [literal[0][1:-1]]
+    elif kind == "identifier" and value in registration_calls and next_value == "(":
+      args, _ = shmem_footprint.get_call_args(tokens, i + 1)
+      worker = args[0][-1] if len(args) > 0 else ""
+      fields = worker_fields.get(worker, {})
+      bound = None
+      for loop in reversed(loops):
+        if loop[1] is not None:
+          bound = loop[1]
+          break
+      registrations.append([
+        value,
+        function,
+        " ".join(fields.get("bgw_function_name", [])),
+        " ".join(fields.get("bgw_library_name", [])),
+        fields.get("bgw_restart_time"),
+        bound,
+        in_loop,
+        line])
+    elif kind == "identifier" and value in wait_calls and next_value == "(":
+      (events_index, timeout_index, unit) = wait_calls[value]
+      args, _ = shmem_footprint.get_call_args(tokens, i + 1)
+      if len(args) > timeout_index:
+        times_out = events_index is None or "WL_TIMEOUT" in args[events_index]
+        timeout = args[timeout_index]
+        if len(timeout) == 1 and timeout[0] in assignments:
+          timeout = ["("] + assignments[timeout[0]] + [")"]
+        functions[function]["waits"].append([value, times_out, timeout, unit, loops[0][2] if in_loop else None, line])
+    i += 1
+
+  return {"registrations": registrations, "functions": functions}
+
+#####################################################################
+# PROFILE
+#####################################################################
+
+# Returns (function, loop number) of the main loop of a worker starting at
+# entry_point, or (None, None): the first loop with a timed wait in the entry
+# point, or in the functions it calls outside of loops, breadth first.
+def get_main_loop(entry_point, functions):
+  seen = set()
+  queue = [entry_point]
+  while len(queue) > 0:
+    name = queue.pop(0)
+    if name in seen or name not in functions:
+      continue
+    seen.add(name)
+    loops = list(map(lambda x: x[4], filter(lambda x: x[1] and x[4] is not None, functions[name]["waits"])))
+    if len(loops) > 0:
+      return name, min(loops)
+    for (callee, in_loop) in functions[name]["calls"]:
+      if not in_loop:
+        queue.append(callee)
+  return None, None
+
+# Returns (milliseconds between wakeups or None, unresolved timeouts,
+# conditional waits) of a worker starting at entry_point. The interval is the
+# sum of the timeouts of the timed waits in the main loop. Other timed waits
+# that run in a loop, in any function the worker reaches, are returned as
+# conditional.
+def get_wakeup_interval(entry_point, functions, evaluator):
+  (main_function, main_loop) = get_main_loop(entry_point, functions)
+  interval = None
+  unresolved = []
+  conditional = []
+  seen = set()
+  queue = [(entry_point, False)]
+  while len(queue) > 0:
+    (name, looped) = queue.pop()
+    if (name, looped) in seen or name not in functions:
+      continue
+    seen.add((name, looped))
+    for (call, times_out, timeout, unit, loop, line) in functions[name]["waits"]:
+      if not times_out or not (loop is not None or looped):
+        continue
+      description = call + "(" + " ".join(timeout) + ")"
+      if name != main_function or loop != main_loop or looped:
+        if description not in conditional:
+          conditional.append(description)
+        continue
+      try:
+        wait_interval = evaluator.evaluate(timeout) * unit
+      except shmem_footprint.Unresolved:
+        unresolved.append(description)
+        continue
+      if wait_interval >= 0:
+        interval = wait_interval if interval is None else interval + wait_interval
+    for (callee, in_loop) in functions[name]["calls"]:
+      queue.append((callee, looped or in_loop))
+  return interval, unresolved, conditional
+
+# Returns [static workers, dynamic workers, entry points, restart times,
+# wakeups per second, unresolved] for the background worker scans and the
+# shmem_footprint.py scans of an extension's files.
+def estimate_profile(scans, shmem_scans):
+  evaluator = shmem_footprint.SizeEvaluator(shmem_scans, bgworker_constants)
+  functions = {}
+  registrations = []
+  for scan in scans:
+    registrations += scan["registrations"]
+    for name in scan["functions"]:
+      function = functions.setdefault(name, {"calls": [], "waits": []})
+      function["calls"] += scan["functions"][name]["calls"]
+      function["waits"] += scan["functions"][name]["waits"]
+
+  # Workers whose bgw_function_name isn't a literal: the functions that
+  # unblock signals are the worker entry points.
+  fallback_entry_points = sorted(filter(lambda x: any(map(lambda y: y[0] == "BackgroundWorkerUnblockSignals", functions[x]["calls"])), functions))
+
+  static_workers = 0
+  dynamic_workers = 0
+  entry_points = set()
+  restart_times = set()
+  wakeups = 0.0
+  unresolved = []
+  for (call, function, entry_point, library, restart_time, bound, in_loop, line) in registrations:
+    count = 1
+    if bound is not None:
+      try:
+        count = evaluator.evaluate(bound)
+      except shmem_footprint.Unresolved:
+        unresolved.append("workers " + " ".join(bound))
+    if call == "RegisterBackgroundWorker":
+      static_workers += count
+    else:
+      dynamic_workers += count
+
+    if restart_time is not None:
+      try:
+        seconds = evaluator.evaluate(restart_time)
+        restart_times.add("never" if seconds < 0 else str(seconds))
+      except shmem_footprint.Unresolved:
+        unresolved.append("bgw_restart_time " + " ".join(restart_time))
+
+    if entry_point != "":
+      candidates = [entry_point]
+    elif library == "":
+      candidates = fallback_entry_points
+    else:
+      candidates = []
+    entry_points |= set(candidates)
+    shortest = None
+    for candidate in candidates:
+      interval, candidate_unresolved, conditional = get_wakeup_interval(candidate, functions, evaluator)
+      unresolved += candidate_unresolved
+      unresolved += list(map(lambda x: "conditional " + x, conditional))
+      if interval is not None and (shortest is None or interval < shortest):
+        shortest = interval
+    if shortest is not None:
+      if shortest == 0:
+        unresolved.append(call + " worker waits with a timeout of 0")
+      else:
+        wakeups += count * 1000 / shortest
+
+  return [static_workers, dynamic_workers, sorted(entry_points), sorted(restart_times), round(wakeups, 3), sorted(set(unresolved))]
+
+# Returns {extension: (static workers, dynamic workers, wakeups per second)}
+# from bgworker_profile.csv.
+def load_profiles(path=default_profile_file):
+  profiles = {}
+  if not os.path.exists(path):
+    return profiles
+  profile_file = open(path, "r")
+  reader = csv.reader(profile_file)
+  next(reader, [])
+  for row in reader:
+    profiles[row[0]] = (int(row[1]), int(row[2]), float(row[5]))
+  profile_file.close()
+  return profiles
+
+def scan_dir(source_dir):
+  scans = []
+  shmem_scans = []
+  for root, _, files in os.walk(source_dir):
+    for name in sorted(files):
+      if os.path.splitext(name)[1] in [".c", ".h", ".cc", ".cpp", ".cxx", ".hh"]:
+        source_file = open(os.path.join(root, name), "r", errors="replace")
+        text = source_file.read()
+        source_file.close()
+        tokens = hook_installations.tokenize(text)
+        scans.append(scan_c_bgworkers(text, tokens))
+        shmem_scans.append(shmem_footprint.scan_c_shmem(text, tokens))
+  return scans, shmem_scans
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Profiles the background workers of extensions.')
+  parser.add_argument('command', choices=['scan', 'total'])
+  parser.add_argument('args', nargs='*')
+  parser.add_argument('-p', '--profiles', action='store', default=default_profile_file, help='bgworker_profile.csv written by extension_info.py')
+  parser.add_argument('-l', '--list', action='store', help='with total, text file with the preloaded extensions')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['command'] == 'scan':
+    for source_dir in args_dict['args']:
+      scans, shmem_scans = scan_dir(source_dir)
+      for scan in scans:
+        for (call, function, entry_point, library, restart_time, bound, in_loop, line) in scan["registrations"]:
+          print(call + " in " + function + ": " + (entry_point if entry_point != "" else "?") + (", restart " + " ".join(restart_time) if restart_time is not None else "") + (", in a loop" + (" of " + " ".join(bound) + " iterations" if bound is not None else "") if in_loop else ""))
+      static_workers, dynamic_workers, entry_points, restart_times, wakeups, unresolved = estimate_profile(scans, shmem_scans)
+      print(source_dir + ": " + str(static_workers) + " static and " + str(dynamic_workers) + " dynamic workers, " + str(wakeups) + " wakeups/s")
+      for expression in unresolved:
+        print("  unresolved: " + expression)
+  else:
+    if args_dict['list'] is None:
+      sys.exit("No list argument parameter.")
+    list_file = open(args_dict['list'], "r")
+    extns_list = list(filter(lambda x: x != "", map(lambda x: x.strip("\n"), list_file.readlines())))
+    list_file.close()
+    profiles = load_profiles(args_dict['profiles'])
+    total_workers = 0
+    total_wakeups = 0.0
+    for extn in extns_list:
+      (static_workers, dynamic_workers, wakeups) = profiles.get(extn, (0, 0, 0.0))
+      total_workers += static_workers + dynamic_workers
+      total_wakeups += wakeups
+      if static_workers + dynamic_workers > 0:
+        print(extn + ": " + str(static_workers + dynamic_workers) + " workers, " + str(wakeups) + " wakeups/s")
+    print("Total: " + str(total_workers) + " workers, " + str(round(total_wakeups, 3)) + " wakeups/s")
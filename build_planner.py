@@ -0,0 +1,289 @@
+# Plans the smallest set of Postgres builds that can run a list of pairs.
+#
+# Every pair needs a build with at least the configure_options of its
+# extensions (and their dependencies). A build with more options can serve it
+# too, unless two of the options conflict (e.g. --with-uuid=ossp and
+# --with-uuid=e2fs). The planner treats every conflict-free union of pair
+# requirements as a candidate build and picks the fewest candidates that cover
+# all pairs (set cover), so runs stop paying for variants that a superset build
+# could serve.
+#
+# Whether a superset build changes test outcomes is checked by the validation
+# pass, which runs a random sample of pairs on both their minimal build and the
+# planned superset build and reports pairs whose results differ.
+#
+# Usage:
+#   python3 build_planner.py plan --list=pairs.txt
+#   python3 build_planner.py plan --list=extns.txt --pairwise
+#   python3 build_planner.py validate --list=pairs.txt --sample=10 --port=5433
+
+import argparse
+import csv
+from itertools import combinations
+import json
+import os
+import random
+import subprocess
+import sys
+
+extn_info_dir = "extn_info"
+validation_file = "build_validation.csv"
+
+# Exact set cover is only attempted for up to this many candidate builds;
+# larger inputs fall back to the greedy approximation.
+max_exact_candidates = 16
+
+# Spellings of the same option.
+option_aliases = {
+  "--with-openssl": "--with-ssl=openssl"
+}
+
+# Option pairs that can't be combined in one build. --with-x/--without-x,
+# --enable-x/--disable-x and --with-x=a/--with-x=b are detected without
+# being listed here.
+known_conflicts = []
+
+#####################################################################
+# EXTENSION HELPERS
+#####################################################################
+
+def load_extn_db():
+  extn_db = {}
+  for file in os.listdir(extn_info_dir):
+    extn_info_file = open(extn_info_dir + "/" + file, "r")
+    extn_db[os.path.splitext(file)[0]] = json.load(extn_info_file)
+    extn_info_file.close()
+  return extn_db
+
+def get_dependencies(extn, extn_db):
+  dep_list = []
+  for dep in extn_db[extn].get("dependencies", []):
+    dep_list += get_dependencies(dep, extn_db) + [dep]
+  return dep_list
+
+def get_pair_requirements(first_extn, second_extn, extn_db):
+  options = set()
+  for extn in get_dependencies(first_extn, extn_db) + [first_extn] + get_dependencies(second_extn, extn_db) + [second_extn]:
+    for opt in extn_db[extn].get("configure_options", []):
+      options.add(normalize_option(opt))
+  return frozenset(options)
+
+#####################################################################
+# CONFLICT DETECTION
+#####################################################################
+
+def normalize_option(opt):
+  return option_aliases.get(opt, opt)
+
+# --with-uuid=ossp -> uuid, --without-perl -> perl, --enable-cassert -> cassert
+def option_key(opt):
+  name = opt.lstrip("-").split("=")[0]
+  for prefix in ["without-", "with-", "disable-", "enable-"]:
+    if name.startswith(prefix):
+      return name[len(prefix):]
+  return name
+
+def options_conflict(first_opt, second_opt):
+  first_opt = normalize_option(first_opt)
+  second_opt = normalize_option(second_opt)
+  if first_opt == second_opt:
+    return False
+  if (first_opt, second_opt) in known_conflicts or (second_opt, first_opt) in known_conflicts:
+    return True
+  return option_key(first_opt) == option_key(second_opt)
+
+def requirements_compatible(first_reqs, second_reqs):
+  for first_opt in first_reqs:
+    for second_opt in second_reqs:
+      if options_conflict(first_opt, second_opt):
+        return False
+  return True
+
+def is_conflict_free(options):
+  options = list(options)
+  for i in range(0, len(options)):
+    for j in range(i + 1, len(options)):
+      if options_conflict(options[i], options[j]):
+        return False
+  return True
+
+#####################################################################
+# PLANNING
+#####################################################################
+
+# Conflicts are between single options, so a union of requirement sets is
+# conflict-free exactly when every two of them are compatible. The candidate
+# builds are therefore the maximal cliques of the compatibility graph
+# (Bron-Kerbosch).
+def get_candidate_builds(requirements):
+  neighbours = []
+  for i in range(0, len(requirements)):
+    neighbours.append(set(j for j in range(0, len(requirements)) if j != i and requirements_compatible(requirements[i], requirements[j])))
+
+  cliques = []
+  def expand(clique, candidates, excluded):
+    if len(candidates) == 0 and len(excluded) == 0:
+      cliques.append(frozenset(clique))
+      return
+    for v in list(candidates):
+      expand(clique | {v}, candidates & neighbours[v], excluded & neighbours[v])
+      candidates = candidates - {v}
+      excluded = excluded | {v}
+  expand(set(), set(range(0, len(requirements))), set())
+  return cliques
+
+def cover_exact(candidates, num_requirements):
+  everything = set(range(0, num_requirements))
+  for size in range(1, len(candidates) + 1):
+    for chosen in combinations(candidates, size):
+      if set().union(*chosen) == everything:
+        return list(chosen)
+  return candidates
+
+def cover_greedy(candidates, num_requirements):
+  uncovered = set(range(0, num_requirements))
+  chosen = []
+  while len(uncovered) > 0:
+    best = max(candidates, key=lambda c: len(c & uncovered))
+    chosen.append(best)
+    uncovered -= best
+  return chosen
+
+# Returns (builds, assignment): builds is a list of sorted option lists and
+# assignment maps every pair to the build it should run on.
+def plan_builds(file_extn_pairs, extn_db):
+  pair_requirements = {}
+  for (first_extn, second_extn) in file_extn_pairs:
+    pair_requirements[(first_extn, second_extn)] = get_pair_requirements(first_extn, second_extn, extn_db)
+  requirements = sorted(set(pair_requirements.values()), key=lambda x: sorted(x))
+  if len(requirements) == 0:
+    return [], {}
+
+  candidates = get_candidate_builds(requirements)
+  if len(candidates) <= max_exact_candidates:
+    chosen = cover_exact(candidates, len(requirements))
+  else:
+    chosen = cover_greedy(candidates, len(requirements))
+
+  builds = []
+  for clique in chosen:
+    options = set()
+    for i in clique:
+      options |= requirements[i]
+    builds.append(sorted(options))
+
+  # A pair covered by several builds runs on the smallest one.
+  assignment = {}
+  for pair, reqs in pair_requirements.items():
+    covering = filter(lambda b: reqs.issubset(b), builds)
+    assignment[pair] = min(covering, key=lambda b: len(b))
+  return builds, assignment
+
+def print_plan(file_extn_pairs, builds, assignment, extn_db):
+  variants = set(map(lambda p: get_pair_requirements(p[0], p[1], extn_db), file_extn_pairs))
+  union = set()
+  for build in builds:
+    union |= set(build)
+
+  print(str(len(file_extn_pairs)) + " pairs need " + str(len(variants)) + " distinct configure variants")
+  print("Superset build " + str(sorted(union)) + " is " + ("conflict-free" if is_conflict_free(union) else "not conflict-free"))
+  print("Minimal plan: " + str(len(builds)) + " build(s)")
+  for build in builds:
+    num_pairs = len(list(filter(lambda p: assignment[p] == build, file_extn_pairs)))
+    print("  " + (" ".join(build) if len(build) > 0 else "(no options)") + ": " + str(num_pairs) + " pairs")
+
+#####################################################################
+# VALIDATION
+#####################################################################
+
+# Runs every sampled pair twice, on its minimal build and on its planned
+# superset build, and writes both results to build_validation.csv.
+def validate_plan(file_extn_pairs, assignment, extn_db, sample_size, seed):
+  import compatibility_analysis as ca
+
+  sample = list(file_extn_pairs)
+  random.Random(seed).shuffle(sample)
+  sample = sample[:sample_size]
+
+  ca.initial_setup()
+  runs = []
+  for (first_extn, second_extn) in sample:
+    minimal = sorted(get_pair_requirements(first_extn, second_extn, extn_db))
+    runs.append((first_extn, second_extn, minimal, assignment[(first_extn, second_extn)]))
+  variants = []
+  for (first_extn, second_extn, minimal, superset) in runs:
+    contrib_folders = ca.get_contrib_folders(ca.get_extns_to_install([first_extn, second_extn]))
+    variants += [(minimal, contrib_folders), (superset, contrib_folders)]
+  ca.build_postgres_variants(variants)
+
+  validation_csv_file = open(validation_file, "w")
+  writer = csv.writer(validation_csv_file)
+  writer.writerow(["first", "second", "minimal options", "superset options", "minimal result", "superset result"])
+  num_differing = 0
+  for (first_extn, second_extn, minimal, superset) in runs:
+    results = []
+    for (label, options) in [("minimal", minimal), ("superset", superset)]:
+      print("Testing " + first_extn + " and " + second_extn + " on the " + label + " build")
+      subprocess.run("rm -rf " + ca.pg_dist_dir, cwd=ca.current_working_dir, shell=True)
+      ca.install_postgres(options)
+      extns_to_install = ca.get_extns_to_install([first_extn, second_extn])
+      test_extn_dir, terminal_file = ca.get_terminal_file(first_extn, second_extn + "-" + label)
+      for extn in extns_to_install:
+        ca.download_install_extn(extn, ca.extn_db[extn], terminal_file)
+      ca.init_db(terminal_file)
+      ca.modify_postgresql_conf(extns_to_install)
+      ca.start_postgres(terminal_file)
+      results.append(ca.compatibility_test(first_extn, second_extn, test_extn_dir, terminal_file))
+      ca.stop_postgres(terminal_file)
+      terminal_file.close()
+      ca.cleanup()
+
+    if results[0] != results[1]:
+      num_differing += 1
+      print("Results differ for " + first_extn + " and " + second_extn + ": " + str(results[0]) + " (minimal) vs " + str(results[1]) + " (superset)")
+    writer.writerow([first_extn, second_extn, " ".join(minimal), " ".join(superset), str(results[0]), str(results[1])])
+
+  validation_csv_file.close()
+  ca.final_cleanup()
+  print(str(num_differing) + "/" + str(len(runs)) + " sampled pairs changed outcome on the superset build")
+
+#####################################################################
+# LIST HELPERS
+#####################################################################
+
+def get_pairs(list_filename, pairwise):
+  list_file = open(list_filename, "r")
+  lines = list(filter(lambda x: x != "", map(lambda x: x.strip("\n"), list_file.readlines())))
+  list_file.close()
+  if not pairwise:
+    return list(map(lambda x: tuple(x.split(" ")), lines))
+  return [(first, second) for first in lines for second in lines if first != second]
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Plans the minimal set of Postgres builds for a list of pairs.')
+  parser.add_argument('command', choices=['plan', 'validate'])
+  parser.add_argument('-l', '--list', action='store', help='pairs list (pairwise-parallel format), or extensions list with --pairwise')
+  parser.add_argument('--pairwise', action='store_true', help='the list holds single extensions, test all ordered pairs of them')
+  parser.add_argument('-s', '--sample', action='store', default="10", help='number of pairs to validate (default 10)')
+  parser.add_argument('--seed', action='store', default="0", help='random seed for the validation sample')
+  parser.add_argument('-p', '--port', action='store', help='Optional port number for validation runs (default is 5432)')
+  args = parser.parse_args()
+  args_dict = vars(args)
+  if args_dict['list'] is None:
+    sys.exit("No list argument parameter.")
+
+  extn_db = load_extn_db()
+  file_extn_pairs = get_pairs(args_dict['list'], args_dict['pairwise'])
+  for pair in file_extn_pairs:
+    for extn in pair:
+      if extn not in extn_db:
+        sys.exit(extn + " is not in the extension database.")
+
+  builds, assignment = plan_builds(file_extn_pairs, extn_db)
+  print_plan(file_extn_pairs, builds, assignment, extn_db)
+
+  if args_dict['command'] == 'validate':
+    if args_dict['port'] is not None:
+      import compatibility_analysis
+      compatibility_analysis.port_num = int(args_dict['port'])
+    validate_plan(file_extn_pairs, assignment, extn_db, int(args_dict['sample']), int(args_dict['seed']))
@@ -1,10 +1,22 @@
 import argparse
 import csv
 from datetime import datetime
+import hashlib
 import json
 import os
+import shlex
+import socket
 import subprocess
 import sys
+import threading
+import time
+import build_planner
+import coverage_selection
+import duration_store
+import matrix_store
+import output_normalizer
+import sql_regress
+import work_queue
 
 # File paths (globals)
 current_working_dir = os.getcwd()
@@ -17,9 +29,80 @@ now = datetime.now()
 date_time = now.strftime("%m-%d-%Y_%H:%M")
 testing_output_dir = "testing-output-" + date_time
 postgres_version = "15.3"
+# Out-of-tree (VPATH) Postgres builds, one directory per set of configure options.
+build_root = "pg-15-build"
+build_done_file = "build.done"
 default_port_num = 5432
 port_num = 5432
 exit_flag = False
+pgbench_template_db = "pgbench_template"
+# Diffs that were only counted as passes because they are equal after
+# normalization (extensions with "normalize_output") are collected here.
+suppressed_diffs_file = "suppressed_diffs.txt"
+
+# RAM-backed fast-test profile (--ram-profile). PGDATA and the extension work
+# directory are placed on tmpfs, and durability settings are turned off since
+# test clusters are thrown away after every pair.
+ram_profile = False
+ram_dir = "/dev/shm"
+ram_profile_config = [
+  "fsync=off",
+  "synchronous_commit=off",
+  "full_page_writes=off",
+  "shared_buffers=32MB"
+]
+matrix_runtimes_file = "matrix_runtimes.csv"
+
+# Pipelined executor (--pipeline). While one pair is tested, the next pair's
+# extensions are built into a second slot (a copy of the Postgres install plus
+# an extension work directory); pg-15-dist and pgextworkdir are symlinks to the
+# active slot and are swapped between pairs.
+pipeline = False
+pipeline_dir = "pipeline"
+pipeline_base_dist_dir = "pg-15-dist-base"
+num_pipeline_slots = 2
+
+# Staged installs (--staged-installs). Every extension is installed once into
+# its own staging prefix (DESTDIR), and each pair's Postgres install is composed
+# from a base install plus the pair's staged extensions. Base installs and
+# stages are kept per set of configure options ("variant").
+staged_installs = False
+stage_dir = "pg-15-stage"
+composed_dist_dir = "pg-15-dist-composed"
+
+# Minimal builds (--minimal-builds). Pairs run on the smallest set of
+# Postgres builds computed by build_planner.py instead of one build per
+# distinct set of configure options; maps each pair to its build's options.
+minimal_builds = False
+build_plan = {}
+
+# In-process SQL regression runner (--sql-regress, see sql_regress.py). When
+# it can't confirm a pass, pg_regress is run as before.
+use_sql_regress = False
+
+# Smoke stage run before a pair's test suites (disable with --no-smoke). It
+# catches libraries that fail to load, CREATE EXTENSION errors and preload
+# crashes in seconds instead of after the full suites.
+smoke_stage = True
+smoke_db = "smoke_test"
+
+# Coverage-guided test selection (--coverage-select, see coverage_selection.py).
+# Pair runs only run the pg_regress tests that reach the partner's hooks,
+# except for 1 in full_run_interval pairs, which run everything.
+coverage_select = False
+coverage_map = {}
+coverage_hooks = {}
+full_run_interval = coverage_selection.default_full_run_interval
+
+# Durations of every extension build, test suite and pgbench run, and of every
+# pair (see duration_store.py). They predict pair costs for the schedulers and
+# the ETA printed after every pair.
+durations_db = current_working_dir + "/" + duration_store.default_durations_db
+run_progress = duration_store.RunProgress()
+
+# Optional compact compatibility matrix (--matrix) that pair results are
+# written to as soon as they are known.
+matrix_store_path = None
 
 # Load extension database
 extn_files = os.listdir(current_working_dir + "/" + extn_info_dir)
@@ -59,6 +142,32 @@ def get_file_extn_pairs_list(file_extns_filename):
   f.close()
   return file_extns_list
 
+# error is set when the pair could not be run at all; its duration then says
+# nothing about the pair, and the matrix records an error instead of a result.
+def record_pair_result(first_extn, second_extn, result, start_time, error=False):
+  seconds = time.time() - start_time
+  if not error:
+    duration_store.record_pair(first_extn, second_extn, get_pg_build(current_working_dir + "/" + pg_dist_dir), seconds, durations_db)
+  if run_progress.active():
+    run_progress.pair_done((first_extn, second_extn), seconds)
+    print("Progress: " + run_progress.summary())
+
+  if matrix_store_path is None:
+    return
+  store = matrix_store.MatrixStore(matrix_store_path)
+  store.set_result(first_extn, second_extn, result, error)
+  store.close()
+
+# Predicted costs of all pairs of a run, used for the ETA.
+def start_run_progress(file_extn_pairs):
+  history = duration_store.load_history(durations_db)
+  versions = get_extn_versions(file_extn_pairs)
+  expected = {}
+  for (first_extn, second_extn) in file_extn_pairs:
+    expected[(first_extn, second_extn)] = work_queue.estimate_pair_duration(first_extn, second_extn, history, extn_db, get_pair_pg_build(first_extn, second_extn), versions)
+  run_progress.start(expected)
+  print("Predicted run time: " + duration_store.format_duration(sum(expected.values())))
+
 def get_dependencies(extn):
   dep_list = []
   if "dependencies" in extn_db[extn]:
@@ -71,36 +180,45 @@ def get_dependencies(extn):
 # DOWNLOADING + INSTALLING POSTGRES EXTENSIONS HELPER FUNCTIONS
 #####################################################################
 
-def install_extn(extn_name, extn_entry, terminal_file):
+# extension_dir is where sources are downloaded to and dist_dir is the Postgres
+# install to build against; both only differ from pgextworkdir and pg-15-dist
+# for pipeline slots and staged installs. If destdir is set, `make install`
+# installs into it (DESTDIR) instead of into dist_dir.
+def install_extn(extn_name, extn_entry, terminal_file, extension_dir=current_working_dir + "/" + ext_work_dir, dist_dir=current_working_dir + "/" + pg_dist_dir, destdir=""):
   print("Installing " + extn_name)
   install_type = extn_entry["install_method"]
+  extn_pg_config_path = dist_dir + "/bin/pg_config"
+  destdir_setting = "" if destdir == "" else "DESTDIR=" + destdir + " "
 
   if install_type == "installed":
     return
   elif install_type == "pgxs":
-    install_extn_dir = current_working_dir + "/" + ext_work_dir + "/" + extn_entry["folder_name"]
-    subprocess.run("make USE_PGXS=1 PG_CONFIG=" + pg_config_path + " -j8", shell=True, cwd=install_extn_dir, stdout=terminal_file, stderr=terminal_file)
-    subprocess.run("make USE_PGXS=1 PG_CONFIG=" + pg_config_path + " install -j8", shell=True, cwd=install_extn_dir, stdout=terminal_file, stderr=terminal_file)
+    install_extn_dir = extension_dir + "/" + extn_entry["folder_name"]
+    subprocess.run("make USE_PGXS=1 PG_CONFIG=" + extn_pg_config_path + " -j8", shell=True, cwd=install_extn_dir, stdout=terminal_file, stderr=terminal_file)
+    subprocess.run("make USE_PGXS=1 PG_CONFIG=" + extn_pg_config_path + " " + destdir_setting + "install -j8", shell=True, cwd=install_extn_dir, stdout=terminal_file, stderr=terminal_file)
   elif install_type == "shell_script":
     # Copy shell script over to the installation directory and run it.
-    install_extn_dir = current_working_dir + "/" + ext_work_dir + "/" + extn_entry["folder_name"]
+    install_extn_dir = extension_dir + "/" + extn_entry["folder_name"]
     script_name = extn_entry["shell_script"]
     subprocess.run("cp ./extn_scripts/" + script_name + " " + install_extn_dir, shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
-    subprocess.run("./" + script_name, shell=True, cwd=install_extn_dir, stdout=terminal_file, stderr=terminal_file)
+    # make (pgxs) and cmake-generated makefiles both pick DESTDIR up from the environment.
+    subprocess.run(destdir_setting + "./" + script_name, shell=True, cwd=install_extn_dir, stdout=terminal_file, stderr=terminal_file)
   else:
     sys.exit("Could not install extension" + extn_name)
 
-def download_install_extn(extn_name, extn_entry, terminal_file):
+def download_install_extn(extn_name, extn_entry, terminal_file, extension_dir=current_working_dir + "/" + ext_work_dir, dist_dir=current_working_dir + "/" + pg_dist_dir, destdir=""):
   print("Downloading extension " + extn_name)
-  extension_dir = current_working_dir + "/" + ext_work_dir
+  start_time = time.time()
   download_type = extn_entry["download_method"]
 
-  if download_type == "contrib" or download_type == "downloaded":
+  if download_type == "contrib":
+    install_contrib_extn(extn_name, extn_entry, terminal_file, dist_dir, destdir)
+  elif download_type == "downloaded":
     return
   elif download_type == "git":
     git_repo = extn_entry["download_url"]
     subprocess.run("git clone " + git_repo, shell=True, cwd=extension_dir, stdout=terminal_file, stderr=terminal_file)
-    install_extn(extn_name, extn_entry, terminal_file)
+    install_extn(extn_name, extn_entry, terminal_file, extension_dir, dist_dir, destdir)
   elif download_type == "tar" or download_type == "zip":
     url = extn_entry["download_url"]
     base_name = os.path.basename(url)
@@ -110,9 +228,50 @@ def download_install_extn(extn_name, extn_entry, terminal_file):
     elif download_type == "zip":
       subprocess.run("unzip " + base_name, shell=True, cwd=extension_dir, stdout=terminal_file, stderr=terminal_file)
     subprocess.run("rm " + base_name, shell=True, cwd=extension_dir, stdout=terminal_file, stderr=terminal_file)
-    install_extn(extn_name, extn_entry, terminal_file)
+    install_extn(extn_name, extn_entry, terminal_file, extension_dir, dist_dir, destdir)
   else:
     sys.exit("Could not find download and install method")
+  record_phase_duration(extn_name, duration_store.BUILD, start_time, extension_dir, dist_dir)
+
+#####################################################################
+# DURATION HELPERS
+#####################################################################
+
+# Version from the extension's control file, if its sources have one.
+def get_extn_version(extn, extension_dir=current_working_dir + "/" + ext_work_dir):
+  extn_entry = extn_db[extn]
+  if extn_entry["download_method"] == "contrib":
+    source_dir = current_working_dir + "/postgresql-" + postgres_version + "/contrib/" + extn_entry["folder_name"]
+  else:
+    source_dir = extension_dir + "/" + extn_entry.get("folder_name", extn)
+  for root, _, files in os.walk(source_dir):
+    if extn + ".control" in files:
+      control_file = open(os.path.join(root, extn + ".control"), "r")
+      for line in control_file.readlines():
+        if line.strip().startswith("default_version"):
+          control_file.close()
+          return line.split("=", 1)[1].strip().strip("'\"")
+      control_file.close()
+  return "unknown"
+
+def get_pg_build(dist_dir):
+  return postgres_version + "/" + os.path.basename(get_install_build_dir(dist_dir))
+
+# The build get_pg_build reports once the pair's Postgres is installed.
+def get_pair_pg_build(first_extn, second_extn):
+  return postgres_version + "/" + get_variant_name(get_pair_configure_options(first_extn, second_extn))
+
+# Versions of every extension a list of pairs installs.
+def get_extn_versions(file_extn_pairs):
+  versions = {}
+  for pair in file_extn_pairs:
+    for extn in get_extns_to_install(list(pair)):
+      if extn not in versions:
+        versions[extn] = get_extn_version(extn)
+  return versions
+
+def record_phase_duration(extn, phase, start_time, extension_dir=current_working_dir + "/" + ext_work_dir, dist_dir=current_working_dir + "/" + pg_dist_dir):
+  duration_store.record_phase(extn, get_extn_version(extn, extension_dir), get_pg_build(dist_dir), phase, time.time() - start_time, durations_db)
 
 def get_extns_to_install(extn_list):
   extns_to_install = []
@@ -154,21 +313,118 @@ def post_install_extn_pair(first_extn, second_extn, terminal_file):
 # INSTALLING POSTGRES HELPER FUNCTIONS
 #####################################################################
 
-def install_postgres(postgres_config_options = []):
-  print("Installing Postgres " + postgres_version + "...")
+def get_variant_name(configure_options):
+  if len(configure_options) == 0:
+    return "default"
+  return "_".join(map(lambda x: x.strip("-").replace("=", "-").replace("/", "-"), sorted(configure_options)))
+
+def get_build_dir(configure_options):
+  return current_working_dir + "/" + build_root + "/" + get_variant_name(configure_options)
+
+# Configures and builds Postgres in its own build directory (VPATH build), so
+# the source tree stays clean and builds for different configure options
+# coexist. A variant is only built once per run. Only the core is built here;
+# contrib modules are built on demand (see build_contrib).
+def build_postgres(postgres_config_options = [], contrib_folders = []):
+  build_dir = get_build_dir(postgres_config_options)
+  if os.path.exists(build_dir + "/" + build_done_file):
+    build_contrib(build_dir, contrib_folders)
+    return build_dir
+
+  print("Building Postgres " + postgres_version + " (" + get_variant_name(postgres_config_options) + ")...")
   postgres_dir = current_working_dir + "/postgresql-" + postgres_version
-  prefix = current_working_dir + "/" + pg_dist_dir
   config_options_str = ""
 
   for opt in postgres_config_options:
     config_options_str += opt + " "
 
-  subprocess.run("./configure --prefix=" + prefix + " " + config_options_str, capture_output=True, shell=True, cwd=postgres_dir)
-  subprocess.run("make clean", capture_output=True, shell=True, cwd=postgres_dir)
-  subprocess.run("make world-bin -j8", capture_output=True, shell=True, cwd=postgres_dir)
-  subprocess.run("make install-world-bin -j8", capture_output=True, shell=True, cwd=postgres_dir)
+  subprocess.run("rm -rf " + build_dir + " && mkdir -p " + build_dir, cwd=current_working_dir, shell=True)
+  # build.done is only written once configure and make have both succeeded, so
+  # a failed build is never mistaken for a finished one by a later run.
+  build_steps = [("configure", postgres_dir + "/configure --prefix=" + current_working_dir + "/" + pg_dist_dir + " " + config_options_str), ("make", "make -j8")]
+  for (step, command) in build_steps:
+    build_res = subprocess.run(command, capture_output=True, shell=True, cwd=build_dir, text=True)
+    if build_res.returncode != 0:
+      subprocess.run("rm -f " + build_done_file, cwd=build_dir, shell=True)
+      sys.exit("Could not build Postgres (" + get_variant_name(postgres_config_options) + "): " + step + " failed\n" + build_res.stderr[-2000:])
+  subprocess.run("touch " + build_done_file, cwd=build_dir, shell=True)
+  build_contrib(build_dir, contrib_folders)
+  return build_dir
+
+def build_contrib(build_dir, contrib_folders):
+  for folder in contrib_folders:
+    if os.path.exists(build_dir + "/contrib/" + folder + "/" + build_done_file):
+      continue
+    print("Building contrib module " + folder + "...")
+    build_res = subprocess.run("make -C contrib/" + folder + " -j8", capture_output=True, shell=True, cwd=build_dir, text=True)
+    if build_res.returncode != 0:
+      subprocess.run("rm -f contrib/" + folder + "/" + build_done_file, cwd=build_dir, shell=True)
+      sys.exit("Could not build contrib module " + folder + "\n" + build_res.stderr[-2000:])
+    subprocess.run("touch contrib/" + folder + "/" + build_done_file, cwd=build_dir, shell=True)
+
+def get_contrib_folders(extns_to_install):
+  contrib_folders = []
+  for extn in extns_to_install:
+    extn_entry = extn_db[extn]
+    if extn_entry.get("download_method") == "contrib" and extn_entry["folder_name"] not in contrib_folders:
+      contrib_folders.append(extn_entry["folder_name"])
+  return contrib_folders
+
+# Builds every variant a run will need up front, all at the same time.
+# configure_options_list holds (configure options, contrib folders) tuples.
+def build_postgres_variants(configure_options_list):
+  variants = {}
+  for (configure_options, contrib_folders) in configure_options_list:
+    name = get_variant_name(configure_options)
+    if name not in variants:
+      variants[name] = (configure_options, [])
+    for folder in contrib_folders:
+      if folder not in variants[name][1]:
+        variants[name][1].append(folder)
+
+  builders = []
+  for (configure_options, contrib_folders) in variants.values():
+    builder = threading.Thread(target=build_postgres, args=(configure_options, contrib_folders))
+    builder.start()
+    builders.append(builder)
+  for builder in builders:
+    builder.join()
+  # sys.exit in a builder thread only ends that thread.
+  for (configure_options, contrib_folders) in variants.values():
+    build_dir = get_build_dir(configure_options)
+    if not os.path.exists(build_dir + "/" + build_done_file):
+      sys.exit("Could not build Postgres (" + get_variant_name(configure_options) + ")")
+    for folder in contrib_folders:
+      if not os.path.exists(build_dir + "/contrib/" + folder + "/" + build_done_file):
+        sys.exit("Could not build contrib module " + folder + " (" + get_variant_name(configure_options) + ")")
+
+def install_postgres(postgres_config_options = [], prefix = current_working_dir + "/" + pg_dist_dir):
+  print("Installing Postgres " + postgres_version + "...")
+  build_dir = build_postgres(postgres_config_options)
+  # Postgres installs are relocatable, so one build can be installed anywhere.
+  install_res = subprocess.run("make install prefix=" + prefix + " -j8", capture_output=True, shell=True, cwd=build_dir, text=True)
+  if install_res.returncode != 0:
+    # Don't leave a partial install behind for a later pair to run against.
+    subprocess.run("rm -rf " + prefix, cwd=current_working_dir, shell=True)
+    sys.exit("Could not install Postgres (" + get_variant_name(postgres_config_options) + ")\n" + install_res.stderr[-2000:])
   print("Done installing Postgres " + postgres_version + "...")
 
+# The build directory an install came from, found through the configure
+# options its pg_config reports.
+def get_install_build_dir(dist_dir):
+  configure_res = subprocess.run(dist_dir + "/bin/pg_config --configure", capture_output=True, shell=True, text=True)
+  configure_options = list(filter(lambda x: x.startswith("--") and not x.startswith("--prefix="), shlex.split(configure_res.stdout)))
+  return get_build_dir(configure_options)
+
+# Contrib modules are only built when an extension list needs them, then
+# installed like any other extension.
+def install_contrib_extn(extn_name, extn_entry, terminal_file, dist_dir, destdir=""):
+  print("Installing contrib module " + extn_name)
+  build_dir = get_install_build_dir(dist_dir)
+  build_contrib(build_dir, [extn_entry["folder_name"]])
+  destdir_setting = "" if destdir == "" else "DESTDIR=" + destdir + " "
+  subprocess.run("make -C contrib/" + extn_entry["folder_name"] + " prefix=" + os.path.realpath(dist_dir) + " " + destdir_setting + "install", shell=True, cwd=build_dir, stdout=terminal_file, stderr=terminal_file)
+
 def get_configure_options(extns_to_install):
   config_options = []
   for extn in extns_to_install:
@@ -181,8 +437,16 @@ def get_configure_options(extns_to_install):
   
   return config_options
 
-def reinstall_postgres(extns_to_install, current_config_options):
-  config_options = get_configure_options(extns_to_install)
+def get_pair_configure_options(first_extn, second_extn):
+  if (first_extn, second_extn) in build_plan:
+    return list(build_plan[(first_extn, second_extn)])
+  configure_options = get_configure_options(get_extns_to_install([first_extn, second_extn]))
+  configure_options.sort()
+  return configure_options
+
+def reinstall_postgres(extns_to_install, current_config_options, config_options=None):
+  if config_options is None:
+    config_options = get_configure_options(extns_to_install)
   if set(config_options) == set(current_config_options):
     return current_config_options
 
@@ -190,26 +454,172 @@ def reinstall_postgres(extns_to_install, current_config_options):
   install_postgres(config_options)
   return config_options
 
+#####################################################################
+# STAGED INSTALL HELPER FUNCTIONS
+#####################################################################
+
+def get_stage_root():
+  if ram_profile:
+    return get_ram_work_dir() + "/" + stage_dir
+  return current_working_dir + "/" + stage_dir
+
+def get_variant_dir(configure_options):
+  return get_stage_root() + "/" + get_variant_name(configure_options)
+
+def link_data_dir(dir):
+  # The extn_scripts reach PGDATA through ../../pg-15-data from an extension's
+  # source directory, so any directory holding a pgextworkdir needs this link.
+  subprocess.run("ln -sfn " + current_working_dir + "/" + pg_data_dir + " " + pg_data_dir, cwd=dir, shell=True)
+
+# Installs the variant's base install the first time it is used.
+def prepare_variant(configure_options):
+  variant_dir = get_variant_dir(configure_options)
+  base_prefix = variant_dir + "/" + pipeline_base_dist_dir
+  if not os.path.exists(base_prefix + "/bin/pg_config"):
+    subprocess.run("rm -rf " + variant_dir + " && mkdir -p " + variant_dir + "/" + ext_work_dir + " " + variant_dir + "/extns", cwd=current_working_dir, shell=True)
+    link_data_dir(variant_dir)
+    install_postgres(configure_options, base_prefix)
+
+# Makes the variant for configure_options current. pgextworkdir points at the
+# variant's sources, which are kept across pairs.
+def select_variant(configure_options):
+  variant_dir = get_variant_dir(configure_options)
+  prepare_variant(configure_options)
+  subprocess.run("rm -rf " + ext_work_dir + " && ln -sfn " + variant_dir + "/" + ext_work_dir + " " + ext_work_dir, cwd=current_working_dir, shell=True)
+  return configure_options
+
+def find_staged_prefix(destdir):
+  # `make install DESTDIR=x` installs under x/<absolute prefix>; follow the
+  # chain of single directories down to the prefix.
+  prefix = destdir
+  while True:
+    entries = os.listdir(prefix)
+    if len(entries) != 1 or entries[0] in ["bin", "include", "lib", "share"] or not os.path.isdir(prefix + "/" + entries[0]):
+      return prefix
+    prefix = prefix + "/" + entries[0]
+
+def is_staged(extn, variant_dir):
+  return os.path.exists(variant_dir + "/extns/" + extn)
+
+# Builds extn against dist_dir and installs it into the variant's stage for
+# it, unless an earlier pair already did.
+def stage_extn(extn, variant_dir, dist_dir, terminal_file):
+  extn_stage = variant_dir + "/extns/" + extn
+  if is_staged(extn, variant_dir):
+    return
+
+  extn_entry = extn_db[extn]
+  destdir = extn_stage + ".destdir"
+  subprocess.run("rm -rf " + destdir + " && mkdir -p " + destdir, cwd=current_working_dir, shell=True)
+  if "folder_name" in extn_entry and extn_entry["download_method"] not in ["contrib", "downloaded"]:
+    subprocess.run("rm -rf " + extn_entry["folder_name"], cwd=variant_dir + "/" + ext_work_dir, shell=True)
+  download_install_extn(extn, extn_entry, terminal_file, variant_dir + "/" + ext_work_dir, dist_dir, destdir)
+  subprocess.run("mv " + find_staged_prefix(destdir) + " " + extn_stage + " && rm -rf " + destdir, cwd=current_working_dir, shell=True)
+
+# Composes prefix_dir from the variant's base install and the stages of
+# extns_to_install (dependencies first, so each extension builds against them).
+# Hard links rather than a symlink farm: Postgres resolves symlinks to find its
+# own installation, which would lead it back to the base install.
+def compose_pair_prefix(extns_to_install, variant_dir, prefix_dir, terminal_file):
+  base_prefix = variant_dir + "/" + pipeline_base_dist_dir
+  subprocess.run("rm -rf " + prefix_dir + " && cp -al " + base_prefix + " " + prefix_dir, cwd=current_working_dir, shell=True)
+  for extn in extns_to_install:
+    stage_extn(extn, variant_dir, prefix_dir, terminal_file)
+    subprocess.run("cp -al --remove-destination " + variant_dir + "/extns/" + extn + "/. " + prefix_dir, cwd=current_working_dir, shell=True)
+
+# Points pg-15-dist (and the variant's own pg-15-dist, which the extn_scripts
+# use through ../../pg-15-dist) at a composed prefix.
+def activate_prefix(variant_dir, prefix_dir):
+  subprocess.run("ln -sfn " + prefix_dir + " " + variant_dir + "/" + pg_dist_dir, cwd=current_working_dir, shell=True)
+  subprocess.run("rm -rf " + pg_dist_dir + " && ln -sfn " + prefix_dir + " " + pg_dist_dir, cwd=current_working_dir, shell=True)
+
+def install_pair_staged(extns_to_install, configure_options, terminal_file):
+  select_variant(configure_options)
+  variant_dir = get_variant_dir(configure_options)
+  prefix_dir = variant_dir + "/" + composed_dist_dir
+  activate_prefix(variant_dir, prefix_dir)
+  compose_pair_prefix(extns_to_install, variant_dir, prefix_dir, terminal_file)
+  return configure_options
+
 #####################################################################
 # SETUP AND CLEANUP HELPER FUNCTIONS
 #####################################################################
 
+def get_ram_work_dir():
+  # One directory per port, so concurrent runs on the same host don't collide.
+  return ram_dir + "/pgext-analyzer-" + str(port_num)
+
+def create_ram_dirs():
+  # PGDATA and the extension work directory live on tmpfs and are symlinked
+  # into the working directory. The extn_scripts run with the physical path of
+  # their directory, so ../../pg-15-data and $PWD/../../pg-15-dist resolve
+  # inside the RAM directory: pg-15-data is there already, and pg-15-dist is
+  # linked back to the working directory's install.
+  ram_work_dir = get_ram_work_dir()
+  ram_dirs = [pg_data_dir] if pipeline or staged_installs else [pg_data_dir, ext_work_dir]
+  for dir in ram_dirs:
+    subprocess.run("mkdir -p " + ram_work_dir + "/" + dir, cwd=current_working_dir, shell=True)
+    subprocess.run("ln -sfn " + ram_work_dir + "/" + dir + " " + dir, cwd=current_working_dir, shell=True)
+  subprocess.run("ln -sfn " + current_working_dir + "/" + pg_dist_dir + " " + ram_work_dir + "/" + pg_dist_dir, cwd=current_working_dir, shell=True)
+
 def initial_setup():
   url = "https://ftp.postgresql.org/pub/source/v" + postgres_version + "/postgresql-" + postgres_version + ".tar.gz"
   subprocess.run("wget " + url, cwd=current_working_dir, shell=True)
   subprocess.run("tar -xvf postgresql-" + postgres_version + ".tar.gz", cwd=current_working_dir, shell=True, capture_output=True)
-  subprocess.run("mkdir " + ext_work_dir, cwd=current_working_dir, shell=True)
+  if ram_profile:
+    create_ram_dirs()
+  else:
+    subprocess.run("mkdir " + ext_work_dir, cwd=current_working_dir, shell=True)
   subprocess.run("mkdir " + testing_output_dir, cwd=current_working_dir, shell=True)
 
 def cleanup(delete_ext_dir=True):
+  if ram_profile:
+    subprocess.run("rm -rf " + get_ram_work_dir() + "/" + pg_data_dir, cwd=current_working_dir, shell=True)
   subprocess.run("rm -rf " + pg_data_dir, cwd=current_working_dir, shell=True)
   subprocess.run("rm logfile", cwd=current_working_dir, shell=True)
   if delete_ext_dir:
     subprocess.run("rm -rf *", cwd=current_working_dir + "/" + ext_work_dir, shell=True)
+  if ram_profile:
+    create_ram_dirs()
 
 def final_cleanup():
   postgres_folder = "postgresql-" + postgres_version
-  subprocess.run("rm -rf " + postgres_folder + " " + postgres_folder + ".tar.gz " + ext_work_dir + " " + pg_dist_dir, cwd=current_working_dir, shell=True)
+  subprocess.run("rm -rf " + postgres_folder + " " + postgres_folder + ".tar.gz " + ext_work_dir + " " + pg_dist_dir + " " + build_root, cwd=current_working_dir, shell=True)
+  if staged_installs:
+    subprocess.run("rm -rf " + get_stage_root(), cwd=current_working_dir, shell=True)
+  if ram_profile:
+    subprocess.run("rm -rf " + pg_data_dir + " " + get_ram_work_dir(), cwd=current_working_dir, shell=True)
+
+def record_matrix_runtime(mode, extn_list_filename, start_time):
+  # Appends this run's total runtime to matrix_runtimes.csv and reports the
+  # difference to the most recent run of the same list with the other profile.
+  runtime = (datetime.now() - start_time).total_seconds()
+  profile = "ram" if ram_profile else "durable"
+  other_profile = "durable" if ram_profile else "ram"
+  runtimes_path = current_working_dir + "/" + matrix_runtimes_file
+
+  other_runtime = None
+  if os.path.exists(runtimes_path):
+    runtimes_file = open(runtimes_path, "r")
+    for row in csv.reader(runtimes_file):
+      if row[1] == mode and row[2] == extn_list_filename and row[3] == other_profile:
+        other_runtime = float(row[4])
+    runtimes_file.close()
+
+  runtimes_file = open(runtimes_path, "a")
+  writer = csv.writer(runtimes_file)
+  writer.writerow([date_time, mode, extn_list_filename, profile, str(round(runtime, 1))])
+  runtimes_file.close()
+
+  print("Total matrix runtime (" + profile + " profile): " + str(round(runtime, 1)) + "s")
+  if other_runtime is None:
+    print("No " + other_profile + " profile run recorded for " + extn_list_filename + " yet.")
+  else:
+    durable_runtime = runtime if not ram_profile else other_runtime
+    ram_runtime = runtime if ram_profile else other_runtime
+    saved = durable_runtime - ram_runtime
+    pct = round(saved * 100 / durable_runtime, 1) if durable_runtime > 0 else 0.0
+    print("RAM profile runtime " + str(round(ram_runtime, 1)) + "s vs durable " + str(round(durable_runtime, 1)) + "s: " + str(round(saved, 1)) + "s (" + str(pct) + "%) faster")
 
 #####################################################################
 # POSTGRES COMMANDS HELPER FUNCTIONS
@@ -234,6 +644,12 @@ def modify_postgresql_conf(extns_to_install):
   shared_preload_lib_str = ','.join(extns_to_preload)
   postgres_conf.write("shared_preload_libraries = '" + shared_preload_lib_str + "'" + "\n")
 
+  # Non-durable settings for the RAM profile, written before the extension
+  # settings so that custom_config can still override them.
+  if ram_profile:
+    for setting in ram_profile_config:
+      postgres_conf.write(setting + "\n")
+
   # Write custom configuration
   for extn in extns_to_install:
     extn_entry = extn_db[extn]
@@ -265,13 +681,30 @@ def stop_postgres(terminal_file):
 # TESTING INFRASTRUCTURE FUNCTIONS
 #####################################################################
 
-def load_extn_str(test_extn, compat_extn, loaded_extns):
-  load_ext_setting = ""
+def load_extn_list(test_extn, compat_extn, loaded_extns):
+  load_extns = []
   for dep in get_dependencies(compat_extn) + [compat_extn]:
     if dep != test_extn and "no_create_extn" not in extn_db[dep] and dep not in loaded_extns:
-      load_ext_setting += "--load-extension=" + dep + " "
+      load_extns.append(dep)
+  return load_extns
+
+def load_extn_str(test_extn, compat_extn, loaded_extns):
+  load_ext_setting = ""
+  for dep in load_extn_list(test_extn, compat_extn, loaded_extns):
+    load_ext_setting += "--load-extension=" + dep + " "
   return load_ext_setting
 
+# The in-process runner handles plain test lists; anything that needs the
+# shell around pg_regress (launchers, env, before_test_scripts) or other
+# pg_regress options goes to pg_regress.
+def can_run_in_process(test_extn_entry):
+  if not use_sql_regress or "env" in test_extn_entry or "before_test_scripts" in test_extn_entry:
+    return False
+  for elem in test_extn_entry["pg_regress"].get("options", []):
+    if not elem.startswith("--load-extension="):
+      return False
+  return True
+
 def pg_regress_test(test_extn, compat_extn, test_extn_dir, terminal_file):
   print("Testing " + test_extn + "...")
   val = True
@@ -305,6 +738,13 @@ def pg_regress_test(test_extn, compat_extn, test_extn_dir, terminal_file):
     if elem + ".out" not in expected_files_list:
       sys.exit(elem + ".out file does not exist in expected files list")
 
+  if coverage_select and compat_extn != "" and not coverage_selection.is_full_run(test_extn, compat_extn, full_run_interval):
+    test_extn_deps = get_dependencies(test_extn) + [test_extn]
+    partner_extns = list(filter(lambda x: x not in test_extn_deps, get_dependencies(compat_extn) + [compat_extn]))
+    selected_tests = coverage_selection.select_tests(test_extn, test_list, test_pg_regress_entry, partner_extns, coverage_map, coverage_hooks)
+    print("Running " + str(len(selected_tests)) + "/" + str(len(test_list)) + " tests of " + test_extn + " selected by the hooks of " + compat_extn + ": " + " ".join(selected_tests))
+    test_list = selected_tests
+
   pg_regress_cmd = current_working_dir + "/" + pg_dist_dir + "/lib/postgresql/pgxs/src/test/regress/pg_regress"
   output_dir = testing_output_dir + "/" + test_extn_dir
   input_dir_setting = "--inputdir=" + test_pg_regress_entry["input_dir"]
@@ -355,10 +795,27 @@ def pg_regress_test(test_extn, compat_extn, test_extn_dir, terminal_file):
     env_txt = " && ".join(env_var_list)
     total_command = env_txt + " && " + total_command
 
-  test_res = subprocess.run(total_command, shell=True, cwd=run_test_dir, stdout=terminal_file, stderr=terminal_file)
-  if test_res.returncode == 0:
+  returncode = None
+  if can_run_in_process(test_extn_entry):
+    load_extns = loaded_extns + (load_extn_list(test_extn, compat_extn, loaded_extns) if compat_extn != "" else [])
+    if sql_regress.run_tests(current_working_dir + "/" + pg_dist_dir, port_num, current_working_dir + "/" + input_dir, test_list, load_extns, log=terminal_file):
+      returncode = 0
+    else:
+      print("Falling back to pg_regress for " + test_extn + "...")
+    terminal_file.flush()
+
+  if returncode is None:
+    returncode = subprocess.run(total_command, shell=True, cwd=run_test_dir, stdout=terminal_file, stderr=terminal_file).returncode
+  # Diffs that only differ in log prefixes, temporary paths or ports aren't
+  # failures, for extensions that opt in.
+  if returncode == 1 and test_extn_entry.get("normalize_output", False) and output_normalizer.diff_file_is_spurious(run_test_dir + "/regression.diffs"):
+    print("Differences for extension " + test_extn + " are only run-specific values.")
+    terminal_file.write("regression.diffs is equal after normalization, counting as passed\n")
+    log_suppressed_diff(run_test_dir + "/regression.diffs", test_extn, compat_extn, terminal_file)
+    returncode = 0
+  if returncode == 0:
     print("Tests for extension " + test_extn + " passed!")
-  elif test_res.returncode == 1:
+  elif returncode == 1:
     print("Tests for extension " + test_extn + " failed!")
     val = False
     subprocess.run("cp -R results " + current_working_dir + "/" + output_dir, shell=True, cwd=run_test_dir,  stdout=terminal_file, stderr=terminal_file)
@@ -367,7 +824,7 @@ def pg_regress_test(test_extn, compat_extn, test_extn_dir, terminal_file):
     subprocess.run("cp logfile " + current_working_dir + "/" + output_dir, shell=True, cwd=current_working_dir,  stdout=terminal_file, stderr=terminal_file)
     if exit_flag: 
       sys.exit("Exiting out of pgext-analyzer...")
-  elif test_res.returncode == 2:
+  elif returncode == 2:
     print("Tests for extension " + test_extn + " could not run!")
     val = False
     subprocess.run("cp logfile " + current_working_dir + "/" + output_dir, shell=True, cwd=current_working_dir,  stdout=terminal_file, stderr=terminal_file)
@@ -381,6 +838,16 @@ def pg_regress_test(test_extn, compat_extn, test_extn_dir, terminal_file):
  
   return val
 
+def log_suppressed_diff(diff_path, test_extn, compat_extn, terminal_file):
+  suppressed_file = open(current_working_dir + "/" + suppressed_diffs_file, "a")
+  output_normalizer.log_suppressed_diff(diff_path, test_extn + " (with " + (compat_extn if compat_extn != "" else "no other extension") + ")", [terminal_file, suppressed_file])
+  suppressed_file.close()
+
+def tee_lines(lines, terminal_file):
+  for line in lines:
+    terminal_file.write(line)
+    yield line
+
 def custom_script_test(test_extn, compat_extn, test_extn_dir, terminal_file):
   # compare output to the expected
   # return true or false depending on this output
@@ -428,23 +895,23 @@ def custom_script_test(test_extn, compat_extn, test_extn_dir, terminal_file):
     total_command = env_txt + " && " + total_command
 
   # Run testing command
-  test_proc = subprocess.run(total_command, shell=True, cwd=extn_source_dir, capture_output=True)
-  terminal_file.write(test_proc.stdout.decode('utf-8'))
   expected_output_file = open(current_working_dir + "/extn_test_results/" + expected_output_file_name, "r")
   expected_output = expected_output_file.read()
-  test_output = test_proc.stdout.decode('utf-8')
+  expected_output_file.close()
   expected_location = custom_test_script["expected_location"]
 
-  test_broken = True
-  if expected_location == "beginning":
-    if test_output.startswith(expected_output):
-      test_broken = False
-  elif expected_location == "end":
-    if test_output.endswith(expected_output):
-      test_broken = False
-  elif expected_location == "all":
-    if test_output == expected_output:
-      test_broken = False
+  # Output is streamed to the terminal file and compared after normalization
+  test_proc = subprocess.Popen(total_command, shell=True, cwd=extn_source_dir, stdout=subprocess.PIPE, stderr=terminal_file, text=True, errors="replace")
+  normalize_output = test_extn_entry.get("normalize_output", False)
+  test_broken = not output_normalizer.matches_expected(tee_lines(test_proc.stdout, terminal_file), expected_output, expected_location, normalize_output)
+  test_proc.wait()
+
+  if test_broken and normalize_output:
+    for fail_file in custom_test_script["fail_files"]:
+      if os.path.basename(fail_file) == "regression.diffs" and output_normalizer.diff_file_is_spurious(extn_source_dir + "/" + fail_file):
+        print("Differences for extension " + test_extn + " are only run-specific values.")
+        log_suppressed_diff(extn_source_dir + "/" + fail_file, test_extn, compat_extn, terminal_file)
+        test_broken = False
 
   if (test_broken):
     print("Tests for extension " + test_extn + " failed!")
@@ -462,26 +929,47 @@ def custom_script_test(test_extn, compat_extn, test_extn_dir, terminal_file):
   print("Tests for extension " + test_extn + " passed!")
   return True
 
+# pgbench data is generated into a template database, which pgbench runs
+# clone. The extensions are created before `pgbench -i`, as they were when
+# every run loaded its own database, so their event triggers and hooks see the
+# pgbench tables being created and loaded. Creation order can matter, so there
+# is one template per order. Checking the catalog (instead of a flag) means a
+# fresh cluster from init_db always gets new templates.
+def create_pgbench_template(extns_to_create, terminal_file):
+  template_db = pgbench_template_db + "_" + hashlib.md5(" ".join(extns_to_create).encode("utf-8")).hexdigest()[:8]
+  res = subprocess.run("./" + pg_dist_dir + "/bin/psql --port=" + str(port_num) + " -X -tA -c \"SELECT 1 FROM pg_database WHERE datname = '" + template_db + "';\" postgres", shell=True, cwd=current_working_dir, capture_output=True)
+  if res.stdout.strip() == b"1":
+    return template_db
+
+  print("Creating pgbench template database...")
+  subprocess.run("./" + pg_dist_dir + "/bin/createdb -p " + str(port_num) + " " + template_db, shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+  # All extensions are created in one psql session.
+  create_extns_sql = ""
+  for extn in extns_to_create:
+    create_extns_sql += "CREATE EXTENSION " + extn + ";\n"
+  if create_extns_sql != "":
+    subprocess.run("./" + pg_dist_dir + "/bin/psql --port=" + str(port_num) + " -X -f - " + template_db, input=create_extns_sql.encode("utf-8"), shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+  subprocess.run("./" + pg_dist_dir + "/bin/pgbench -i -s 10 -p " + str(port_num) + " " + template_db, shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+  return template_db
+
+# Extensions of a pair (with dependencies) that CREATE EXTENSION applies to,
+# in creation order.
+def get_extns_to_create(first_extn, second_extn):
+  extns_to_create = []
+  for dep in get_dependencies(first_extn) + [first_extn] + get_dependencies(second_extn) + [second_extn]:
+    if dep not in extns_to_create and "no_create_extn" not in extn_db[dep]:
+      extns_to_create.append(dep)
+  return extns_to_create
+
 def pgbench_test(test_extn, compat_extn, terminal_file):
    # Create and load database with extensions
   val = True
-  subprocess.run("./" + pg_dist_dir + "/bin/createdb -p " + str(port_num) + " pgbench_test", shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
-  extns_to_load = []
-  for dep in get_dependencies(test_extn) + [test_extn]:
-    if dep not in extns_to_load:
-      extns_to_load.append(dep)
-
-  for dep in get_dependencies(compat_extn) + [compat_extn]:
-    if dep not in extns_to_load:
-      extns_to_load.append(dep)
-
-  for extn in extns_to_load:
-    extn_entry = extn_db[extn]
-    if "no_create_extn" not in extn_entry:
-      subprocess.run("./" + pg_dist_dir + "/bin/psql --port=" + str(port_num) + " -c \"CREATE EXTENSION " + extn + ";\" pgbench_test", shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+  start_time = time.time()
+  template_db = create_pgbench_template(get_extns_to_create(test_extn, compat_extn), terminal_file)
+  # FILE_COPY copies the template's files instead of WAL-logging every block.
+  subprocess.run("./" + pg_dist_dir + "/bin/psql --port=" + str(port_num) + " -X -c \"CREATE DATABASE pgbench_test TEMPLATE " + template_db + " STRATEGY FILE_COPY;\" postgres", shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
 
   # Run pgbench
-  subprocess.run("./" + pg_dist_dir + "/bin/pgbench -i -s 10 -p " + str(port_num) + " pgbench_test", shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
   res = subprocess.run("./" + pg_dist_dir + "/bin/pgbench -p " + str(port_num) + " --no-vacuum  -T 30 -j 8 pgbench_test", shell=True, cwd=current_working_dir, capture_output=True)
   if res.returncode == 0:
     res_output = res.stdout.splitlines()
@@ -495,8 +983,75 @@ def pgbench_test(test_extn, compat_extn, terminal_file):
     val = False
 
   subprocess.run("./" + pg_dist_dir + "/bin/dropdb -p " + str(port_num) +  " pgbench_test", shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+  record_phase_duration(test_extn, duration_store.PGBENCH, start_time)
   return val
 
+# Calls one function the extension created, found through pg_depend once the
+# extension exists: one that can be called without arguments, preferring
+# functions that return something and don't modify anything. psql runs the
+# generated call with \gexec; nothing runs if there is no such function.
+def get_smoke_function_sql(extn):
+  return ("SELECT format('SELECT count(*) FROM %I.%I();', n.nspname, p.proname)"
+    " FROM pg_depend d"
+    " JOIN pg_extension e ON d.refclassid = 'pg_extension'::regclass AND d.refobjid = e.oid"
+    " JOIN pg_proc p ON d.classid = 'pg_proc'::regclass AND d.objid = p.oid"
+    " JOIN pg_namespace n ON p.pronamespace = n.oid"
+    " WHERE e.extname = '" + extn + "' AND d.deptype = 'e' AND p.prokind = 'f'"
+    " AND p.pronargs = p.pronargdefaults"
+    " AND p.prorettype NOT IN ('trigger'::regtype, 'event_trigger'::regtype, 'internal'::regtype, 'language_handler'::regtype, 'fdw_handler'::regtype, 'index_am_handler'::regtype, 'table_am_handler'::regtype, 'tsm_handler'::regtype)"
+    " AND NOT (p.prorettype = 'record'::regtype AND p.proallargtypes IS NULL)"
+    " ORDER BY p.prorettype = 'void'::regtype, p.provolatile = 'v', p.proname LIMIT 1 \\gexec\n")
+
+# Seconds-long check that the pair works at all: the server came up with both
+# extensions preloaded, both can be created in a fresh database, and a
+# function of each runs. Extensions can give their own query with
+# "smoke_query" in extn_info; by default one of their functions is called (see
+# get_smoke_function_sql). Extensions that can only be created in a specific
+# database ("smoke_restricted", e.g. pg_cron) only get the server check.
+def smoke_test(first_extn, second_extn, test_extn_dir, terminal_file):
+  print("Smoke testing " + first_extn + " and " + second_extn + "...")
+  psql_cmd = "./" + pg_dist_dir + "/bin/psql --port=" + str(port_num) + " -X -v ON_ERROR_STOP=1"
+  res = subprocess.run(psql_cmd + " -c \"SELECT 1;\" postgres", shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+  restricted_extns = list(filter(lambda x: extn_db[x].get("smoke_restricted", False), get_extns_to_create(first_extn, second_extn)))
+  if res.returncode == 0 and len(restricted_extns) > 0:
+    print("Skipping smoke queries, " + " and ".join(restricted_extns) + " can't be created in " + smoke_db)
+  elif res.returncode == 0:
+    subprocess.run(psql_cmd + " -c \"DROP DATABASE IF EXISTS " + smoke_db + ";\" -c \"CREATE DATABASE " + smoke_db + ";\" postgres", shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+    smoke_sql = ""
+    for extn in get_extns_to_create(first_extn, second_extn):
+      smoke_sql += "CREATE EXTENSION " + extn + ";\n"
+    for extn in [first_extn, second_extn]:
+      extn_entry = extn_db[extn]
+      if "smoke_query" in extn_entry:
+        smoke_sql += extn_entry["smoke_query"] + "\n"
+      elif "no_create_extn" not in extn_entry:
+        smoke_sql += "SELECT extname, extversion FROM pg_extension WHERE extname = '" + extn + "';\n"
+        smoke_sql += get_smoke_function_sql(extn)
+    res = subprocess.run(psql_cmd + " -f - " + smoke_db, input=smoke_sql.encode("utf-8"), shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+    subprocess.run(psql_cmd + " -c \"DROP DATABASE IF EXISTS " + smoke_db + ";\" postgres", shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+
+  if res.returncode == 0:
+    return True
+
+  print("Smoke test for " + first_extn + " and " + second_extn + " failed!")
+  subprocess.run("cp logfile " + testing_output_dir + "/" + test_extn_dir, shell=True, cwd=current_working_dir, stdout=terminal_file, stderr=terminal_file)
+  if exit_flag:
+    sys.exit("Exiting out of pgext-analyzer...")
+  return False
+
+# Runs test_extn's own test suite with compat_extn loaded and records how long
+# it took.
+def extn_suite_test(test_extn, compat_extn, test_extn_dir, terminal_file):
+  start_time = time.time()
+  res = True
+  test_type = extn_db[test_extn]["test_method"]
+  if test_type == "pg_regress":
+    res = pg_regress_test(test_extn, compat_extn, test_extn_dir, terminal_file)
+  elif test_type == "custom_test_script":
+    res = custom_script_test(test_extn, compat_extn, test_extn_dir, terminal_file)
+  record_phase_duration(test_extn, duration_store.SUITE, start_time)
+  return res
+
 def compatibility_test(first_extn, second_extn, test_extn_dir, terminal_file):
   print("Running compatibility testing for " + first_extn + " and " + second_extn)
   val = True
@@ -504,25 +1059,18 @@ def compatibility_test(first_extn, second_extn, test_extn_dir, terminal_file):
   # Post install scripts
   post_install_extn_pair(first_extn, second_extn, terminal_file)
 
+  if smoke_stage and not smoke_test(first_extn, second_extn, test_extn_dir, terminal_file):
+    return False
+
   first_extn_entry = extn_db[first_extn]
   second_extn_entry = extn_db[second_extn]
   if "test_method" in first_extn_entry:
-    first_test_type = first_extn_entry["test_method"]
-    if first_test_type == "pg_regress":
-      res = pg_regress_test(first_extn, second_extn, test_extn_dir, terminal_file)
-      val = val and res
-    elif first_test_type == "custom_test_script":
-      res = custom_script_test(first_extn, second_extn, test_extn_dir, terminal_file)
-      val = val and res
+    res = extn_suite_test(first_extn, second_extn, test_extn_dir, terminal_file)
+    val = val and res
 
   if "test_method" in second_extn_entry:
-    second_test_type = second_extn_entry["test_method"]
-    if second_test_type == "pg_regress":
-      res = pg_regress_test(second_extn, first_extn, test_extn_dir, terminal_file)
-      val = val and res
-    elif second_test_type == "custom_test_script":
-      res = custom_script_test(second_extn, first_extn, test_extn_dir, terminal_file)
-      val = val and res
+    res = extn_suite_test(second_extn, first_extn, test_extn_dir, terminal_file)
+    val = val and res
 
   if not val:
     return False
@@ -567,30 +1115,60 @@ def pairwise_validation_helper(file_extns_list):
     if "install_method" not in extn_entry:
       sys.exit("Extension " + extn + " cannot be installed.")
 
-def pairwise_testing_helper(file_extn_pairs):
-  initial_setup()
-  extn_compat_list = []
-  current_configure_options = []
-  install_postgres(current_configure_options)
+def plan_minimal_builds(file_extn_pairs):
+  if not minimal_builds:
+    return
+  builds, assignment = build_planner.plan_builds(file_extn_pairs, extn_db)
+  build_plan.update(assignment)
+  print("Testing " + str(len(file_extn_pairs)) + " pairs on " + str(len(builds)) + " Postgres build(s)")
+
+# Builds the Postgres variants of all pairs before any pair is tested, so that
+# switching between configure options later only costs an install.
+def build_pair_variants(file_extn_pairs):
+  variants = [([], [])]
   for (first_extn, second_extn) in file_extn_pairs:
-    print("Determining compatibility betweeen " + first_extn + " and " + second_extn)
-    
-    # Get a list of extensions to download and install
-    extns_to_install = get_extns_to_install([first_extn, second_extn])
-    current_configure_options = reinstall_postgres(extns_to_install, current_configure_options)
-    test_extn_dir, terminal_file = get_terminal_file(first_extn, second_extn)
-
+    variants.append((get_pair_configure_options(first_extn, second_extn), get_contrib_folders(get_extns_to_install([first_extn, second_extn]))))
+  build_postgres_variants(variants)
+
+# Installs, starts and tests a single pair. Postgres is only rebuilt when the
+# pair needs different configure options. Returns (compatible, configure options).
+def run_pair_test(first_extn, second_extn, current_configure_options):
+  print("Determining compatibility betweeen " + first_extn + " and " + second_extn)
+  start_time = time.time()
+
+  # Get a list of extensions to download and install
+  extns_to_install = get_extns_to_install([first_extn, second_extn])
+  test_extn_dir, terminal_file = get_terminal_file(first_extn, second_extn)
+  if staged_installs:
+    current_configure_options = install_pair_staged(extns_to_install, get_pair_configure_options(first_extn, second_extn), terminal_file)
+  else:
+    current_configure_options = reinstall_postgres(extns_to_install, current_configure_options, get_pair_configure_options(first_extn, second_extn))
     for extn in extns_to_install:
       download_install_extn(extn, extn_db[extn], terminal_file)
 
-    init_db(terminal_file)
-    modify_postgresql_conf(extns_to_install)
-    start_postgres(terminal_file)
+  init_db(terminal_file)
+  modify_postgresql_conf(extns_to_install)
+  start_postgres(terminal_file)
 
-    extn_compat_list.append(compatibility_test(first_extn, second_extn, test_extn_dir, terminal_file))
-    stop_postgres(terminal_file)
-    terminal_file.close()
-    cleanup()
+  result = compatibility_test(first_extn, second_extn, test_extn_dir, terminal_file)
+  stop_postgres(terminal_file)
+  terminal_file.close()
+  # Staged installs keep the sources so later pairs can reuse the stages.
+  cleanup(not staged_installs)
+  record_pair_result(first_extn, second_extn, result, start_time)
+  return result, current_configure_options
+
+def pairwise_testing_helper(file_extn_pairs):
+  initial_setup()
+  start_run_progress(file_extn_pairs)
+  build_pair_variants(file_extn_pairs)
+  extn_compat_list = []
+  current_configure_options = []
+  if not staged_installs:
+    install_postgres(current_configure_options)
+  for (first_extn, second_extn) in file_extn_pairs:
+    result, current_configure_options = run_pair_test(first_extn, second_extn, current_configure_options)
+    extn_compat_list.append(result)
   
   delete_working_pairs(file_extn_pairs, extn_compat_list)
   final_cleanup()
@@ -598,40 +1176,176 @@ def pairwise_testing_helper(file_extn_pairs):
 
 def pairwise_parallel_testing_helper(file_extn_pairs, file_extn_list, install_at_once=False):
   initial_setup()
+  start_run_progress(file_extn_pairs)
   extn_compat_list = []
 
-  if install_at_once:
+  if not install_at_once or staged_installs:
+    build_pair_variants(file_extn_pairs)
+  if install_at_once and not staged_installs:
     install_postgres(get_configure_options(file_extn_list))
     download_install_extn_list(file_extn_list)
 
   # TODO: this does not work for Citus?
   for (first_extn, second_extn) in file_extn_pairs:
     print("Determining compatibility betweeen " + first_extn + " and " + second_extn)
+    start_time = time.time()
     extns_to_install = get_extns_to_install([first_extn, second_extn])
 
-    if not install_at_once:
+    test_extn_dir, terminal_file = get_terminal_file(first_extn, second_extn)
+    if staged_installs:
+      install_pair_staged(extns_to_install, get_pair_configure_options(first_extn, second_extn), terminal_file)
+    elif not install_at_once:
       if os.path.exists(current_working_dir + "/" + pg_dist_dir):
         subprocess.run("rm -rf " + pg_dist_dir, cwd=current_working_dir, shell=True)
-      install_postgres(get_configure_options(extns_to_install))
+      install_postgres(get_pair_configure_options(first_extn, second_extn))
       download_install_extn_list(extns_to_install)
 
-    test_extn_dir, terminal_file = get_terminal_file(first_extn, second_extn)
-
     init_db(terminal_file)
     modify_postgresql_conf(extns_to_install)
     start_postgres(terminal_file)
 
     # Run tests
-    extn_compat_list.append(compatibility_test(first_extn, second_extn, test_extn_dir, terminal_file))
+    result = compatibility_test(first_extn, second_extn, test_extn_dir, terminal_file)
+    extn_compat_list.append(result)
+    record_pair_result(first_extn, second_extn, result, start_time)
     stop_postgres(terminal_file)
     terminal_file.close()
-    cleanup_var = not install_at_once
+    cleanup_var = not install_at_once and not staged_installs
     cleanup(cleanup_var)
   
   delete_working_pairs(file_extn_pairs, extn_compat_list)
   final_cleanup()
   return extn_compat_list
 
+#####################################################################
+# PIPELINED PAIRWISE TESTING
+#####################################################################
+
+def get_pipeline_root():
+  if ram_profile:
+    return get_ram_work_dir() + "/" + pipeline_dir
+  return current_working_dir + "/" + pipeline_dir
+
+def get_slot_dir(slot):
+  return get_pipeline_root() + "/slot" + str(slot)
+
+def get_pipeline_base_prefix(configure_options):
+  return get_pipeline_root() + "/" + pipeline_base_dist_dir + "-" + get_variant_name(configure_options)
+
+def activate_slot(slot, configure_options):
+  slot_dir = get_slot_dir(slot)
+  if staged_installs:
+    # Sources live in the variant, only the composed prefix is per slot.
+    select_variant(configure_options)
+    activate_prefix(get_variant_dir(configure_options), slot_dir + "/" + pg_dist_dir)
+    return
+  for dir in [pg_dist_dir, ext_work_dir]:
+    subprocess.run("ln -sfn " + slot_dir + "/" + dir + " " + dir, cwd=current_working_dir, shell=True)
+
+# Resets a slot to a fresh copy of the pair's base Postgres install and builds
+# the pair's extensions into it.
+def prepare_pair_slot(first_extn, second_extn, slot):
+  slot_dir = get_slot_dir(slot)
+  subprocess.run("rm -rf " + slot_dir + " && mkdir -p " + slot_dir + "/" + ext_work_dir, cwd=current_working_dir, shell=True)
+  link_data_dir(slot_dir)
+
+  _, terminal_file = get_terminal_file(first_extn, second_extn)
+  start = datetime.now()
+  extns_to_install = get_extns_to_install([first_extn, second_extn])
+  configure_options = get_pair_configure_options(first_extn, second_extn)
+  if staged_installs:
+    prepare_variant(configure_options)
+    compose_pair_prefix(extns_to_install, get_variant_dir(configure_options), slot_dir + "/" + pg_dist_dir, terminal_file)
+  else:
+    base_prefix = get_pipeline_base_prefix(configure_options)
+    if not os.path.exists(base_prefix + "/bin/pg_config"):
+      install_postgres(configure_options, base_prefix)
+    subprocess.run("cp -a " + base_prefix + " " + slot_dir + "/" + pg_dist_dir, cwd=current_working_dir, shell=True)
+    for extn in extns_to_install:
+      download_install_extn(extn, extn_db[extn], terminal_file, slot_dir + "/" + ext_work_dir, slot_dir + "/" + pg_dist_dir)
+  terminal_file.close()
+  print("Built " + first_extn + " and " + second_extn + " in slot " + str(slot) + " (" + str(round((datetime.now() - start).total_seconds(), 1)) + "s)")
+
+# Records in slot_ok whether the slot was built. The install helpers call
+# sys.exit on failure, which would otherwise end the builder thread silently and
+# leave the pair to be tested against a half-built slot.
+def try_prepare_pair_slot(first_extn, second_extn, slot, slot_ok):
+  try:
+    prepare_pair_slot(first_extn, second_extn, slot)
+    slot_ok[slot] = True
+  except (SystemExit, Exception) as e:
+    print("Building " + first_extn + " and " + second_extn + " in slot " + str(slot) + " failed: " + str(e))
+    slot_ok[slot] = False
+
+# With staged installs, shell_script extensions are built against the variant's
+# active pg-15-dist (../../pg-15-dist), which may belong to the pair under test,
+# so they can't be staged in the background.
+def can_build_in_background(first_extn, second_extn):
+  if not staged_installs:
+    return True
+  variant_dir = get_variant_dir(get_pair_configure_options(first_extn, second_extn))
+  for extn in get_extns_to_install([first_extn, second_extn]):
+    if extn_db[extn]["install_method"] == "shell_script" and not is_staged(extn, variant_dir):
+      return False
+  return True
+
+def pairwise_pipelined_testing_helper(file_extn_pairs):
+  initial_setup()
+  start_run_progress(file_extn_pairs)
+  build_pair_variants(file_extn_pairs)
+  # pg-15-dist and pgextworkdir become symlinks to the active slot.
+  subprocess.run("rm -rf " + ext_work_dir + " && mkdir -p " + get_pipeline_root(), cwd=current_working_dir, shell=True)
+  extn_compat_list = []
+  slot_ok = {}
+
+  activate_slot(0, get_pair_configure_options(file_extn_pairs[0][0], file_extn_pairs[0][1]))
+  try_prepare_pair_slot(file_extn_pairs[0][0], file_extn_pairs[0][1], 0, slot_ok)
+
+  for i in range(0, len(file_extn_pairs)):
+    (first_extn, second_extn) = file_extn_pairs[i]
+    print("Determining compatibility betweeen " + first_extn + " and " + second_extn)
+    start_time = time.time()
+    activate_slot(i % num_pipeline_slots, get_pair_configure_options(first_extn, second_extn))
+
+    # Build the next pair in the other slot while this one is tested. Postgres
+    # variants are built out of tree up front, so this works across different
+    # configure options as well.
+    builder = None
+    next_slot = (i + 1) % num_pipeline_slots
+    if i + 1 < len(file_extn_pairs):
+      (next_first_extn, next_second_extn) = file_extn_pairs[i + 1]
+      if can_build_in_background(next_first_extn, next_second_extn):
+        builder = threading.Thread(target=try_prepare_pair_slot, args=(next_first_extn, next_second_extn, next_slot, slot_ok))
+        builder.start()
+
+    extns_to_install = get_extns_to_install([first_extn, second_extn])
+    test_extn_dir, terminal_file = get_terminal_file(first_extn, second_extn)
+    if slot_ok[i % num_pipeline_slots]:
+      init_db(terminal_file)
+      modify_postgresql_conf(extns_to_install)
+      start_postgres(terminal_file)
+
+      result = compatibility_test(first_extn, second_extn, test_extn_dir, terminal_file)
+      stop_postgres(terminal_file)
+    else:
+      # The slot's build failed (see the builder's output); the pair fails.
+      result = False
+    terminal_file.close()
+    cleanup(not staged_installs)
+    extn_compat_list.append(result)
+    record_pair_result(first_extn, second_extn, result, start_time, not slot_ok[i % num_pipeline_slots])
+
+    if builder is not None:
+      builder.join()
+    elif i + 1 < len(file_extn_pairs):
+      activate_slot(next_slot, get_pair_configure_options(next_first_extn, next_second_extn))
+      try_prepare_pair_slot(next_first_extn, next_second_extn, next_slot, slot_ok)
+
+  delete_working_pairs(file_extn_pairs, extn_compat_list)
+  final_cleanup()
+  subprocess.run("rm -rf " + get_pipeline_root(), cwd=current_working_dir, shell=True)
+  return extn_compat_list
+
 def pairwise_mode(file_extns_filename):
   file_extns_list = get_file_extns_list(file_extns_filename)
   pairwise_validation_helper(file_extns_list)
@@ -644,8 +1358,12 @@ def pairwise_mode(file_extns_filename):
         continue
       else:
         file_extn_pairs.append((first_item, second_item))
+  plan_minimal_builds(file_extn_pairs)
   
-  extn_compat_list = pairwise_testing_helper(file_extn_pairs)
+  if pipeline:
+    extn_compat_list = pairwise_pipelined_testing_helper(file_extn_pairs)
+  else:
+    extn_compat_list = pairwise_testing_helper(file_extn_pairs)
   for i in range(len(extn_compat_list)):
     print(str(file_extn_pairs[i]) + ": " + str(extn_compat_list[i]))
 
@@ -673,7 +1391,11 @@ def pairwise_parallel_mode(file_extns_filename):
   file_extns_list = [item for sublist in file_extns_list for item in sublist]
   file_extns_list = list(set(file_extns_list))
   pairwise_validation_helper(file_extns_list)
-  extn_compat_list = pairwise_parallel_testing_helper(file_extn_pairs, file_extns_list)
+  plan_minimal_builds(file_extn_pairs)
+  if pipeline:
+    extn_compat_list = pairwise_pipelined_testing_helper(file_extn_pairs)
+  else:
+    extn_compat_list = pairwise_parallel_testing_helper(file_extn_pairs, file_extns_list)
   for i in range(len(extn_compat_list)):
     print(str(file_extn_pairs[i]) + ": " + str(extn_compat_list[i]))
   compat_csv_file = open("pairwise_parallel.csv", "w")
@@ -684,6 +1406,57 @@ def pairwise_parallel_mode(file_extns_filename):
   
   compat_csv_file.close()
 
+def pairwise_queue_mode(file_extns_filename, queue_path):
+  # All workers record into the duration store next to the queue file.
+  global durations_db
+  durations_db = work_queue.get_durations_db_path(queue_path)
+  file_extn_pairs = get_file_extn_pairs_list(file_extns_filename)
+  file_extns_list = list(set([extn for pair in file_extn_pairs for extn in pair]))
+  pairwise_validation_helper(file_extns_list)
+  plan_minimal_builds(file_extn_pairs)
+
+  # The first worker to arrive creates the queue; the others join it.
+  pair_options = {}
+  pair_builds = {}
+  for (first_extn, second_extn) in file_extn_pairs:
+    pair_options[(first_extn, second_extn)] = get_pair_configure_options(first_extn, second_extn)
+    pair_builds[(first_extn, second_extn)] = get_pair_pg_build(first_extn, second_extn)
+  if work_queue.create_queue(queue_path, file_extn_pairs, pair_options, pair_builds, get_extn_versions(file_extn_pairs), extn_db):
+    print("Created work queue " + queue_path + " with " + str(len(file_extn_pairs)) + " pairs")
+
+  worker_id = socket.gethostname() + ":" + str(port_num)
+  initial_setup()
+  build_pair_variants(file_extn_pairs)
+  current_configure_options = []
+  if not staged_installs:
+    install_postgres(current_configure_options)
+  tested_pairs = []
+  extn_compat_list = []
+  while True:
+    entry = work_queue.steal_pair(queue_path, worker_id, sorted(current_configure_options))
+    if entry is None:
+      break
+
+    first_extn = entry["first"]
+    second_extn = entry["second"]
+    result, current_configure_options = run_pair_test(first_extn, second_extn, current_configure_options)
+    work_queue.complete_pair(queue_path, entry, result)
+    tested_pairs.append((first_extn, second_extn))
+    extn_compat_list.append(result)
+
+    pending, running, done, remaining = work_queue.get_queue_progress(queue_path)
+    print("Queue: " + str(pending) + " pending, " + str(running) + " running, " + str(done) + " done, ~" + str(round(remaining / 60)) + " min of work left")
+
+  delete_working_pairs(tested_pairs, extn_compat_list)
+  final_cleanup()
+
+  # Same format as pairwise-parallel mode, so util/parallel_csv.py can merge it.
+  compat_csv_file = open("pairwise_parallel.csv", "w")
+  writer = csv.writer(compat_csv_file)
+  for i in range(0, len(extn_compat_list)):
+    writer.writerow([tested_pairs[i][0], tested_pairs[i][1], str(extn_compat_list[i])])
+  compat_csv_file.close()
+
 #####################################################################
 # SINGLE TESTING MODE
 #####################################################################
@@ -752,6 +1525,17 @@ if __name__ == '__main__':
   parser.add_argument('-m', '--mode', action='store', help='Determine whether to run compatibility testing or single extension testing.')
   parser.add_argument('-p', '--port', action='store', help='Optional port number (default is 5432)')
   parser.add_argument('-x', '--exit-flag', action='store_true', help='Changes the value of the exit flag, which determines whether this program exits after failed tests.')
+  parser.add_argument('-q', '--queue', action='store', help='Shared work queue file used by pairwise-queue mode.')
+  parser.add_argument('--pipeline', action='store_true', help='In pairwise and pairwise-parallel mode, builds the next pair while the current pair is tested.')
+  parser.add_argument('--staged-installs', action='store_true', help='In pairwise modes, installs each extension once into its own staging prefix and composes every pair\'s install from them.')
+  parser.add_argument('--minimal-builds', action='store_true', help='In pairwise modes, runs pairs on the minimal set of Postgres builds computed by build_planner.py.')
+  parser.add_argument('--sql-regress', action='store_true', help='Runs pg_regress tests in-process over one libpq connection, falling back to pg_regress unless all tests pass.')
+  parser.add_argument('--no-smoke', action='store_true', help='Skips the smoke stage that checks a pair can be loaded and created before running its test suites.')
+  parser.add_argument('--coverage-select', action='store', help='Coverage map (see coverage_selection.py) used to only run the pg_regress tests of a pair that reach the partner\'s hooks.')
+  parser.add_argument('--full-run-interval', action='store', help='With --coverage-select, 1 in this many pairs still runs all tests (default 10).')
+  parser.add_argument('--matrix', action='store', help='Compact matrix file (see matrix_store.py) that pair results are recorded in.')
+  parser.add_argument('-r', '--ram-profile', action='store_true', help='Places PGDATA and the extension work directory on tmpfs and disables durability settings.')
+  parser.add_argument('--ram-dir', action='store', help='tmpfs directory used by the RAM profile (default is /dev/shm)')
   args = parser.parse_args()
   args_dict = vars(args)
   extn_list_filename = args_dict['list']
@@ -770,10 +1554,32 @@ if __name__ == '__main__':
   if exit_flag_val is not None:
     exit_flag = exit_flag_val
 
+  ram_profile = args_dict['ram_profile']
+  ram_dir_str = args_dict['ram_dir']
+  if ram_dir_str is not None:
+    ram_dir = ram_dir_str
+
+  matrix_store_path = args_dict['matrix']
+  pipeline = args_dict['pipeline']
+  staged_installs = args_dict['staged_installs']
+  minimal_builds = args_dict['minimal_builds']
+  use_sql_regress = args_dict['sql_regress']
+  smoke_stage = not args_dict['no_smoke']
+  coverage_map_path = args_dict['coverage_select']
+  if coverage_map_path is not None:
+    coverage_select = True
+    coverage_map.update(coverage_selection.load_coverage_map(coverage_map_path))
+    coverage_hooks.update(coverage_selection.load_hooks())
+  if args_dict['full_run_interval'] is not None:
+    full_run_interval = int(args_dict['full_run_interval'])
+
+  start_time = datetime.now()
+
   # Four modes will be supported.
   # Single: testing a single extension
   # Pairwise: testing pairs of extensions. Single machine.
   # Pairwise parallel: testing pairs of extensions, in parallel.
+  # Pairwise queue: testing pairs stolen from a work queue shared by workers.
   # Combinatorial testing: testing via combinatorial table
   if mode == 'single':
     single_mode(extn_list_filename)
@@ -781,6 +1587,14 @@ if __name__ == '__main__':
     pairwise_mode(extn_list_filename)
   elif mode == 'pairwise-parallel':
     pairwise_parallel_mode(extn_list_filename)
+  elif mode == 'pairwise-queue':
+    queue_path = args_dict['queue']
+    if queue_path is None:
+      sys.exit("No queue parameter.")
+    pairwise_queue_mode(extn_list_filename, queue_path)
   elif mode == 'combinatorial':
     ### TODO: Support combinatorial mode
     print("Combinatorial mode not supported yet!")
+    sys.exit()
+
+  record_matrix_runtime(mode, extn_list_filename, start_time)
@@ -0,0 +1,273 @@
+# Coverage-guided test selection for pair testing. Most test files of a large
+# suite never reach the hooks the other extension of a pair installs, so
+# running them in pair mode rarely finds anything single mode didn't.
+#
+# A one-time profiling run builds Postgres with --enable-coverage (gcov; PGXS
+# builds of the extensions inherit the flags), runs every pg_regress test of
+# every extension on its own and records the functions each test executed in
+# coverage_map.json. Pair runs (--coverage-select in compatibility_analysis.py)
+# then only run the tests that executed a core function calling one of the
+# partner's hooks (as listed in hooks.csv, written by extension_info.py), plus
+# the extension's setup tests. A stable 1 in --full-run-interval sample of
+# pairs, rotating daily, still runs the full suite as a safety net.
+#
+# Functions that only run in background processes are flushed to gcov when
+# the server stops, so they aren't attributed to single tests.
+#
+# Usage:
+#   python3 coverage_selection.py profile --list=extn_lists/current_list.txt --port=5433
+#   python3 coverage_selection.py select pg_stat_statements pg_hint_plan
+
+import argparse
+import csv
+from datetime import date
+import json
+import os
+import re
+import subprocess
+import sys
+import zlib
+
+default_coverage_map_file = "coverage_map.json"
+default_hooks_file = "hooks.csv"
+default_full_run_interval = 10
+
+coverage_option = "--enable-coverage"
+
+# Core functions that call each hook (Postgres 15).
+hook_call_sites = {
+  "shmem_startup_hook": ["CreateSharedMemoryAndSemaphores"],
+  "shmem_request_hook": ["process_shmem_requests"],
+  "needs_fmgr_hook": ["fmgr_info_cxt_security", "inline_function", "inline_set_returning_function"],
+  "fmgr_hook": ["fmgr_security_definer"],
+  "explain_get_index_name_hook": ["explain_get_index_name"],
+  "ExplainOneQuery_hook": ["ExplainOneQuery"],
+  "get_attavgwidth_hook": ["get_attavgwidth"],
+  "get_index_stats_hook": ["examine_variable", "btcostestimate"],
+  "get_relation_info_hook": ["get_relation_info"],
+  "get_relation_stats_hook": ["examine_variable", "examine_simple_variable"],
+  "planner_hook": ["planner"],
+  "join_search_hook": ["make_rel_from_joinlist"],
+  "set_rel_pathlist_hook": ["set_rel_pathlist"],
+  "set_join_pathlist_hook": ["add_paths_to_joinrel"],
+  "create_upper_paths_hook": ["create_ordinary_grouping_paths", "create_partial_grouping_paths", "create_window_paths", "create_distinct_paths", "create_ordered_paths", "grouping_planner"],
+  "ExecutorStart_hook": ["ExecutorStart"],
+  "ExecutorRun_hook": ["ExecutorRun"],
+  "ExecutorFinish_hook": ["ExecutorFinish"],
+  "ExecutorEnd_hook": ["ExecutorEnd"],
+  "post_parse_analyze_hook": ["parse_analyze_fixedparams", "parse_analyze_varparams", "parse_analyze_withcb"],
+  "ProcessUtility_hook": ["ProcessUtility"],
+  "emit_log_hook": ["EmitErrorReport"],
+  "check_password_hook": ["CreateRole", "AlterRole"],
+  "ClientAuthentication_hook": ["ClientAuthentication"],
+  "ExecutorCheckPerms_hook": ["ExecCheckRTPerms"],
+  "object_access_hook": ["RunObjectPostCreateHook", "RunObjectDropHook", "RunObjectTruncateHook", "RunObjectPostAlterHook", "RunNamespaceSearchHook", "RunFunctionExecuteHook"],
+  "row_security_policy_hook_permissive": ["get_row_security_policies"],
+  "row_security_policy_hook_restrictive": ["get_row_security_policies"]
+}
+
+#####################################################################
+# COVERAGE MAP
+#####################################################################
+
+def load_coverage_map(path=default_coverage_map_file):
+  if not os.path.exists(path):
+    return {}
+  coverage_file = open(path, "r")
+  coverage_map = json.load(coverage_file)
+  coverage_file.close()
+  return coverage_map
+
+def write_coverage_map(coverage_map, path=default_coverage_map_file):
+  tmp_path = path + ".tmp"
+  coverage_file = open(tmp_path, "w")
+  json.dump(coverage_map, coverage_file, indent=2, sort_keys=True)
+  coverage_file.close()
+  os.replace(tmp_path, path)
+
+# Returns {extension: [hooks it installs]} from extension_info.py's hooks.csv.
+def load_hooks(path=default_hooks_file):
+  hooks = {}
+  if not os.path.exists(path):
+    return hooks
+  hooks_file = open(path, "r")
+  reader = csv.reader(hooks_file)
+  header = next(reader, [])
+  for row in reader:
+    hooks[row[0]] = [header[i] for i in range(1, len(row)) if row[i] == "Yes"]
+  hooks_file.close()
+  return hooks
+
+#####################################################################
+# SELECTION
+#####################################################################
+
+def get_hook_call_sites(partner_extns, hooks):
+  call_sites = set()
+  for extn in partner_extns:
+    for hook in hooks.get(extn, []):
+      call_sites |= set(hook_call_sites.get(hook, []))
+  return call_sites
+
+# Setup tests always run; they create the objects later tests use. They are
+# listed with "setup_tests" in extn_info, and default to the first test.
+def get_setup_tests(test_list, pg_regress_entry):
+  return pg_regress_entry.get("setup_tests", test_list[:1])
+
+# A stable sample of 1 in interval pairs that changes every day.
+def is_full_run(test_extn, compat_extn, interval=default_full_run_interval):
+  if interval <= 1:
+    return True
+  key = test_extn + " " + compat_extn + " " + date.today().isoformat()
+  return zlib.crc32(key.encode("utf-8")) % interval == 0
+
+# The non-setup test that executed the most functions, i.e. the one that
+# exercises the most of the extension with the partner loaded.
+def get_representative_test(test_list, setup_tests, test_coverage):
+  representative = None
+  for test in test_list:
+    if test in setup_tests:
+      continue
+    if representative is None or len(test_coverage[test]) > len(test_coverage[representative]):
+      representative = test
+  return representative
+
+# Returns the tests of test_list that executed a call site of one of the
+# partner extensions' hooks, in their original order, plus the setup tests.
+# If no test reaches the hooks, the representative test runs after the setup
+# tests, so a pair never passes without running a test of its own.
+# Returns test_list unchanged if the extension has no coverage profile.
+def select_tests(test_extn, test_list, pg_regress_entry, partner_extns, coverage_map, hooks):
+  if test_extn not in coverage_map:
+    return test_list
+  test_coverage = coverage_map[test_extn]
+  for test in test_list:
+    if test not in test_coverage:
+      return test_list
+  # Without hook data for the partner, nothing can be ruled out.
+  for extn in partner_extns:
+    if extn not in hooks:
+      return test_list
+
+  call_sites = get_hook_call_sites(partner_extns, hooks)
+  setup_tests = get_setup_tests(test_list, pg_regress_entry)
+  selected = []
+  for test in test_list:
+    if test in setup_tests or len(call_sites & set(test_coverage[test])) > 0:
+      selected.append(test)
+  if set(selected) <= set(setup_tests):
+    representative = get_representative_test(test_list, setup_tests, test_coverage)
+    selected = list(filter(lambda x: x in selected or x == representative, test_list))
+  return selected
+
+#####################################################################
+# PROFILING
+#####################################################################
+
+def reset_counters(dirs):
+  for dir in dirs:
+    subprocess.run("find . -name '*.gcda' -delete", shell=True, cwd=dir)
+
+# Functions with at least one executed line, from the .gcda files under dirs.
+def get_executed_functions(dirs):
+  functions = set()
+  for dir in dirs:
+    gcda_dirs = set()
+    for root, _, files in os.walk(dir):
+      if any(map(lambda x: x.endswith(".gcda"), files)):
+        gcda_dirs.add(root)
+    for gcda_dir in sorted(gcda_dirs):
+      res = subprocess.run("gcov -n -f -o . *.gcda", shell=True, cwd=gcda_dir, capture_output=True)
+      function_name = None
+      for line in res.stdout.decode("utf-8", errors="replace").splitlines():
+        match = re.match(r"^Function '(.*)'$", line)
+        if match:
+          function_name = match.group(1)
+          continue
+        match = re.match(r"^Lines executed:([\d.]+)% of \d+$", line)
+        if match and function_name is not None:
+          if float(match.group(1)) > 0:
+            functions.add(function_name)
+          function_name = None
+  return functions
+
+# Runs every pg_regress test of each extension on its own, on a coverage
+# build, and records the functions it executed. Tests run in list order
+# against one database (--use-existing after the first), so later tests still
+# see the objects earlier ones created.
+def profile(extn_list, coverage_map_path):
+  import compatibility_analysis as ca
+
+  coverage_map = load_coverage_map(coverage_map_path)
+  ca.initial_setup()
+  for extn in extn_list:
+    extn_entry = ca.extn_db[extn]
+    if extn_entry.get("test_method") != "pg_regress":
+      print("Skipping " + extn + ", only pg_regress tests can be profiled")
+      continue
+
+    print("Profiling tests of " + extn + "...")
+    extns_to_install = ca.get_extns_to_install([extn])
+    configure_options = ca.get_configure_options(extns_to_install) + [coverage_option]
+    subprocess.run("rm -rf " + ca.pg_dist_dir, cwd=ca.current_working_dir, shell=True)
+    ca.install_postgres(configure_options)
+    test_extn_dir, terminal_file = ca.get_terminal_file(extn + "-coverage")
+    for dep in extns_to_install:
+      ca.download_install_extn(dep, ca.extn_db[dep], terminal_file)
+    ca.init_db(terminal_file)
+    ca.modify_postgresql_conf(extns_to_install)
+    ca.start_postgres(terminal_file)
+
+    gcov_dirs = [ca.get_build_dir(configure_options), ca.current_working_dir + "/" + ca.ext_work_dir]
+    test_list = extn_entry["pg_regress"]["test_list"]
+    test_coverage = {}
+    for i in range(0, len(test_list)):
+      single_test_entry = json.loads(json.dumps(extn_entry))
+      single_test_entry["pg_regress"]["test_list"] = [test_list[i]]
+      if i > 0:
+        single_test_entry["pg_regress"]["options"] = single_test_entry["pg_regress"].get("options", []) + ["--use-existing"]
+      ca.extn_db[extn] = single_test_entry
+      reset_counters(gcov_dirs)
+      ca.pg_regress_test(extn, "", test_extn_dir, terminal_file)
+      test_coverage[test_list[i]] = sorted(get_executed_functions(gcov_dirs))
+      print("  " + test_list[i] + ": " + str(len(test_coverage[test_list[i]])) + " functions")
+    ca.extn_db[extn] = extn_entry
+
+    ca.stop_postgres(terminal_file)
+    terminal_file.close()
+    ca.cleanup()
+    coverage_map[extn] = test_coverage
+    write_coverage_map(coverage_map, coverage_map_path)
+
+  ca.final_cleanup()
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Coverage-guided test selection for pair testing.')
+  parser.add_argument('command', choices=['profile', 'select'])
+  parser.add_argument('args', nargs='*')
+  parser.add_argument('-l', '--list', action='store', help='text file with the extensions to profile')
+  parser.add_argument('-c', '--coverage-map', action='store', default=default_coverage_map_file, help='coverage map file (default coverage_map.json)')
+  parser.add_argument('--hooks', action='store', default=default_hooks_file, help='hooks.csv written by extension_info.py')
+  parser.add_argument('-p', '--port', action='store', help='Optional port number for profiling runs (default is 5432)')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['command'] == 'profile':
+    if args_dict['list'] is None:
+      sys.exit("No list argument parameter.")
+    import compatibility_analysis
+    if args_dict['port'] is not None:
+      compatibility_analysis.port_num = int(args_dict['port'])
+    list_file = open(args_dict['list'], "r")
+    extn_list = list(filter(lambda x: x != "", map(lambda x: x.strip("\n"), list_file.readlines())))
+    list_file.close()
+    profile(extn_list, args_dict['coverage_map'])
+  else:
+    if len(args_dict['args']) != 2:
+      sys.exit("select takes the tested extension and its partner.")
+    import compatibility_analysis as ca
+    (test_extn, compat_extn) = args_dict['args']
+    pg_regress_entry = ca.extn_db[test_extn]["pg_regress"]
+    partner_extns = ca.get_dependencies(compat_extn) + [compat_extn]
+    selected = select_tests(test_extn, pg_regress_entry["test_list"], pg_regress_entry, partner_extns, load_coverage_map(args_dict['coverage_map']), load_hooks(args_dict['hooks']))
+    print(str(len(selected)) + "/" + str(len(pg_regress_entry["test_list"])) + " tests selected: " + " ".join(selected))
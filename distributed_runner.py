@@ -0,0 +1,416 @@
+# Multi-host runner for pairwise compatibility testing. A coordinator process
+# hands out pairs to worker agents over a line-based JSON socket protocol,
+# collects their streamed results and terminal logs, and re-queues the pair of
+# any agent that disconnects or stops sending heartbeats. This replaces the
+# manual shard files and util/parallel_csv.py merges.
+#
+# Usage:
+#   python3 distributed_runner.py coordinator --list=pairs.txt --bind=0.0.0.0:7400
+#   python3 distributed_runner.py agent --coordinator=host:7400 --port=5433
+#
+# Agents run from a checkout of this repository (they import
+# compatibility_analysis, which works relative to the current directory).
+# For testing on one machine, `coordinator --local-agents=N` starts N agents,
+# each in its own directory under distributed-agents/ and on its own port.
+#
+# Protocol (one JSON object per line):
+#   agent -> coordinator: hello, request, heartbeat, log, result (with an
+#                         "error" field when the agent could not run the pair)
+#   coordinator -> agent: pair, wait, done
+
+import argparse
+import csv
+from datetime import datetime
+import json
+import os
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+import duration_store
+import matrix_store
+import work_queue
+
+current_working_dir = os.getcwd()
+script_dir = os.path.dirname(os.path.abspath(__file__))
+extn_info_dir = "extn_info"
+agents_dir = "distributed-agents"
+now = datetime.now()
+date_time = now.strftime("%m-%d-%Y_%H:%M")
+distributed_output_dir = "distributed-output-" + date_time
+
+default_coordinator_port = 7400
+heartbeat_interval = 10
+heartbeat_timeout = 120
+wait_interval = 15
+# A pair whose agents keep dying (e.g. because the pair crashes the host) is
+# recorded as failed after this many attempts instead of being re-queued.
+max_pair_attempts = 3
+
+# Directories an agent needs from the repository checkout.
+agent_shared_dirs = ["extn_info", "extn_scripts", "extn_test_results", "extn_sql_files"]
+
+#####################################################################
+# PROTOCOL HELPERS
+#####################################################################
+
+class Connection:
+  def __init__(self, sock):
+    self.sock = sock
+    self.reader = sock.makefile("r")
+    self.write_lock = threading.Lock()
+
+  def send(self, msg):
+    data = (json.dumps(msg) + "\n").encode("utf-8")
+    with self.write_lock:
+      self.sock.sendall(data)
+
+  # Returns None when the peer has gone away.
+  def receive(self):
+    try:
+      line = self.reader.readline()
+    except (OSError, ValueError):
+      return None
+    if line == "":
+      return None
+    return json.loads(line)
+
+  def close(self):
+    try:
+      self.sock.close()
+    except OSError:
+      pass
+
+def parse_address(address, default_host):
+  if ":" in address:
+    host, port = address.rsplit(":", 1)
+    return (host if host != "" else default_host), int(port)
+  return address, default_coordinator_port
+
+#####################################################################
+# COORDINATOR
+#####################################################################
+
+class Coordinator:
+  # pair_builds maps each pair to the Postgres build it runs on, and versions
+  # maps extensions to their versions, for the predicted pair durations.
+  def __init__(self, file_extn_pairs, extn_db, pair_builds, versions, matrix_path=None):
+    self.cond = threading.Condition()
+    self.matrix = None if matrix_path is None else matrix_store.MatrixStore(matrix_path)
+    self.durations_db = current_working_dir + "/" + duration_store.default_durations_db
+    history = duration_store.load_history(self.durations_db)
+    expected = {}
+    for (first_extn, second_extn) in file_extn_pairs:
+      expected[(first_extn, second_extn)] = work_queue.estimate_pair_duration(first_extn, second_extn, history, extn_db, pair_builds[(first_extn, second_extn)], versions)
+
+    # Longest-expected-first, as in pairwise-queue mode.
+    self.pending = sorted(file_extn_pairs, key=lambda pair: expected[pair], reverse=True)
+    self.running = {}
+    self.attempts = {}
+    self.results = {}
+    self.num_pairs = len(file_extn_pairs)
+
+    subprocess.run("mkdir -p " + distributed_output_dir, shell=True, cwd=current_working_dir)
+    self.results_file = open(current_working_dir + "/pairwise_parallel.csv", "w")
+    self.results_writer = csv.writer(self.results_file)
+
+  def finished(self):
+    return len(self.results) == self.num_pairs
+
+  def next_pair(self, worker_id):
+    with self.cond:
+      if self.finished():
+        return {"type": "done"}
+      if len(self.pending) == 0:
+        return {"type": "wait"}
+      pair = self.pending.pop(0)
+      self.running[worker_id] = (pair, time.time())
+      self.attempts[pair] = self.attempts.get(pair, 0) + 1
+      print("Assigned " + pair[0] + " " + pair[1] + " to " + worker_id)
+      return {"type": "pair", "first": pair[0], "second": pair[1]}
+
+  # Must be called with self.cond held. error is set when no agent could run
+  # the pair, which the matrix records as an error rather than a result.
+  def store_result(self, pair, result, error=False):
+    self.results[pair] = result
+    self.results_writer.writerow([pair[0], pair[1], str(result)])
+    self.results_file.flush()
+    if self.matrix is not None:
+      self.matrix.set_result(pair[0], pair[1], result, error)
+    print(pair[0] + " " + pair[1] + ": " + str(result) + " (" + str(len(self.results)) + "/" + str(self.num_pairs) + ")")
+    self.cond.notify_all()
+
+  def record_result(self, worker_id, msg):
+    pair = (msg["first"], msg["second"])
+    with self.cond:
+      if worker_id in self.running and self.running[worker_id][0] == pair:
+        del self.running[worker_id]
+      if pair in self.results:
+        return
+      if "error" in msg:
+        # The agent could not run the pair; its duration says nothing about
+        # how long the pair takes.
+        print("Worker " + worker_id + " failed to run " + pair[0] + " " + pair[1] + ": " + msg["error"])
+      else:
+        duration_store.record_pair(pair[0], pair[1], msg["pg_build"], msg["seconds"], self.durations_db)
+      self.store_result(pair, msg["result"], "error" in msg)
+
+  def record_log(self, msg):
+    pair_dir = current_working_dir + "/" + distributed_output_dir + "/" + msg["first"] + "_" + msg["second"]
+    os.makedirs(pair_dir, exist_ok=True)
+    log_file = open(pair_dir + "/terminal.txt", "a")
+    log_file.write(msg["data"])
+    log_file.close()
+
+  # Puts the in-flight pair of a dead worker back at the head of the queue,
+  # or records it as failed once it has used up its attempts.
+  def requeue(self, worker_id):
+    with self.cond:
+      if worker_id not in self.running:
+        return
+      pair, _ = self.running.pop(worker_id)
+      if pair in self.results:
+        pass
+      elif self.attempts[pair] >= max_pair_attempts:
+        print("Worker " + worker_id + " died, " + pair[0] + " " + pair[1] + " failed after " + str(self.attempts[pair]) + " attempts")
+        self.store_result(pair, False, True)
+      else:
+        print("Worker " + worker_id + " died, re-queueing " + pair[0] + " " + pair[1])
+        self.pending.insert(0, pair)
+      self.cond.notify_all()
+
+  def handle_agent(self, sock, address):
+    sock.settimeout(heartbeat_timeout)
+    conn = Connection(sock)
+    worker_id = address[0] + ":" + str(address[1])
+    while True:
+      msg = conn.receive()
+      if msg is None:
+        break
+      msg_type = msg["type"]
+      if msg_type == "hello":
+        worker_id = msg["worker"]
+        print("Worker " + worker_id + " connected")
+      elif msg_type == "request":
+        try:
+          conn.send(self.next_pair(worker_id))
+        except OSError:
+          break
+      elif msg_type == "log":
+        self.record_log(msg)
+      elif msg_type == "result":
+        self.record_result(worker_id, msg)
+    conn.close()
+    self.requeue(worker_id)
+
+  def write_pairwise_csv(self):
+    # Same grid as pairwise mode and util/parallel_csv.py.
+    extn_list = list(set([extn for pair in self.results for extn in pair]))
+    extn_list.sort()
+    compat_csv_file = open(current_working_dir + "/pairwise.csv", "w")
+    writer = csv.writer(compat_csv_file)
+    writer.writerow(["first =>>"] + extn_list)
+    for second_extn in extn_list:
+      row_to_write = [second_extn]
+      for first_extn in extn_list:
+        extn_pair = (first_extn, second_extn)
+        if first_extn == second_extn:
+          row_to_write.append("n/a")
+        elif extn_pair in self.results:
+          row_to_write.append("yes" if self.results[extn_pair] else "no")
+        else:
+          row_to_write.append("dne")
+      writer.writerow(row_to_write)
+    compat_csv_file.close()
+
+def start_local_agents(num_agents, coordinator_address, base_port, extra_args):
+  agent_procs = []
+  for i in range(0, num_agents):
+    agent_dir = current_working_dir + "/" + agents_dir + "/agent" + str(i + 1)
+    os.makedirs(agent_dir, exist_ok=True)
+    for dir in agent_shared_dirs:
+      subprocess.run("ln -sfn " + current_working_dir + "/" + dir + " " + dir, shell=True, cwd=agent_dir)
+    agent_log = open(agent_dir + "/agent.txt", "a")
+    agent_command = [sys.executable, script_dir + "/distributed_runner.py", "agent",
+      "--coordinator=" + coordinator_address, "--port=" + str(base_port + i)] + extra_args
+    agent_procs.append(subprocess.Popen(agent_command, cwd=agent_dir, stdout=agent_log, stderr=agent_log))
+  return agent_procs
+
+def coordinator_main(args_dict):
+  extn_list_filename = args_dict["list"]
+  if extn_list_filename is None:
+    sys.exit("No list argument parameter.")
+
+  extn_db = load_extn_db()
+  pairs_file = open(extn_list_filename, "r")
+  file_extn_pairs = list(map(lambda x: tuple(x.strip("\n").split(" ")), pairs_file.readlines()))
+  pairs_file.close()
+  file_extn_pairs = list(filter(lambda x: len(x) == 2, file_extn_pairs))
+  for pair in file_extn_pairs:
+    for extn in pair:
+      if extn not in extn_db:
+        sys.exit("Extension " + extn + " not in extension DB.")
+
+  import compatibility_analysis as ca
+  pair_builds = {}
+  for (first_extn, second_extn) in file_extn_pairs:
+    pair_builds[(first_extn, second_extn)] = ca.get_pair_pg_build(first_extn, second_extn)
+  coordinator = Coordinator(file_extn_pairs, extn_db, pair_builds, ca.get_extn_versions(file_extn_pairs), args_dict["matrix"])
+  host, port = parse_address(args_dict["bind"], "0.0.0.0")
+  server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+  server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+  server.bind((host, port))
+  server.listen()
+  server.settimeout(1)
+  print("Coordinator listening on " + host + ":" + str(port) + " with " + str(len(file_extn_pairs)) + " pairs")
+
+  agent_procs = []
+  if args_dict["local_agents"] is not None:
+    extra_args = ["--ram-profile"] if args_dict["ram_profile"] else []
+    agent_procs = start_local_agents(int(args_dict["local_agents"]), "127.0.0.1:" + str(port), int(args_dict["base_port"]), extra_args)
+
+  while not coordinator.finished():
+    try:
+      sock, address = server.accept()
+    except socket.timeout:
+      if len(agent_procs) > 0 and all(map(lambda p: p.poll() is not None, agent_procs)):
+        print("All local agents exited before the matrix was finished.")
+        break
+      continue
+    threading.Thread(target=coordinator.handle_agent, args=(sock, address), daemon=True).start()
+
+  server.close()
+  coordinator.results_file.close()
+  coordinator.write_pairwise_csv()
+  if coordinator.matrix is not None:
+    coordinator.matrix.flush()
+    coordinator.matrix.close()
+  for proc in agent_procs:
+    proc.wait()
+  print("Finished " + str(len(coordinator.results)) + "/" + str(coordinator.num_pairs) + " pairs")
+
+#####################################################################
+# AGENT
+#####################################################################
+
+def load_extn_db():
+  extn_db = {}
+  for file in os.listdir(current_working_dir + "/" + extn_info_dir):
+    extn_info_file = open(current_working_dir + "/" + extn_info_dir + "/" + file, "r")
+    extn_db[os.path.splitext(file)[0]] = json.load(extn_info_file)
+    extn_info_file.close()
+  return extn_db
+
+# Streams a pair's terminal file to the coordinator while the pair runs.
+def stream_terminal_file(conn, terminal_file_name, first_extn, second_extn, stop_event):
+  offset = 0
+  while True:
+    stopping = stop_event.is_set()
+    if os.path.exists(terminal_file_name):
+      log_file = open(terminal_file_name, "r", errors="replace")
+      log_file.seek(offset)
+      data = log_file.read()
+      offset = log_file.tell()
+      log_file.close()
+      if data != "":
+        conn.send({"type": "log", "first": first_extn, "second": second_extn, "data": data})
+    if stopping:
+      return
+    stop_event.wait(1)
+
+def send_heartbeats(conn, stop_event):
+  while not stop_event.wait(heartbeat_interval):
+    try:
+      conn.send({"type": "heartbeat"})
+    except OSError:
+      return
+
+def agent_main(args_dict):
+  import compatibility_analysis as ca
+
+  if args_dict["port"] is not None:
+    ca.port_num = int(args_dict["port"])
+  ca.ram_profile = args_dict["ram_profile"]
+
+  host, port = parse_address(args_dict["coordinator"], "127.0.0.1")
+  sock = socket.create_connection((host, port))
+  conn = Connection(sock)
+  worker_id = socket.gethostname() + ":" + str(ca.port_num)
+  conn.send({"type": "hello", "worker": worker_id})
+
+  stop_heartbeats = threading.Event()
+  threading.Thread(target=send_heartbeats, args=(conn, stop_heartbeats), daemon=True).start()
+
+  ca.initial_setup()
+  current_configure_options = []
+  ca.install_postgres(current_configure_options)
+  reinstall = False
+  while True:
+    conn.send({"type": "request"})
+    msg = conn.receive()
+    if msg is None or msg["type"] == "done":
+      break
+    if msg["type"] == "wait":
+      time.sleep(wait_interval)
+      continue
+
+    first_extn = msg["first"]
+    second_extn = msg["second"]
+    terminal_file_name = ca.current_working_dir + "/" + ca.testing_output_dir + "/" + first_extn + "_" + second_extn + "/terminal.txt"
+    stop_streaming = threading.Event()
+    streamer = threading.Thread(target=stream_terminal_file, args=(conn, terminal_file_name, first_extn, second_extn, stop_streaming))
+    streamer.start()
+
+    start = time.time()
+    result_msg = {"type": "result", "first": first_extn, "second": second_extn}
+    try:
+      if reinstall and not ca.staged_installs:
+        current_configure_options = ca.get_pair_configure_options(first_extn, second_extn)
+        subprocess.run("rm -rf " + ca.pg_dist_dir, cwd=ca.current_working_dir, shell=True)
+        ca.install_postgres(current_configure_options)
+      reinstall = False
+      result, current_configure_options = ca.run_pair_test(first_extn, second_extn, current_configure_options)
+    except (SystemExit, Exception) as e:
+      # The install helpers sys.exit on failure. Report the pair as failed
+      # rather than dying with it assigned, and start the next pair from a
+      # fresh cluster and Postgres install.
+      print("Pair " + first_extn + " " + second_extn + " raised: " + str(e))
+      result = False
+      result_msg["error"] = str(e)
+      ca.stop_postgres(subprocess.DEVNULL)
+      ca.cleanup(not ca.staged_installs)
+      reinstall = True
+    stop_streaming.set()
+    streamer.join()
+    if "error" not in result_msg:
+      result_msg["pg_build"] = ca.get_pg_build(ca.current_working_dir + "/" + ca.pg_dist_dir)
+    result_msg["result"] = result
+    result_msg["seconds"] = time.time() - start
+    conn.send(result_msg)
+    if result:
+      subprocess.run("rm -rf " + first_extn + "_" + second_extn, shell=True, cwd=ca.current_working_dir + "/" + ca.testing_output_dir)
+
+  stop_heartbeats.set()
+  conn.close()
+  ca.final_cleanup()
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Runs pairwise compatibility testing across several machines.')
+  parser.add_argument('role', choices=['coordinator', 'agent'])
+  parser.add_argument('-l', '--list', action='store', help='(coordinator) text file with pairs of extensions')
+  parser.add_argument('-b', '--bind', action='store', default="0.0.0.0:" + str(default_coordinator_port), help='(coordinator) address to listen on')
+  parser.add_argument('-n', '--local-agents', action='store', help='(coordinator) number of agents to start on this machine')
+  parser.add_argument('--base-port', action='store', default="5440", help='(coordinator) Postgres port of the first local agent')
+  parser.add_argument('-m', '--matrix', action='store', help='(coordinator) compact matrix file (see matrix_store.py) to record results in')
+  parser.add_argument('-c', '--coordinator', action='store', default="127.0.0.1:" + str(default_coordinator_port), help='(agent) coordinator address')
+  parser.add_argument('-p', '--port', action='store', help='(agent) Postgres port number')
+  parser.add_argument('-r', '--ram-profile', action='store_true', help='Use the RAM-backed fast-test cluster profile.')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict["role"] == "coordinator":
+    coordinator_main(args_dict)
+  else:
+    agent_main(args_dict)
@@ -0,0 +1,281 @@
+# Durable store of how long the phases of a compatibility run take. Every
+# extension build/install, test suite and pgbench run is recorded with the
+# extension, its version and the Postgres build it ran on; every pair is
+# recorded with its total duration. The history feeds predicted pair costs
+# for the schedulers (work_queue.py, distributed_runner.py), a live ETA and
+# pairs-per-hour rate during runs, and capacity planning for a list of pairs.
+#
+# The store is an SQLite database (durations.db). Connections are opened per
+# call and wait on locks, so threads and worker processes on the same machine
+# can record concurrently.
+#
+# Usage:
+#   python3 duration_store.py report
+#   python3 duration_store.py predict --list=test_files/test1a.txt --workers=4
+#   python3 duration_store.py import pair_durations.csv   # old work queue history
+
+import argparse
+import csv
+import sqlite3
+import sys
+import time
+
+default_durations_db = "durations.db"
+
+# Phases recorded per extension.
+BUILD = "build"
+SUITE = "suite"
+PGBENCH = "pgbench"
+phases = [BUILD, SUITE, PGBENCH]
+
+# Predictions use the median of the most recent samples.
+num_recent_samples = 20
+
+# Per-pair cost (initdb, start/stop, smoke stage) on top of the phases.
+pair_overhead_seconds = 15
+
+schema = [
+  "CREATE TABLE IF NOT EXISTS phase_durations (extn TEXT NOT NULL, version TEXT NOT NULL, pg_build TEXT NOT NULL, phase TEXT NOT NULL, seconds REAL NOT NULL, recorded_at REAL NOT NULL)",
+  "CREATE INDEX IF NOT EXISTS phase_durations_key ON phase_durations (extn, phase, version, pg_build)",
+  "CREATE TABLE IF NOT EXISTS pair_durations (first TEXT NOT NULL, second TEXT NOT NULL, pg_build TEXT NOT NULL, seconds REAL NOT NULL, recorded_at REAL NOT NULL)",
+  "CREATE INDEX IF NOT EXISTS pair_durations_key ON pair_durations (first, second)"
+]
+
+def connect(db_path=default_durations_db):
+  conn = sqlite3.connect(db_path, timeout=60)
+  for statement in schema:
+    conn.execute(statement)
+  return conn
+
+#####################################################################
+# RECORDING
+#####################################################################
+
+def record_phase(extn, version, pg_build, phase, seconds, db_path=default_durations_db):
+  conn = connect(db_path)
+  with conn:
+    conn.execute("INSERT INTO phase_durations VALUES (?, ?, ?, ?, ?, ?)", (extn, version, pg_build, phase, seconds, time.time()))
+  conn.close()
+
+def record_pair(first_extn, second_extn, pg_build, seconds, db_path=default_durations_db):
+  conn = connect(db_path)
+  with conn:
+    conn.execute("INSERT INTO pair_durations VALUES (?, ?, ?, ?, ?)", (first_extn, second_extn, pg_build, seconds, time.time()))
+  conn.close()
+
+# Imports the pair_durations.csv (first, second, seconds) that work_queue.py
+# used to write, so the history of older runs isn't lost.
+def import_pair_csv(csv_path, db_path=default_durations_db):
+  num_rows = 0
+  conn = connect(db_path)
+  durations_file = open(csv_path, "r")
+  with conn:
+    for row in csv.reader(durations_file):
+      if len(row) != 3:
+        continue
+      conn.execute("INSERT INTO pair_durations VALUES (?, ?, ?, ?, ?)", (row[0], row[1], "unknown", float(row[2]), 0))
+      num_rows += 1
+  durations_file.close()
+  conn.close()
+  return num_rows
+
+#####################################################################
+# PREDICTION
+#####################################################################
+
+def median(values):
+  values = sorted(values)
+  if len(values) == 0:
+    return None
+  mid = len(values) // 2
+  return values[mid] if len(values) % 2 == 1 else (values[mid - 1] + values[mid]) / 2
+
+def recent_median(conn, query, params):
+  rows = conn.execute(query + " ORDER BY recorded_at DESC LIMIT " + str(num_recent_samples), params).fetchall()
+  return median(list(map(lambda x: x[0], rows)))
+
+# Expected duration of one phase, from the most specific history available:
+# same version and build, then same build, then any run of the extension.
+def predict_phase(conn, extn, phase, version=None, pg_build=None):
+  base_query = "SELECT seconds FROM phase_durations WHERE extn = ? AND phase = ?"
+  candidates = []
+  if version is not None and pg_build is not None:
+    candidates.append((base_query + " AND version = ? AND pg_build = ?", (extn, phase, version, pg_build)))
+  if pg_build is not None:
+    candidates.append((base_query + " AND pg_build = ?", (extn, phase, pg_build)))
+  candidates.append((base_query, (extn, phase)))
+  for (query, params) in candidates:
+    estimate = recent_median(conn, query, params)
+    if estimate is not None:
+      return estimate
+  return None
+
+def add_recent_sample(samples, key, seconds):
+  if key not in samples:
+    samples[key] = []
+  if len(samples[key]) < num_recent_samples:
+    samples[key].append(seconds)
+
+# Recent medians of every pair, per Postgres build (first, second, build) and
+# over all builds (first, second, None), of the pairs each extension was part
+# of (extns), and of every extension phase, per
+# version and build (extn, phase, version, build), per build (extn, phase,
+# None, build) and over all runs (extn, phase, None, None). They are loaded
+# through one connection, so predicting a whole list of pairs doesn't query
+# the database once per pair.
+def load_history(db_path=default_durations_db):
+  conn = connect(db_path)
+  pair_samples = {}
+  extn_samples = {}
+  for (first_extn, second_extn, pg_build, seconds) in conn.execute("SELECT first, second, pg_build, seconds FROM pair_durations ORDER BY recorded_at DESC"):
+    add_recent_sample(pair_samples, (first_extn, second_extn, pg_build), seconds)
+    add_recent_sample(pair_samples, (first_extn, second_extn, None), seconds)
+    add_recent_sample(extn_samples, first_extn, seconds)
+    add_recent_sample(extn_samples, second_extn, seconds)
+  phase_samples = {}
+  for (extn, phase, version, pg_build, seconds) in conn.execute("SELECT extn, phase, version, pg_build, seconds FROM phase_durations ORDER BY recorded_at DESC"):
+    add_recent_sample(phase_samples, (extn, phase, version, pg_build), seconds)
+    add_recent_sample(phase_samples, (extn, phase, None, pg_build), seconds)
+    add_recent_sample(phase_samples, (extn, phase, None, None), seconds)
+  conn.close()
+
+  history = {"pairs": {}, "extns": {}, "phases": {}}
+  for key, values in pair_samples.items():
+    history["pairs"][key] = median(values)
+  for key, values in extn_samples.items():
+    history["extns"][key] = median(values)
+  for key, values in phase_samples.items():
+    history["phases"][key] = median(values)
+  return history
+
+# predict_phase over a loaded history: same version and build, then same
+# build, then any run of the extension.
+def lookup_phase(history, extn, phase, version=None, pg_build=None):
+  candidates = []
+  if version is not None and pg_build is not None:
+    candidates.append((extn, phase, version, pg_build))
+  if pg_build is not None:
+    candidates.append((extn, phase, None, pg_build))
+  candidates.append((extn, phase, None, None))
+  for key in candidates:
+    if key in history["phases"]:
+      return history["phases"][key]
+  return None
+
+# Expected cost of a pair on the Postgres build pg_build: its own history if
+# it has been run before (on that build if it has been run there), otherwise
+# the sum of its extensions' phases. extns_to_install are the pair's
+# extensions with dependencies; only the pair itself runs suites and pgbench.
+# versions maps extensions to the versions that will run. history comes from
+# load_history. Returns None when an extension has no history at all, so
+# callers can fall back to their own defaults.
+def predict_pair_cost(first_extn, second_extn, extns_to_install, history, pg_build=None, versions=None):
+  if versions is None:
+    versions = {}
+  for key in [(first_extn, second_extn, pg_build), (first_extn, second_extn, None)]:
+    if key in history["pairs"]:
+      return history["pairs"][key]
+
+  total = pair_overhead_seconds
+  for extn in extns_to_install:
+    build_estimate = lookup_phase(history, extn, BUILD, versions.get(extn), pg_build)
+    if build_estimate is None:
+      return None
+    total += build_estimate
+  for extn in [first_extn, second_extn]:
+    for phase in [SUITE, PGBENCH]:
+      estimate = lookup_phase(history, extn, phase, versions.get(extn), pg_build)
+      total += 0 if estimate is None else estimate
+  return total
+
+#####################################################################
+# RUN PROGRESS
+#####################################################################
+
+# Tracks a run against its predicted pair costs. The ETA scales the predicted
+# cost of the remaining pairs by how far off the predictions have been so far.
+class RunProgress:
+  def __init__(self):
+    self.start({})
+
+  # expected maps every pair of the run to its predicted cost in seconds.
+  def start(self, expected):
+    self.expected = dict(expected)
+    self.start_time = time.time()
+    self.done = {}
+
+  def active(self):
+    return len(self.expected) > 0
+
+  def pair_done(self, pair, seconds):
+    self.done[pair] = seconds
+
+  def pairs_per_hour(self):
+    elapsed = time.time() - self.start_time
+    return len(self.done) * 3600 / elapsed if elapsed > 0 else 0.0
+
+  def eta_seconds(self):
+    done_expected = sum(map(lambda x: self.expected.get(x, 0), self.done.keys()))
+    remaining = sum(map(lambda x: x[1], filter(lambda x: x[0] not in self.done, self.expected.items())))
+    ratio = sum(self.done.values()) / done_expected if done_expected > 0 else 1.0
+    return remaining * ratio
+
+  def summary(self):
+    return str(len(self.done)) + "/" + str(len(self.expected)) + " pairs, " + str(round(self.pairs_per_hour(), 1)) + " pairs/hour, ETA " + format_duration(self.eta_seconds())
+
+def format_duration(seconds):
+  minutes = int(round(seconds / 60))
+  return str(minutes // 60) + "h" + str(minutes % 60).zfill(2) + "m"
+
+#####################################################################
+# REPORTS
+#####################################################################
+
+def print_report(db_path):
+  conn = connect(db_path)
+  rows = conn.execute("SELECT DISTINCT extn FROM phase_durations ORDER BY extn").fetchall()
+  print("extension".ljust(30) + "".join(map(lambda x: x.rjust(10), phases)))
+  for (extn,) in rows:
+    line = extn.ljust(30)
+    for phase in phases:
+      estimate = predict_phase(conn, extn, phase)
+      line += ("-" if estimate is None else str(round(estimate, 1))).rjust(10)
+    print(line)
+  (num_pairs, total_seconds) = conn.execute("SELECT COUNT(*), SUM(seconds) FROM pair_durations").fetchone()
+  if num_pairs > 0:
+    print(str(num_pairs) + " pairs recorded, " + str(round(num_pairs * 3600 / total_seconds, 1)) + " pairs/hour on average")
+  conn.close()
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Historical durations of compatibility runs.')
+  parser.add_argument('command', choices=['report', 'predict', 'import'])
+  parser.add_argument('args', nargs='*')
+  parser.add_argument('-d', '--db', action='store', default=default_durations_db, help='duration database (default durations.db)')
+  parser.add_argument('-l', '--list', action='store', help='pairs list (pairwise-parallel format) to predict')
+  parser.add_argument('-w', '--workers', action='store', default="1", help='number of workers the list is spread over')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['command'] == 'report':
+    print_report(args_dict['db'])
+  elif args_dict['command'] == 'import':
+    for path in args_dict['args']:
+      print("Imported " + str(import_pair_csv(path, args_dict['db'])) + " pair durations from " + path)
+  else:
+    if args_dict['list'] is None:
+      sys.exit("No list argument parameter.")
+    import compatibility_analysis as ca
+    file_extn_pairs = ca.get_file_extn_pairs_list(args_dict['list'])
+    history = load_history(args_dict['db'])
+    versions = ca.get_extn_versions(file_extn_pairs)
+    total = 0
+    num_unknown = 0
+    for (first_extn, second_extn) in file_extn_pairs:
+      estimate = predict_pair_cost(first_extn, second_extn, ca.get_extns_to_install([first_extn, second_extn]), history, ca.get_pair_pg_build(first_extn, second_extn), versions)
+      if estimate is None:
+        num_unknown += 1
+      else:
+        total += estimate
+    workers = int(args_dict['workers'])
+    print(str(len(file_extn_pairs)) + " pairs, " + str(num_unknown) + " without history")
+    print("Predicted cost of pairs with history: " + format_duration(total) + " (" + format_duration(total / workers) + " on " + str(workers) + " worker(s))")
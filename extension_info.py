@@ -1,7 +1,17 @@
+import analysis_cache
+import argparse
+import bgworker_profile
 import csv
 from datetime import datetime
+import hook_installations
+import io
 import json
 import os
+import parallel_driver
+import re
+import shmem_footprint
+import sql_catalog
+import sql_lexer
 import subprocess
 
 # Debug flag
@@ -15,6 +25,12 @@ postgres_version = "15.3"
 now = datetime.now()
 date_time = now.strftime("%m-%d-%Y_%H:%M")
 testing_output_dir = "testing-output-" + date_time
+postgres_source_dir = current_working_dir + "/postgresql-" + postgres_version
+
+# Per-file scan results are cached by content (analysis_cache.py); bump the
+# version whenever a scan below returns something different.
+analyzer_version = "9"
+analysis_cache_db = analysis_cache.default_cache_db
 
 # Common C/C++ extensions
 common_c_file_extns = ["h", "hh", "c", "cpp", "cc", "cxx", "cpp"]
@@ -133,11 +149,10 @@ def cleanup():
   subprocess.run("rm -rf " + ext_work_dir, shell=True, cwd=current_working_dir)
   subprocess.run("rm postgresql-" + postgres_version + ".tar.gz", shell=True, cwd=current_working_dir)
 
-def download_extn(extn_name, terminal_file):
+def download_extn(extn_name, terminal_file, extension_dir=current_working_dir + "/" + ext_work_dir):
   extn_entry = extn_db[extn_name]
 
   print("Downloading extension " + extn_name)
-  extension_dir = current_working_dir + "/" + ext_work_dir
 
   download_type = extn_entry["download_method"]
   if download_type == "git":
@@ -165,54 +180,45 @@ def download_extn(extn_name, terminal_file):
 # EXTENSION SOURCE CODE ANALYSIS HELPER FUNCTIONS
 #####################################################################
 
-def does_hook_exist(cl : str, hook):
-  return (cl.startswith(hook + "=") or cl.startswith(hook + " =")) and cl.endswith(";")
-
-def does_utility_plugin_exist(cl : str):
-  for keyword in misc_utility_keywords:
-    if keyword in cl:
-      return True
-  return False
-
-def does_background_worker_exist(cl : str):
-  return "RegisterDynamicBackgroundWorker" in cl
-
-def does_config_option_exist(cl: str):
-  for elem in custom_variable_fns:
-    fn_name = "DefineCustom" + elem + "Variable"
-    if fn_name in cl:
-      return True 
-  
-  return False
-
-def does_udf_exist(cl : str):
-  udf1_str = "create function"
-  udf2_str = "create or replace function"
-  udf3_str = "create  function"
-  return udf1_str in cl.lower() or udf2_str in cl.lower() or udf3_str in cl.lower()
-
-def does_udt_exist(cl : str):
-  udt1_str = "create type"
-  udt2_str = "create or replace type"
-  return udt1_str in cl.lower() or udt2_str in cl.lower()
-
-def does_external_table_exist(cl : str):
-  return "create foreign data wrapper" in cl.lower()
-
-def does_access_method_exist(cl : str):
-  return "create access method" in cl.lower()
-
-def does_table_access_method_exist(cl : str):
-  return does_access_method_exist(cl) and "type table" in cl.lower()
-
-def does_index_access_method_exist(cl : str):
-  if "create text search dictionary" in cl.lower():
-    return True
-  
-  if "create operator class" in cl.lower():
-    return True 
-  
-  return does_access_method_exist(cl) and "type index" in cl.lower()
+# Feature each hook category marks.
+hook_features = {}
+for hook in query_processing_hooks:
+  hook_features[hook] = "Query Procesing"
+for hook in utility_hooks:
+  hook_features[hook] = "Utility Commands"
+for hook in client_auth_hooks:
+  hook_features[hook] = "Client Authentication"
+
+# One pattern finds every keyword of a C file in a single pass. Keywords count
+# anywhere; checking their first characters up front lets most positions fail
+# after one test. Hook assignments come from hook_installations.py.
+c_keywords = misc_utility_keywords + ["RegisterBackgroundWorker", "RegisterDynamicBackgroundWorker", "DefineCustom"]
+c_source_pattern = re.compile(
+  r"(?=[" + re.escape("".join(sorted(set(map(lambda x: x[0], c_keywords))))) + r"])" +
+  r"(?:(?P<utility>" + "|".join(map(re.escape, misc_utility_keywords)) + r")" +
+  r"|(?P<bgworker>Register(?:Dynamic)?BackgroundWorker)" +
+  r"|(?P<guc>DefineCustom(?:" + "|".join(custom_variable_fns) + r")Variable))")
+
+# Returns the keyword kinds ("utility", "bgworker", "guc") a C source file
+# contains.
+def scan_c_source(text):
+  kinds = set()
+  for match in c_source_pattern.finditer(text):
+    kinds.add(match.lastgroup)
+  return kinds
+
+# Returns the keyword kinds of a C source file, its hook assignments as
+# parsed by hook_installations.py, its shared memory requests (see
+# shmem_footprint.py) and its background workers (see bgworker_profile.py).
+def scan_c_file(text):
+  kinds = scan_c_source(text)
+  tokens = hook_installations.tokenize(text)
+  return {
+    "kinds": sorted(kinds),
+    "hooks": hook_installations.scan_c_hooks(text, postgres_hooks, tokens),
+    "shmem": shmem_footprint.scan_c_shmem(text, tokens),
+    "bgworkers": bgworker_profile.scan_c_bgworkers(text, tokens)
+  }
 
 def does_bw_worker_exist_rust(cl : str):
   return "BackgroundWorkerBuilder::new" in cl
@@ -242,17 +248,102 @@ def does_utility_keyword_exist_rust(cl: str):
 def does_type_exist_rust(cl: str):
   return "create type" in cl or "CREATE TYPE" in cl
 
+# Installations (as in hook_installations.get_installations) of the hooks
+# implemented in lines [start_idx, end_idx) of a Rust hook file, an
+# `impl PgHooks` block. pgrx's register_hook saves every previous hook and
+# passes it to the implementation as prev_hook, so the hook is chained when
+# its method calls prev_hook (or passes it on) before the next method starts.
+def get_rust_installations(filename, code_lines, start_idx, end_idx):
+  installations = []
+  hook_lines = []
+  method_starts = []
+  for i in range(start_idx, end_idx):
+    processed_cl = " ".join(code_lines[i].strip().split())
+    if re.search(r"\bfn \w+", processed_cl):
+      method_starts.append(i)
+    for hook in rust_hook_map:
+      if does_hook_exist_rust(processed_cl, hook):
+        hook_lines.append((hook, i))
+
+  for (hook, i) in hook_lines:
+    method_end = end_idx
+    for start in method_starts:
+      if start > i:
+        method_end = start
+        break
+    # prev_hook used other than in the parameter list (prev_hook: fn(...)).
+    calls_previous = any(map(lambda x: re.search(r"\bprev_hook\b(?!\s*:)", x) is not None, code_lines[i:method_end]))
+    installations.append((hook, "PgHooks::" + rust_hook_map[hook], filename, i + 1, True, calls_previous))
+  return installations
+
+# Returns the features and mechanisms a Rust source file contains.
+def scan_rust_source(text):
+  features = set()
+  mechanisms = set()
+  function_flag = False
+  for cl in io.StringIO(text):
+    processed_cl = " ".join(cl.strip().split())
+    if function_flag:
+      if "fn " in processed_cl:
+        features.add("Functions")
+
+    if does_shmem_exist_rust(processed_cl):
+      mechanisms.add("Memory Allocation")
+    
+    if does_config_option_exist_rust(processed_cl):
+      mechanisms.add("Custom Configuration Variables")
+    
+    if does_bw_worker_exist_rust(processed_cl):
+      mechanisms.add("Background Workers")
+
+    if does_fdw_exist_rust(processed_cl):
+      features.add("Storage Managers")
+
+    if does_utility_keyword_exist_rust(processed_cl):
+      features.add("Utility Commands")
+    
+    if processed_cl.startswith("#[pg_extern"):
+      function_flag = True
+
+    if does_type_exist_rust(processed_cl):
+      features.add("Types")
+  return [sorted(features), sorted(mechanisms)]
+
+# Statements (as normalized by sql_lexer.py) that mark a feature.
+sql_feature_patterns = [
+  ("Functions", re.compile(r"^create (or replace )?function\b", re.IGNORECASE)),
+  ("Types", re.compile(r"^create (or replace )?type\b", re.IGNORECASE)),
+  ("Storage Managers", re.compile(r"^create foreign data wrapper\b|^create access method \S+ type table\b", re.IGNORECASE)),
+  ("Index Access Methods", re.compile(r"^create text search dictionary\b|^create operator class\b|^create access method \S+ type index\b", re.IGNORECASE))
+]
+
+# Returns the features the statements of an SQL file create, whether they
+# mention pg_catalog, and the objects they create (see sql_catalog.py).
+def scan_sql_source(lines):
+  features = set()
+  pg_catalog = False
+  objects = []
+  for (statement, line) in sql_lexer.iter_statements(lines):
+    for (feature, pattern) in sql_feature_patterns:
+      if pattern.match(statement):
+        features.add(feature)
+    if "pg_catalog" in statement.lower():
+      pg_catalog = True
+    sql_object = sql_catalog.get_statement_object(statement)
+    if sql_object is not None:
+      objects.append(sql_object + [line])
+  return [sorted(features), pg_catalog, objects]
+
 #####################################################################
 # EXTENSION SOURCE CODE ANALYSIS
 #####################################################################
-def source_analysis(extn_name):
+def source_analysis(extn_name, extension_dir=current_working_dir + "/" + ext_work_dir):
   extn_entry = extn_db[extn_name]
   download_type = extn_entry["download_method"]
   source_dir ="" 
   if download_type == "contrib":
-    source_dir = current_working_dir + "/postgresql-" + postgres_version + "/contrib/" + extn_entry["folder_name"]
+    source_dir = postgres_source_dir + "/contrib/" + extn_entry["folder_name"]
   else:
-    extension_dir = current_working_dir + "/" + ext_work_dir
     source_dir = extension_dir + "/" + extn_entry["folder_name"] + "/" + extn_entry["source_dir"]
 
   hooks_map = {}
@@ -274,78 +365,50 @@ def source_analysis(extn_name):
   for ty in types_of_mechanisms:
     mechanisms_map[ty] = False
 
+  hook_scans = []
+  shmem_scans = []
+  bgworker_scans = []
   for root, _, files in os.walk(source_dir):
     for name in files:
       _, file_ext = os.path.splitext(name)
       if file_ext[1:] in common_c_file_extns:
-        tmp_source_file = open(os.path.join(source_dir, os.path.join(root, name)), "r")
-        code_lines = tmp_source_file.readlines()
-        for cl in code_lines:
-          processed_cl = " ".join(cl.strip().split())
-          for hook in misc_hooks:
-            if does_hook_exist(processed_cl, hook):
-              hooks_map[hook] = True
-
-          for hook in query_processing_hooks:
-            if does_hook_exist(processed_cl, hook):
-              hooks_map[hook] = True
-              features_map["Query Procesing"] = True
-
-          for hook in utility_hooks:
-            if does_hook_exist(processed_cl, hook):
-              hooks_map[hook] = True
-              features_map["Utility Commands"] = True
-
-          for hook in client_auth_hooks:
-            if does_hook_exist(processed_cl, hook):
-              hooks_map[hook] = True
-              features_map["Client Authentication"] = True
-
-          if does_utility_plugin_exist(processed_cl):
-            features_map["Utility Commands"] = True
-          
-          if does_background_worker_exist(processed_cl):
-            mechanisms_map["Background Workers"] = True
+        source_path = os.path.join(source_dir, os.path.join(root, name))
+        scan = analysis_cache.scan_file("extension_info.c", analyzer_version, source_path, scan_c_file, analysis_cache_db)
+        hook_scans.append((os.path.relpath(source_path, source_dir), scan["hooks"]))
+        shmem_scans.append(scan["shmem"])
+        bgworker_scans.append(scan["bgworkers"])
+        kinds = scan["kinds"]
 
-          if does_config_option_exist(processed_cl):
-            mechanisms_map["Custom Configuration Variables"] = True
+        if "utility" in kinds:
+          features_map["Utility Commands"] = True
 
-        tmp_source_file.close()
-      elif file_ext[1:] == rust_file_extn:
-        tmp_source_file = open(os.path.join(source_dir, os.path.join(root, name)), "r")
-        code_lines = tmp_source_file.readlines()
-        function_flag = False
-        for cl in code_lines:
-          processed_cl = " ".join(cl.strip().split())
-          if function_flag:
-            if "fn " in processed_cl:
-              features_map["Functions"] = True
-
-          if does_shmem_exist_rust(processed_cl):
-            mechanisms_map["Memory Allocation"] = True
-          
-          if does_config_option_exist_rust(processed_cl):
-            mechanisms_map["Custom Configuration Variables"] = True
-          
-          if does_bw_worker_exist_rust(processed_cl):
-            mechanisms_map["Background Workers"] = True
-
-          if does_fdw_exist_rust(processed_cl):
-            features_map["Storage Managers"] = True
-
-          if does_utility_keyword_exist_rust(processed_cl):
-            features_map["Utility Commands"] = True
-          
-          if processed_cl.startswith("#[pg_extern"):
-            function_flag = True
+        if "bgworker" in kinds:
+          mechanisms_map["Background Workers"] = True
 
-          if does_type_exist_rust(processed_cl):
-            features_map["Types"] = True
-
-        tmp_source_file.close()
+        if "guc" in kinds:
+          mechanisms_map["Custom Configuration Variables"] = True
+      elif file_ext[1:] == rust_file_extn:
+        features, mechanisms = analysis_cache.scan_file("extension_info.rust", analyzer_version, os.path.join(source_dir, os.path.join(root, name)), scan_rust_source, analysis_cache_db)
+        for feature in features:
+          features_map[feature] = True
+        for mechanism in mechanisms:
+          mechanisms_map[mechanism] = True
+
+  installations = hook_installations.get_installations(hook_scans)
+  for installation in installations:
+    hook = installation[0]
+    hooks_map[hook] = True
+    if hook in hook_features:
+      features_map[hook_features[hook]] = True
 
   if hooks_map["shmem_startup_hook"] and hooks_map["shmem_request_hook"]:
     mechanisms_map["Memory Allocation"] = True
+  # Extensions written before shmem_request_hook request shared memory from
+  # _PG_init.
+  if any(map(lambda x: len(x["calls"]) > 0, shmem_scans)):
+    mechanisms_map["Memory Allocation"] = True
+  footprint = shmem_footprint.estimate_footprint(shmem_scans)
+  profile = bgworker_profile.estimate_profile(bgworker_scans, shmem_scans)
   
   if "rust" in extn_entry:
     hook_files = extn_entry["rust"]["hook_files"]
@@ -355,6 +418,7 @@ def source_analysis(extn_name):
       hf_code_lines = hf_file.readlines()
       start_idx = hf["line_start"] - 1
       end_idx = hf["line_end"]
+      installations += get_rust_installations(filename, hf_code_lines, start_idx, end_idx)
       for i in range(start_idx, end_idx):
         cl = hf_code_lines[i]
         processed_cl = " ".join(cl.strip().split())
@@ -380,16 +444,15 @@ def source_analysis(extn_name):
 
       hf_file.close()
 
-  return hooks_map, features_map, mechanisms_map
+  return hooks_map, features_map, mechanisms_map, installations, footprint, profile
 
-def sql_analysis(extn_name, features_map):
+def sql_analysis(extn_name, features_map, extension_dir=current_working_dir + "/" + ext_work_dir):
   extn_entry = extn_db[extn_name]
   download_type = extn_entry["download_method"]
   codebase_dir ="" 
   if download_type == "contrib":
-    codebase_dir = current_working_dir + "/postgresql-" + postgres_version + "/contrib/" + extn_entry["folder_name"]
+    codebase_dir = postgres_source_dir + "/contrib/" + extn_entry["folder_name"]
   else:
-    extension_dir = current_working_dir + "/" + ext_work_dir
     codebase_dir = extension_dir + "/" + extn_entry["folder_name"]
 
   sql_files_list = []
@@ -414,51 +477,29 @@ def sql_analysis(extn_name, features_map):
     print(sql_files_list)
 
   pg_catalog = False
-
-  access_method_flag = False
+  objects = []
   for file in sql_files_list:
-    total_file_path = codebase_dir + "/" + file
-    file_obj = open(total_file_path, "r")
-    file_lines = file_obj.readlines()
-    for fl in file_lines:
-      if access_method_flag:
-        if "table" in fl.lower():
-          features_map.update({"Storage Managers": True})
-        elif "index" in fl.lower():
-          features_map.update({"Index Access Methods": True})
-        access_method_flag = False
-      
-      if does_udf_exist(fl):
-        features_map.update({"Functions": True})
-      if does_udt_exist(fl):
-        features_map.update({"Types": True})
-      if does_external_table_exist(fl):
-        features_map.update({"Storage Managers": True})
-
-      if does_table_access_method_exist(fl):
-        features_map.update({"Storage Managers": True})
-      elif does_index_access_method_exist(fl):
-        features_map.update({"Index Access Methods": True})
-      elif does_access_method_exist(fl):
-        access_method_flag = True
-
-      if "pg_catalog" in fl.lower():
-        pg_catalog = True
+    features, file_pg_catalog, file_objects = analysis_cache.scan_file_lines("extension_info.sql", analyzer_version, codebase_dir + "/" + file, scan_sql_source, analysis_cache_db)
+    for feature in features:
+      features_map.update({feature: True})
+    pg_catalog = pg_catalog or file_pg_catalog
+    for (kind, schema, name, signature, line) in file_objects:
+      objects.append([kind, schema, name, signature, file, line])
 
   if pg_catalog:
     print(extn_name)
     
-  return features_map
+  return features_map, objects
 
-def run_extension_info_analysis(extn_name, hooks_csv_file_writer, info_csv_file_writer, mechanisms_csv_file_writer):
+def run_extension_info_analysis(extn_name, hooks_csv_file_writer, info_csv_file_writer, mechanisms_csv_file_writer, installations_csv_file_writer, objects_csv_file_writer, footprint_csv_file_writer, profile_csv_file_writer, extension_dir=current_working_dir + "/" + ext_work_dir):
   extn_entry = extn_db[extn_name]
   download_type = extn_entry["download_method"]
   if download_type == "downloaded":
     return 
 
   print("Running extension info analysis on " + extn_name)
-  hook_map, features_map, mechanisms_map = source_analysis(extn_name)
-  features_map = sql_analysis(extn_name, features_map)
+  hook_map, features_map, mechanisms_map, installations, footprint, profile = source_analysis(extn_name, extension_dir)
+  features_map, objects = sql_analysis(extn_name, features_map, extension_dir)
 
   if DEBUG:
     print(hook_map)
@@ -485,45 +526,66 @@ def run_extension_info_analysis(extn_name, hooks_csv_file_writer, info_csv_file_
 
   mechanisms_csv_file_writer.writerow(output_to_mechanisms_csv)
 
-if __name__ == '__main__':
-  # Download Postgres 
-  initial_setup()
+  for (hook, owner, file_name, line, saves_previous, calls_previous) in installations:
+    installations_csv_file_writer.writerow([extn_name, hook, owner, file_name, str(line), "Yes" if saves_previous else "No", "Yes" if calls_previous else "No"])
+
+  for (kind, schema, name, signature, file_name, line) in objects:
+    objects_csv_file_writer.writerow([extn_name, kind, schema, name, signature, file_name, str(line)])
 
-  # Terminal file
+  footprint_csv_file_writer.writerow([extn_name] + list(map(str, footprint[:5])) + ["; ".join(footprint[5])])
+
+  (static_workers, dynamic_workers, entry_points, restart_times, wakeups, unresolved) = profile
+  profile_csv_file_writer.writerow([extn_name, str(static_workers), str(dynamic_workers), " ".join(entry_points), " ".join(restart_times), str(wakeups), "; ".join(unresolved)])
+
+#####################################################################
+# DRIVER
+
+output_files = [
+  ("hooks.csv", ["Extension Name"] + postgres_hooks),
+  ("info.csv", ["Extension Name"] + types_of_extns),
+  ("mechanisms.csv", ["Extension Name"] + types_of_mechanisms),
+  (hook_installations.default_installations_file, hook_installations.installations_header),
+  (sql_catalog.default_objects_file, sql_catalog.objects_header),
+  (shmem_footprint.default_footprint_file, shmem_footprint.footprint_header),
+  (bgworker_profile.default_profile_file, bgworker_profile.profile_header)
+]
+
+# Analyzes the sources of one extension, downloaded to extension_dir. Returns
+# its rows for each of output_files.
+def analyze_extn_sources(extn_name, extension_dir):
+  writers = list(map(lambda x: parallel_driver.RowCollector(), output_files))
+  run_extension_info_analysis(extn_name, *writers, extension_dir)
+  return list(map(lambda x: x.rows, writers))
+
+# Downloads and analyzes one extension in its own work directory.
+def analyze_extn(extn_name):
+  extension_dir = parallel_driver.get_extn_work_dir(current_working_dir + "/" + ext_work_dir, extn_name)
+  subprocess.run("mkdir -p " + extension_dir, shell=True, cwd=current_working_dir)
   terminal_file = open(testing_output_dir + "/terminal.txt", "a")
+  download_extn(extn_name, terminal_file, extension_dir)
+  terminal_file.close()
+  rows = analyze_extn_sources(extn_name, extension_dir)
+  subprocess.run("rm -rf " + extension_dir, shell=True, cwd=current_working_dir)
+  return rows
 
-  # CSV files
-  hooks_csv_file = open("hooks.csv", "w")
-  hooks_csv_file_writer = csv.writer(hooks_csv_file)
-  total_hooks_list = ["Extension Name"] + postgres_hooks
-  hooks_csv_file_writer.writerow(total_hooks_list)
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Analyzes the hooks, features and mechanisms of every extension.')
+  parser.add_argument('-j', '--jobs', action='store', default=str(parallel_driver.default_num_jobs), help='number of extensions analyzed in parallel (default: number of CPUs)')
+  parser.add_argument('--no-cache', action='store_true', help='scan every file again instead of using analysis_cache.db')
+  args = parser.parse_args()
+  args_dict = vars(args)
 
-  info_csv_file = open("info.csv", "w")
-  info_csv_file_writer = csv.writer(info_csv_file)
-  info_csv_file_writer.writerow(["Extension Name"] + types_of_extns)
+  if args_dict['no_cache']:
+    analysis_cache_db = None
 
-  mechanisms_csv_file = open("mechanisms.csv", "w")
-  mechanisms_csv_file_writer = csv.writer(mechanisms_csv_file)
-  mechanisms_csv_file_writer.writerow(["Extension Name"] + types_of_mechanisms)
+  # Download Postgres 
+  initial_setup()
 
   if DEBUG:
-    download_extn("italian_fts", terminal_file)
-    run_extension_info_analysis("italian_fts", hooks_csv_file_writer, info_csv_file_writer, mechanisms_csv_file_writer)
-    #extns_list = list(extn_db.keys())
-    #extns_list.sort()
-    #start_extn = "unidecode"
-    #start_index = extns_list.index(start_extn, 0)
-
-    #for i in range(start_index, len(extns_list)):
-    #  download_extn(extns_list[i], terminal_file)
-    #  run_extension_info_analysis(extns_list[i], hooks_csv_file_writer, info_csv_file_writer, mechanisms_csv_file_writer)
+    parallel_driver.run_analysis(["italian_fts"], analyze_extn, output_files, 1)
   else:
-    # Determine the percentage of source code copied from Postgres
     extns_list = list(extn_db.keys())
     extns_list.sort()
-    for extn in extns_list:
-      download_extn(extn, terminal_file)
-      run_extension_info_analysis(extn, hooks_csv_file_writer, info_csv_file_writer, mechanisms_csv_file_writer)
+    parallel_driver.run_analysis(extns_list, analyze_extn, output_files, int(args_dict['jobs']))
 
   cleanup()
-  
\ No newline at end of file
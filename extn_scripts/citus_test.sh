@@ -4,8 +4,11 @@
 # variable, which is injected into the pg_regress command line.
 #
 # We currently only run the basic test suite (check-multi) and filter
-# the tests passed line from the output, because the total output
-# contains absolute paths and timings.
+# the tests passed line from the output. The full output is kept in
+# check-multi.log; citus sets "normalize_output", so if tests fail,
+# compatibility_analysis.py checks regression.diffs with
+# output_normalizer.py, and failures that only differ in log-line
+# prefixes, temporary paths or ports still pass.
 
 if [[ ! -z "${CREATE_EXTENSIONS}" ]]; then
   EXTRA_TESTS=$(echo ${CREATE_EXTENSIONS} | sed -e 's/,/ --load-extension=/')
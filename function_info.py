@@ -1,7 +1,13 @@
+import analysis_cache
+import argparse
 import csv
 from datetime import datetime
 import json
 import os
+import parallel_driver
+import re
+import sql_catalog
+import sql_lexer
 import subprocess
 import sys
 
@@ -15,6 +21,12 @@ postgres_version = "15.3"
 now = datetime.now()
 date_time = now.strftime("%m-%d-%Y_%H:%M")
 testing_output_dir = "testing-output-" + date_time
+postgres_source_dir = current_working_dir + "/postgresql-" + postgres_version
+
+# Per-file scans are cached by content (analysis_cache.py); bump the version
+# whenever scan_functions returns something different.
+analyzer_version = "3"
+analysis_cache_db = analysis_cache.default_cache_db
 
 # Creating the extension DB with the JSON files in extn_info
 extn_files = os.listdir(current_working_dir + "/" + extn_info_dir)
@@ -42,11 +54,10 @@ def cleanup():
   subprocess.run("rm -rf " + ext_work_dir, shell=True, cwd=current_working_dir)
   subprocess.run("rm postgresql-" + postgres_version + ".tar.gz", shell=True, cwd=current_working_dir)
 
-def download_extn(extn_name, terminal_file):
+def download_extn(extn_name, terminal_file, extension_dir=current_working_dir + "/" + ext_work_dir):
   extn_entry = extn_db[extn_name]
 
   print("Downloading extension " + extn_name)
-  extension_dir = current_working_dir + "/" + ext_work_dir
 
   download_type = extn_entry["download_method"]
   if download_type == "git":
@@ -70,18 +81,195 @@ def download_extn(extn_name, terminal_file):
 
   print("Finished downloading extension " + extn_name)
 
-def does_udf_exist(cl : str):
-  udf1_str = "create function"
-  udf2_str = "create or replace function"
-  return cl.lower().startswith(udf1_str) or cl.lower().startswith(udf2_str)
+function_pattern = re.compile(r"^create (or replace )?function\b", re.IGNORECASE)
+language_pattern = re.compile(r"\blanguage '?(\w+)'?", re.IGNORECASE)
+sql_body_pattern = re.compile(r"\b(begin atomic|return)\b", re.IGNORECASE)
+
+routine_change_pattern = re.compile(r"^(alter|drop) function\b", re.IGNORECASE)
+
+# Returns the known language of a CREATE FUNCTION statement, or None.
+# Functions without a LANGUAGE clause have an SQL-standard body and are sql.
+def get_language(statement):
+  # A parameter can be called language too, so the first known language
+  # after the keyword wins.
+  languages = list(filter(lambda x: x in language_list, map(lambda x: x.group(1).lower(), language_pattern.finditer(statement))))
+  if len(languages) == 0 and sql_body_pattern.search(statement):
+    languages = ["sql"]
+  return languages[0] if len(languages) > 0 else None
+
+#####################################################################
+# FUNCTION ATTRIBUTES
+#####################################################################
+
+# Attributes of a function that CREATE FUNCTION leaves out. Functions are
+# PARALLEL UNSAFE unless marked otherwise, which keeps every query calling
+# them from using a parallel plan.
+default_attributes = {
+  "volatility": "volatile",
+  "parallel": "unsafe",
+  "strict": False,
+  "support": ""
+}
+
+attributes_header = ["Extension Name", "Function", "Arguments", "Language", "Volatility", "Parallel", "Parallel Marked", "Strict", "Cost", "Rows", "Support", "File", "Line"]
+lint_header = ["Extension Name", "Functions", "Parallel Safe", "Parallel Restricted", "Parallel Unsafe", "Unsafe By Default", "Unsafe By Default Immutable/Stable", "Volatile", "Strict", "Non-Default Cost", "Non-Default Rows", "Support"]
+
+# Returns the attributes a CREATE or ALTER FUNCTION sets in tokens, the
+# tokens after the argument list.
+def get_function_attributes(tokens):
+  attributes = {}
+  depth = 0
+  for i in range(0, len(tokens)):
+    kind, value = tokens[i]
+    if value == "(":
+      depth += 1
+    elif value == ")":
+      depth -= 1
+    if depth != 0 or kind != "word":
+      continue
+    next_token = tokens[i + 1] if i + 1 < len(tokens) else (None, None)
+    if value in ["immutable", "stable", "volatile"]:
+      attributes["volatility"] = value
+    elif value == "parallel" and next_token[1] in ["safe", "restricted", "unsafe"]:
+      attributes["parallel"] = next_token[1]
+    elif value == "strict" or (value == "returns" and next_token[1] == "null"):
+      attributes["strict"] = True
+    elif value == "called" and next_token[1] == "on":
+      attributes["strict"] = False
+    elif value in ["cost", "rows"] and next_token[0] == "number":
+      attributes[value] = next_token[1]
+    elif value == "support":
+      schema, name, _ = sql_catalog.parse_qualified_name(tokens, i + 1)
+      if name is not None:
+        attributes["support"] = (schema + "." if schema != "" else "") + name
+    elif value == "returns" and next_token[1] in ["setof", "table"]:
+      attributes["set_returning"] = True
+  return attributes
+
+# Returns [schema, name, arguments, index after the argument list] of the
+# function named at tokens[i]. arguments is None if the name has no argument
+# list (ALTER FUNCTION name ...).
+def parse_function_name(tokens, i):
+  routine = sql_catalog.parse_routine(tokens, i, "Function")
+  schema, name, j = sql_catalog.parse_qualified_name(tokens, i)
+  if routine is None:
+    return [schema, name, None, j]
+  _, j = sql_catalog.get_parenthesized(tokens, j)
+  return [routine[1], routine[2], routine[3], j]
+
+# Returns what a statement does to functions: a list of [change, schema,
+# name, arguments, attributes, line], with change "create", "alter" or
+# "drop".
+def get_function_changes(statement, line):
+  tokens = sql_catalog.tokenize(statement)
+  if function_pattern.match(statement):
+    i = 4 if tokens[1] == ("word", "or") else 2
+    schema, name, arguments, end = parse_function_name(tokens, i)
+    if name is None or arguments is None:
+      return []
+    attributes = get_function_attributes(tokens[end:])
+    language = get_language(statement)
+    attributes["language"] = language if language is not None else ""
+    return [["create", schema, name, arguments, attributes, line]]
+
+  if not routine_change_pattern.match(statement):
+    return []
+  if tokens[0][1] == "alter":
+    schema, name, arguments, end = parse_function_name(tokens, 2)
+    return [] if name is None else [["alter", schema, name, arguments, get_function_attributes(tokens[end:]), line]]
+  i = 4 if len(tokens) > 3 and tokens[2] == ("word", "if") else 2
+  changes = []
+  for item in sql_catalog.split_list(tokens[i:]):
+    schema, name, arguments, _ = parse_function_name(item, 0)
+    if name is not None:
+      changes.append(["drop", schema, name, arguments, {}, line])
+  return changes
+
+# Returns the number of functions of an SQL file in each of language_list,
+# and the changes its statements make to functions.
+def scan_functions(lines):
+  counts = {}
+  changes = []
+  for (statement, line) in sql_lexer.iter_statements(lines):
+    if function_pattern.match(statement):
+      language = get_language(statement)
+      if language is not None:
+        counts[language] = counts.get(language, 0) + 1
+    if function_pattern.match(statement) or routine_change_pattern.match(statement):
+      changes += get_function_changes(statement, line)
+  return [counts, changes]
 
-def does_language_exist(cl: str):
-  return "language " in cl
+# Sorts the scripts of an extension in upgrade order: ext--1.0.sql,
+# ext--1.0--1.1.sql, ext--1.1.sql, ...
+def get_script_order(file_name):
+  return (list(map(int, re.findall(r"\d+", os.path.basename(file_name)))), file_name)
 
-def not_comment(cl: str):
-  return not cl.strip().startswith("/*") and not cl.strip().startswith("--")
+# Replays the changes of every script (in get_script_order order) and
+# returns {(schema, name, arguments): [attributes, file, line]} for the
+# functions that exist at the end.
+def apply_function_changes(file_changes):
+  functions = {}
+  for (file_name, changes) in sorted(file_changes, key=lambda x: get_script_order(x[0])):
+    for (change, schema, name, arguments, attributes, line) in changes:
+      if change == "create":
+        functions[(schema, name, arguments)] = [attributes, file_name, line]
+        continue
+      # ALTER and DROP FUNCTION may leave out the arguments of a function
+      # whose name is unique.
+      keys = list(filter(lambda x: x[0] == schema and x[1] == name and (arguments is None or x[2] == arguments), functions.keys()))
+      for key in keys:
+        if change == "drop":
+          del functions[key]
+        else:
+          functions[key][0] = dict(functions[key][0], **attributes)
+  return functions
 
-def function_analysis(extn_name):
+# Returns the row of a function in function_attributes.csv. Cost and rows
+# are the estimates the planner uses, defaults included.
+def get_attributes_row(extn_name, key, attributes, file_name, line):
+  (schema, name, arguments) = key
+  marked = "parallel" in attributes
+  attributes = dict(default_attributes, **attributes)
+  cost = attributes.get("cost", "1" if attributes["language"] in ["c", "internal"] else "100")
+  rows = attributes.get("rows", "1000" if attributes.get("set_returning", False) else "0")
+  return [
+    extn_name,
+    (schema + "." if schema != "" else "") + name,
+    arguments,
+    attributes["language"],
+    attributes["volatility"],
+    attributes["parallel"],
+    "Yes" if marked else "No",
+    "Yes" if attributes["strict"] else "No",
+    cost,
+    rows,
+    attributes["support"],
+    file_name,
+    str(line)]
+
+# Returns an extension's row in function_lint.csv from its rows in
+# function_attributes.csv.
+def get_lint_row(extn_name, attribute_rows):
+  def count(condition):
+    return str(len(list(filter(condition, attribute_rows))))
+  unsafe_by_default = lambda x: x[5] == "unsafe" and x[6] == "No"
+  return [
+    extn_name,
+    str(len(attribute_rows)),
+    count(lambda x: x[5] == "safe"),
+    count(lambda x: x[5] == "restricted"),
+    count(lambda x: x[5] == "unsafe"),
+    count(unsafe_by_default),
+    count(lambda x: unsafe_by_default(x) and x[4] in ["immutable", "stable"]),
+    count(lambda x: x[4] == "volatile"),
+    count(lambda x: x[7] == "Yes"),
+    count(lambda x: x[8] != ("1" if x[3] in ["c", "internal"] else "100")),
+    count(lambda x: x[9] not in ["0", "1000"]),
+    count(lambda x: x[10] != "")]
+
+# Returns the number of functions of an extension in each of language_list,
+# and the functions its scripts leave behind (see apply_function_changes).
+def function_analysis(extn_name, extension_dir=current_working_dir + "/" + ext_work_dir):
   language_dict = {}
 
   for vl in language_list:
@@ -91,13 +279,12 @@ def function_analysis(extn_name):
   download_type = extn_entry["download_method"]
 
   if download_type == "downloaded":
-    return language_dict
+    return language_dict, {}
 
   codebase_dir ="" 
   if download_type == "contrib":
-    codebase_dir = current_working_dir + "/postgresql-" + postgres_version + "/contrib/" + extn_entry["folder_name"]
+    codebase_dir = postgres_source_dir + "/contrib/" + extn_entry["folder_name"]
   else:
-    extension_dir = current_working_dir + "/" + ext_work_dir
     codebase_dir = extension_dir + "/" + extn_entry["folder_name"]
 
   sql_files_list = []
@@ -116,88 +303,66 @@ def function_analysis(extn_name):
   if DEBUG:
     print(sql_files_list)
 
+  file_changes = []
   for file in sql_files_list:
-    total_file_path = codebase_dir + "/" + file
-    file_obj = open(total_file_path, "r")
-    file_lines = file_obj.readlines()
-    file_lines = list(filter(not_comment, file_lines))
-
-    index = 0
-    while index < len(file_lines):
-      fl = file_lines[index]
-      if does_udf_exist(fl):
-        if DEBUG:
-          print(fl)
-        udf_index = index
-        while True:
-          if index >= len(file_lines):
-            print("BUG: no method syntax in function spotted...")
-            print(file)
-            print(extn_name)
-            break
-          
-          language_str = file_lines[index].lower()
-          if does_udf_exist(language_str) and udf_index != index:
-            print("BUG: no method syntax in function spotted...")
-            print(file)
-            print(extn_name)
-            break
-
-          if does_language_exist(language_str.lower()):
-            if DEBUG:
-              print(language_str)
-
-            update_flag = False
-            lang_list = language_str.split()
-            for (i, l) in list(enumerate(lang_list)):
-              if l == "language":
-                language_idx = i+1
-                language_name = lang_list[language_idx]
-                language_name = language_name.strip("';")
-
-                # Language verification
-                for verified_lang in language_list:
-                  if language_name == verified_lang:
-                    language_dict[language_name] = language_dict[language_name] + 1
-                    update_flag = True
-                    break
-            
-            if update_flag:
-              index += 1
-              break
-            else:
-              index += 1
-          else:
-            index += 1
-      else:
-        index += 1
-          
-  return language_dict
+    counts, changes = analysis_cache.scan_file_lines("function_info.functions", analyzer_version, codebase_dir + "/" + file, scan_functions, analysis_cache_db)
+    for language_name in counts:
+      language_dict[language_name] += counts[language_name]
+    file_changes.append((file, changes))
+
+  return language_dict, apply_function_changes(file_changes)
+
+output_files = [
+  ("functions.csv", ["Extension Name"] + language_list),
+  ("function_attributes.csv", attributes_header),
+  ("function_lint.csv", lint_header)
+]
+
+# Analyzes the SQL files of one extension, downloaded to extension_dir.
+# Returns its rows for output_files.
+def analyze_extn_sources(extn_name, extension_dir):
+  rows = []
+  attribute_rows = []
+  lint_rows = []
+  if extn_db[extn_name]["download_method"] != "downloaded":
+    language_dict, functions = function_analysis(extn_name, extension_dir)
+    output_list = []
+    for verified_lang in language_list:
+      output_list.append(str(language_dict[verified_lang]))
+    rows.append([extn_name] + output_list)
+    for key in sorted(functions.keys()):
+      attributes, file_name, line = functions[key]
+      attribute_rows.append(get_attributes_row(extn_name, key, attributes, file_name, line))
+    lint_rows.append(get_lint_row(extn_name, attribute_rows))
+  return [rows, attribute_rows, lint_rows]
+
+# Downloads and analyzes one extension in its own work directory.
+def analyze_extn(extn_name):
+  print("Analyzing " + extn_name + "...")
+  extension_dir = parallel_driver.get_extn_work_dir(current_working_dir + "/" + ext_work_dir, extn_name)
+  subprocess.run("mkdir -p " + extension_dir, shell=True, cwd=current_working_dir)
+  terminal_file = open(testing_output_dir + "/terminal.txt", "a")
+  download_extn(extn_name, terminal_file, extension_dir)
+  terminal_file.close()
+  rows = analyze_extn_sources(extn_name, extension_dir)
+  subprocess.run("rm -rf " + extension_dir, shell=True, cwd=current_working_dir)
+  return rows
 
 if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Counts the functions of every extension by language and reports their planner attributes.')
+  parser.add_argument('-j', '--jobs', action='store', default=str(parallel_driver.default_num_jobs), help='number of extensions analyzed in parallel (default: number of CPUs)')
+  parser.add_argument('--no-cache', action='store_true', help='scan every file again instead of using analysis_cache.db')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['no_cache']:
+    analysis_cache_db = None
+
   # Download Postgres 
   initial_setup()
-  # Terminal file
-  terminal_file = open(testing_output_dir + "/terminal.txt", "a")
-
-  # Function analysis CSV file
-  functions_csv_file = open("functions.csv", "w")
-  functions_csv_file_writer = csv.writer(functions_csv_file)
-  functions_csv_file_writer.writerow(["Extension Name"] + language_list)
 
   extns_list = list(extn_db.keys())
   extns_list.sort()
-  
-  for extn in extns_list:
-    print("Analyzing " + extn + "...")
-    download_extn(extn, terminal_file)
-    if extn_db[extn]["download_method"] == "downloaded":
-      continue
-    
-    language_dict = function_analysis(extn)
-    output_list = []
-    for verified_lang in language_list:
-      output_list.append(str(language_dict[verified_lang]))
-    functions_csv_file_writer.writerow([extn] + output_list)
+  parallel_driver.run_analysis(extns_list, analyze_extn, output_files, int(args_dict['jobs']))
 
-  cleanup()
\ No newline at end of file
+  cleanup()
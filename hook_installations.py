@@ -0,0 +1,279 @@
+# Finds where C extensions install Postgres hooks by tokenizing their
+# sources, instead of matching lines that look like "hook = ...;". Because it
+# works on tokens, it finds assignments split over several lines, assignments
+# inside #define bodies, and the chaining around them:
+#
+#   prev_planner_hook = planner_hook;     saves the previous hook
+#   planner_hook = my_planner;            installs the hook
+#   if (prev_planner_hook)
+#     prev_planner_hook(parse, ...);      calls the previous hook
+#
+# Every installation is recorded with the function (or macro) that installs
+# it, its line, and whether the extension saves and calls the previous hook.
+# extension_info.py writes them to hook_installations.csv. Two extensions
+# that install the same hook only both run if the one installed last calls
+# the previous hook, so pairs sharing a hook that isn't chained are the ones
+# most likely to break each other; the pairs command ranks them.
+#
+# Usage:
+#   python3 hook_installations.py scan pgextworkdir/pg_hint_plan
+#   python3 hook_installations.py pairs --list=extn_lists/current_list.txt --output=risky_pairs.txt
+
+import argparse
+import csv
+import itertools
+import os
+import re
+import sys
+
+default_installations_file = "hook_installations.csv"
+
+installations_header = ["Extension Name", "Hook", "Installed In", "File", "Line", "Saves Previous", "Calls Previous"]
+
+#####################################################################
+# TOKENIZER
+#####################################################################
+
+token_pattern = re.compile(r"""
+  (?P<comment>/\*.*?\*/|//[^\n]*)
+  |(?P<directive>^[^\S\n]*\#(?:[^\n\\]|\\.|\\\n)*)
+  |(?P<string>"(?:\\.|[^"\\\n])*"|'(?:\\.|[^'\\\n])*')
+  |(?P<identifier>[A-Za-z_]\w*)
+  |(?P<number>\.?\d(?:[\w.]|[eEpP][+-])*)
+  |(?P<punct>->|\+\+|--|<<=|>>=|<<|>>|[<>=!+\-*/%&|^]=|&&|\|\||\#\#|[^\s\w])
+  |(?P<newline>\n)
+  """, re.VERBOSE | re.MULTILINE | re.DOTALL)
+
+define_pattern = re.compile(r"^\s*#\s*define\s+([A-Za-z_]\w*)(\([^)]*\))?(.*)$", re.DOTALL)
+conditional_pattern = re.compile(r"^\s*#\s*(if|ifdef|ifndef|elif|else|endif)\b")
+
+# Returns (kind, text, line) tokens. Comments and whitespace are dropped.
+# #define bodies become a ("define", name, line) token followed by the tokens
+# of the body (all on the line of the #define) and an ("end_define", name,
+# line) token; other directives are dropped. Braces in the #elif and #else
+# branches of a conditional are dropped as well, so a function signature
+# repeated per Postgres version under #if/#else opens the function once.
+def tokenize(text, first_line=1):
+  tokens = []
+  line = first_line
+  # One entry per open conditional: whether it is past its first branch.
+  conditionals = []
+  for match in token_pattern.finditer(text):
+    kind = match.lastgroup
+    value = match.group(kind)
+    if kind == "directive":
+      define = define_pattern.match(value)
+      conditional = conditional_pattern.match(value)
+      if define is not None:
+        tokens.append(("define", define.group(1), line))
+        tokens += tokenize(define.group(3).replace("\\\n", " "), line)
+        tokens.append(("end_define", define.group(1), line))
+      elif conditional is None:
+        pass
+      elif conditional.group(1).startswith("if"):
+        conditionals.append(False)
+      elif len(conditionals) > 0 and conditional.group(1) == "endif":
+        conditionals.pop()
+      elif len(conditionals) > 0:
+        conditionals[-1] = True
+    elif kind == "punct" and value in ["{", "}"] and any(conditionals):
+      pass
+    elif kind not in ["comment", "newline"]:
+      tokens.append((kind, value, line))
+    line += value.count("\n")
+  return tokens
+
+#####################################################################
+# SCANNING
+#####################################################################
+
+# Scans one C file. Returns a dict with:
+#   installations: [hook, installing function or "#define NAME", line, rhs]
+#   saves: [variable, hook] for "variable = hook" assignments
+#   called: identifiers called as functions, directly or through (*x)(...)
+# tokens, if given, are the file's tokens from tokenize.
+def scan_c_hooks(text, hooks, tokens=None):
+  hooks = set(hooks)
+  tokens = tokenize(text) if tokens is None else tokens
+  installations = []
+  saves = []
+  called = set()
+
+  brace_depth = 0
+  paren_depth = 0
+  candidate = None
+  function = None
+  define_stack = []
+  # Brace depths of open extern "C" { blocks, which don't nest functions.
+  extern_stack = []
+  for i in range(0, len(tokens)):
+    kind, value, line = tokens[i]
+    prev_value = tokens[i - 1][1] if i > 0 else None
+    next_value = tokens[i + 1][1] if i + 1 < len(tokens) else None
+
+    if kind == "define":
+      define_stack.append(value)
+      continue
+    if kind == "end_define":
+      define_stack.pop()
+      continue
+    owner = "#define " + define_stack[-1] if len(define_stack) > 0 else function
+
+    if value == "(" and kind == "punct":
+      if paren_depth == 0 and brace_depth == 0 and tokens[i - 1][0] == "identifier":
+        candidate = prev_value
+      paren_depth += 1
+    elif value == ")" and kind == "punct":
+      paren_depth = max(0, paren_depth - 1)
+    elif value == "{" and kind == "punct" and len(define_stack) == 0:
+      if i >= 2 and tokens[i - 1][0] == "string" and tokens[i - 2][1] == "extern":
+        extern_stack.append(brace_depth)
+        continue
+      if brace_depth == 0:
+        function = candidate if prev_value == ")" else None
+      brace_depth += 1
+    elif value == "}" and kind == "punct" and len(define_stack) == 0:
+      if len(extern_stack) > 0 and extern_stack[-1] == brace_depth:
+        extern_stack.pop()
+        continue
+      brace_depth = max(0, brace_depth - 1)
+      if brace_depth == 0:
+        function = None
+    elif value == ";" and brace_depth == 0:
+      candidate = None
+
+    if kind == "identifier" and next_value == "(":
+      called.add(value)
+    if kind == "identifier" and prev_value == "*" and next_value == ")" and i >= 2 and tokens[i - 2][1] == "(" and i + 2 < len(tokens) and tokens[i + 2][1] == "(":
+      called.add(value)
+
+    if value != "=" or kind != "punct" or i == 0 or tokens[i - 1][0] != "identifier":
+      continue
+    if i >= 2 and tokens[i - 2][1] in [".", "->"]:
+      continue
+    lhs = prev_value
+    rhs = []
+    depth = 0
+    for j in range(i + 1, len(tokens)):
+      if tokens[j][0] in ["define", "end_define"]:
+        break
+      if tokens[j][1] in ["(", "[", "{"]:
+        depth += 1
+      elif tokens[j][1] in [")", "]", "}"]:
+        if depth == 0:
+          break
+        depth -= 1
+      elif tokens[j][1] in [";", ","] and depth == 0:
+        break
+      rhs.append(tokens[j][1])
+
+    if lhs in hooks:
+      if rhs not in [["NULL"], ["0"], []]:
+        installations.append([lhs, owner, line, " ".join(rhs)])
+    elif len(rhs) == 1 and rhs[0] in hooks:
+      saves.append([lhs, rhs[0]])
+
+  return {"installations": installations, "saves": saves, "called": sorted(called)}
+
+# Combines the scans of an extension's files into its installations:
+# [hook, installing function, file, line, saves previous, calls previous].
+# Assignments of a saved previous hook back to the hook (in _PG_fini) are
+# restores, not installations.
+def get_installations(file_scans):
+  saved_vars = {}
+  called = set()
+  for (_, scan) in file_scans:
+    for (var, hook) in scan["saves"]:
+      saved_vars[var] = hook
+    called |= set(scan["called"])
+
+  installations = []
+  for (file_name, scan) in file_scans:
+    for (hook, owner, line, rhs) in scan["installations"]:
+      if saved_vars.get(rhs) == hook:
+        continue
+      hook_vars = [var for var in saved_vars if saved_vars[var] == hook]
+      installations.append([
+        hook,
+        owner if owner is not None else "",
+        file_name,
+        line,
+        len(hook_vars) > 0,
+        any(map(lambda x: x in called, hook_vars))])
+  installations.sort(key=lambda x: (x[0], x[2], x[3]))
+  return installations
+
+#####################################################################
+# PAIR RANKING
+#####################################################################
+
+# Returns {extension: {hook: calls previous}} from hook_installations.csv.
+# A hook counts as chained only if every installation of it calls the
+# previous hook.
+def load_installations(path=default_installations_file):
+  extn_hooks = {}
+  if not os.path.exists(path):
+    return extn_hooks
+  installations_file = open(path, "r")
+  reader = csv.reader(installations_file)
+  next(reader, [])
+  for row in reader:
+    hooks = extn_hooks.setdefault(row[0], {})
+    hooks[row[1]] = hooks.get(row[1], True) and row[6] == "Yes"
+  installations_file.close()
+  return extn_hooks
+
+# Returns (pair, shared hooks, shared hooks not chained by both) for every pair
+# of extns_list sharing a hook, riskiest first.
+def rank_pairs(extns_list, extn_hooks):
+  ranked = []
+  for (first_extn, second_extn) in itertools.combinations(extns_list, 2):
+    first_hooks = extn_hooks.get(first_extn, {})
+    second_hooks = extn_hooks.get(second_extn, {})
+    shared = sorted(set(first_hooks.keys()) & set(second_hooks.keys()))
+    if len(shared) == 0:
+      continue
+    unchained = [hook for hook in shared if not (first_hooks[hook] and second_hooks[hook])]
+    ranked.append(((first_extn, second_extn), shared, unchained))
+  ranked.sort(key=lambda x: (len(x[2]), len(x[1])), reverse=True)
+  return ranked
+
+def scan_dir(source_dir, hooks):
+  file_scans = []
+  for root, _, files in os.walk(source_dir):
+    for name in sorted(files):
+      if os.path.splitext(name)[1] in [".c", ".h", ".cc", ".cpp", ".cxx", ".hh"]:
+        source_file = open(os.path.join(root, name), "r", errors="replace")
+        file_scans.append((os.path.relpath(os.path.join(root, name), source_dir), scan_c_hooks(source_file.read(), hooks)))
+        source_file.close()
+  return get_installations(file_scans)
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Finds hook installations in C sources and ranks extension pairs that share hooks.')
+  parser.add_argument('command', choices=['scan', 'pairs'])
+  parser.add_argument('args', nargs='*')
+  parser.add_argument('-i', '--installations', action='store', default=default_installations_file, help='hook_installations.csv written by extension_info.py')
+  parser.add_argument('-l', '--list', action='store', help='text file with the extensions to pair')
+  parser.add_argument('-o', '--output', action='store', help='write the ranked pairs in the pairwise-parallel list format')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['command'] == 'scan':
+    import extension_info
+    for source_dir in args_dict['args']:
+      for (hook, owner, file_name, line, saves, calls) in scan_dir(source_dir, extension_info.postgres_hooks):
+        print(file_name + ":" + str(line) + ": " + hook + " installed in " + owner + (", saves previous" if saves else "") + (", calls previous" if calls else ""))
+  else:
+    if args_dict['list'] is None:
+      sys.exit("No list argument parameter.")
+    list_file = open(args_dict['list'], "r")
+    extns_list = list(filter(lambda x: x != "", map(lambda x: x.strip("\n"), list_file.readlines())))
+    list_file.close()
+    ranked = rank_pairs(extns_list, load_installations(args_dict['installations']))
+    for ((first_extn, second_extn), shared, unchained) in ranked:
+      print(first_extn + " " + second_extn + ": " + str(len(shared)) + " shared hooks" + (", not chained: " + " ".join(unchained) if len(unchained) > 0 else ""))
+    if args_dict['output'] is not None:
+      output_file = open(args_dict['output'], "w")
+      for ((first_extn, second_extn), _, _) in ranked:
+        output_file.write(first_extn + " " + second_extn + "\n")
+      output_file.close()
@@ -0,0 +1,260 @@
+# Compact, memory-mapped store for the pairwise compatibility matrix.
+#
+# Every ordered pair (first, second) has one 2-bit status cell. Extensions are
+# indexed by a stable, append-only ID table (matrix_ids.txt, one name per
+# line), so adding extensions never reshuffles existing cells. The matrix file
+# has room for `capacity` extensions, which makes a 1024 x 1024 matrix 256KB.
+#
+# Workers update cells in place through a shared mmap; each write takes a
+# byte-range lock on the byte holding the cell, so concurrent workers on the
+# same machine (or a local filesystem) never lose updates.
+#
+# Usage:
+#   python3 matrix_store.py import test_results/            (pairwise-parallel CSVs)
+#   python3 matrix_store.py export --list=extn_lists/current_list.txt --output=pairwise.csv
+#   python3 matrix_store.py progress
+#   python3 matrix_store.py get citus pg_cron
+#   python3 matrix_store.py set citus pg_cron yes
+
+import argparse
+import csv
+import fcntl
+import mmap
+import os
+import struct
+import sys
+
+default_matrix_file = "matrix.bin"
+default_capacity = 1024
+magic = b"PGXMAT01"
+header_format = "<8sI4x"
+header_size = struct.calcsize(header_format)
+
+# Cell values
+UNTESTED = 0
+COMPATIBLE = 1
+INCOMPATIBLE = 2
+ERROR = 3
+
+status_names = {
+  UNTESTED: "dne",
+  COMPATIBLE: "yes",
+  INCOMPATIBLE: "no",
+  ERROR: "error"
+}
+status_values = {v: k for k, v in status_names.items()}
+
+class MatrixStore:
+  def __init__(self, path=default_matrix_file, capacity=default_capacity):
+    self.path = path
+    self.ids_path = os.path.splitext(path)[0] + "_ids.txt"
+    if not os.path.exists(path):
+      self.create(capacity)
+
+    self.file = open(path, "r+b")
+    self.map = mmap.mmap(self.file.fileno(), 0)
+    file_magic, self.capacity = struct.unpack_from(header_format, self.map, 0)
+    if file_magic != magic:
+      sys.exit(path + " is not a compatibility matrix file.")
+    self.load_ids()
+
+  def create(self, capacity):
+    # Only one process may create the file; the others wait on the lock.
+    lock_file = open(self.path + ".lock", "a")
+    fcntl.flock(lock_file, fcntl.LOCK_EX)
+    if not os.path.exists(self.path):
+      tmp_path = self.path + ".tmp"
+      f = open(tmp_path, "wb")
+      f.write(struct.pack(header_format, magic, capacity))
+      f.truncate(header_size + (capacity * capacity + 3) // 4)
+      f.close()
+      os.replace(tmp_path, self.path)
+    fcntl.flock(lock_file, fcntl.LOCK_UN)
+    lock_file.close()
+
+  def close(self):
+    self.map.close()
+    self.file.close()
+
+  #####################################################################
+  # EXTENSION ID TABLE
+  #####################################################################
+
+  def load_ids(self):
+    self.names = []
+    if os.path.exists(self.ids_path):
+      ids_file = open(self.ids_path, "r")
+      self.names = list(map(lambda x: x.strip("\n"), ids_file.readlines()))
+      ids_file.close()
+    self.ids = {name: i for i, name in enumerate(self.names)}
+
+  def get_id(self, extn, create=True):
+    if extn in self.ids:
+      return self.ids[extn]
+    if not create:
+      return None
+
+    # Another worker may have appended names since we loaded the table.
+    ids_file = open(self.ids_path, "a+")
+    fcntl.flock(ids_file, fcntl.LOCK_EX)
+    self.load_ids()
+    if extn not in self.ids:
+      if len(self.names) >= self.capacity:
+        sys.exit("Compatibility matrix is full (capacity " + str(self.capacity) + ").")
+      ids_file.write(extn + "\n")
+      ids_file.flush()
+      self.names.append(extn)
+      self.ids[extn] = len(self.names) - 1
+    fcntl.flock(ids_file, fcntl.LOCK_UN)
+    ids_file.close()
+    return self.ids[extn]
+
+  #####################################################################
+  # CELL ACCESS
+  #####################################################################
+
+  def cell_location(self, first_id, second_id):
+    idx = first_id * self.capacity + second_id
+    return header_size + idx // 4, (idx % 4) * 2
+
+  def get_by_id(self, first_id, second_id):
+    offset, shift = self.cell_location(first_id, second_id)
+    return (self.map[offset] >> shift) & 3
+
+  def get(self, first_extn, second_extn):
+    first_id = self.get_id(first_extn, create=False)
+    second_id = self.get_id(second_extn, create=False)
+    if first_id is None or second_id is None:
+      return UNTESTED
+    return self.get_by_id(first_id, second_id)
+
+  def set(self, first_extn, second_extn, status):
+    offset, shift = self.cell_location(self.get_id(first_extn), self.get_id(second_extn))
+    # Four cells share a byte, so the read-modify-write holds a lock on it.
+    fcntl.lockf(self.file, fcntl.LOCK_EX, 1, offset)
+    self.map[offset] = (self.map[offset] & ~(3 << shift) & 0xff) | (status << shift)
+    fcntl.lockf(self.file, fcntl.LOCK_UN, 1, offset)
+
+  # error marks a pair the harness could not run (a failed build or install,
+  # a dead worker), as opposed to one the extensions broke.
+  def set_result(self, first_extn, second_extn, compatible, error=False):
+    if error:
+      self.set(first_extn, second_extn, ERROR)
+    else:
+      self.set(first_extn, second_extn, COMPATIBLE if compatible else INCOMPATIBLE)
+
+  def flush(self):
+    self.map.flush()
+
+  #####################################################################
+  # IMPORT / EXPORT
+  #####################################################################
+
+  # Imports CSVs in the pairwise-parallel format (first, second, True/False).
+  def import_csv(self, csv_path):
+    num_rows = 0
+    f = open(csv_path, "r")
+    for row in csv.reader(f):
+      if len(row) != 3:
+        continue
+      self.set_result(row[0], row[1], row[2] == "True")
+      num_rows += 1
+    f.close()
+    return num_rows
+
+  # Writes the same first x second grid as pairwise mode/util/parallel_csv.py.
+  def export_grid_csv(self, output_path, extn_list):
+    compat_csv_file = open(output_path, "w")
+    writer = csv.writer(compat_csv_file)
+    writer.writerow(["first =>>"] + extn_list)
+    for second_extn in extn_list:
+      row_to_write = [second_extn]
+      for first_extn in extn_list:
+        if first_extn == second_extn:
+          row_to_write.append("n/a")
+        else:
+          row_to_write.append(status_names[self.get(first_extn, second_extn)])
+      writer.writerow(row_to_write)
+    compat_csv_file.close()
+
+  def export_pairs_csv(self, output_path, extn_list):
+    compat_csv_file = open(output_path, "w")
+    writer = csv.writer(compat_csv_file)
+    for first_extn in extn_list:
+      for second_extn in extn_list:
+        status = self.get(first_extn, second_extn)
+        if first_extn != second_extn and (status == COMPATIBLE or status == INCOMPATIBLE):
+          writer.writerow([first_extn, second_extn, str(status == COMPATIBLE)])
+    compat_csv_file.close()
+
+  # Returns {status: count} over all ordered pairs of extn_list.
+  def progress(self, extn_list):
+    counts = {UNTESTED: 0, COMPATIBLE: 0, INCOMPATIBLE: 0, ERROR: 0}
+    ids = list(map(lambda x: self.get_id(x, create=False), extn_list))
+    for first_id in ids:
+      for second_id in ids:
+        if first_id == second_id:
+          continue
+        if first_id is None or second_id is None:
+          counts[UNTESTED] += 1
+        else:
+          counts[self.get_by_id(first_id, second_id)] += 1
+    return counts
+
+def get_extn_list(store, list_filename):
+  if list_filename is None:
+    extn_list = list(store.names)
+  else:
+    list_file = open(list_filename, "r")
+    extn_list = list(map(lambda x: x.strip("\n"), list_file.readlines()))
+    list_file.close()
+    extn_list = list(filter(lambda x: x != "", extn_list))
+  extn_list.sort()
+  return extn_list
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Compact compatibility matrix store.')
+  parser.add_argument('command', choices=['import', 'export', 'progress', 'get', 'set'])
+  parser.add_argument('args', nargs='*')
+  parser.add_argument('-m', '--matrix', action='store', default=default_matrix_file, help='matrix file (default matrix.bin)')
+  parser.add_argument('-l', '--list', action='store', help='text file with the extensions to export/report on (default: all)')
+  parser.add_argument('-o', '--output', action='store', default="pairwise.csv", help='output CSV for export')
+  parser.add_argument('--pairs', action='store_true', help='export in the pairwise-parallel (first, second, result) format')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  store = MatrixStore(args_dict['matrix'])
+  command = args_dict['command']
+  if command == 'import':
+    for path in args_dict['args']:
+      csv_files = [path]
+      if os.path.isdir(path):
+        csv_files = [os.path.join(path, f) for f in sorted(os.listdir(path)) if f.endswith(".csv")]
+      for csv_file in csv_files:
+        print("Imported " + str(store.import_csv(csv_file)) + " pairs from " + csv_file)
+  elif command == 'export':
+    extn_list = get_extn_list(store, args_dict['list'])
+    if args_dict['pairs']:
+      store.export_pairs_csv(args_dict['output'], extn_list)
+    else:
+      store.export_grid_csv(args_dict['output'], extn_list)
+  elif command == 'progress':
+    extn_list = get_extn_list(store, args_dict['list'])
+    counts = store.progress(extn_list)
+    total = sum(counts.values())
+    tested = total - counts[UNTESTED]
+    pct = round(tested * 100 / total, 2) if total > 0 else 0.0
+    print(str(tested) + "/" + str(total) + " pairs tested (" + str(pct) + "%)")
+    for status in [COMPATIBLE, INCOMPATIBLE, ERROR, UNTESTED]:
+      print("  " + status_names[status] + ": " + str(counts[status]))
+  elif command == 'get':
+    if len(args_dict['args']) != 2:
+      sys.exit("get takes two extension names.")
+    print(status_names[store.get(args_dict['args'][0], args_dict['args'][1])])
+  elif command == 'set':
+    if len(args_dict['args']) != 3 or args_dict['args'][2] not in status_values:
+      sys.exit("set takes two extension names and one of yes/no/error/dne.")
+    store.set(args_dict['args'][0], args_dict['args'][1], status_values[args_dict['args'][2]])
+
+  store.flush()
+  store.close()
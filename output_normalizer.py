@@ -0,0 +1,176 @@
+# Rule-based normalizer for test output. Server log lines, temporary paths and
+# ports differ between runs and machines; every rule below replaces one of them
+# with a fixed placeholder, so two outputs that only differ in those values
+# compare equal. The rules are deliberately narrow: timestamps and PIDs are
+# only replaced in the prefix of a log line, never inside result rows, where a
+# different value is a real failure.
+#
+# Everything works line by line on iterators, so outputs and diff files are
+# never read into memory as a whole.
+#
+# A regression.diffs file is "spurious" when every hunk in it is the same on
+# both sides once normalized; such a pg_regress failure is then counted as a
+# pass instead of needing a rerun or manual triage. compatibility_analysis.py
+# only does this for extensions with "normalize_output" set in extn_info, and
+# logs every diff it suppresses (see log_suppressed_diff).
+#
+# Usage:
+#   python3 output_normalizer.py normalize check-multi.log
+#   python3 output_normalizer.py diffs test_results/.../regression.diffs
+
+import argparse
+from collections import deque
+import re
+import sys
+
+# (name, pattern, replacement), applied in order.
+rules = [
+  # The log_line_prefix settings in extn_info: "%m [%p] " (the default),
+  # "%m: %u [%p] %d " (timescaledb) and "[%m] [%p] [%d] " (pglogical). A
+  # timestamp at the very start of the line, optionally in brackets or followed
+  # by ": " and a user name, then the PID in brackets.
+  ("log prefix", re.compile(r"^(\[?)\d{4}-\d{2}-\d{2} \d{2}:\d{2}:\d{2}(?:\.\d+)?(?: [A-Z]{2,5}| ?[+-]\d{2}(?::?\d{2})?)?(\]?(?:: \S*)? \[)\d+\]"), r"\1<timestamp>\2<pid>]"),
+  # Temporary directories, including pg_regress's tmp_check and tmp_install.
+  ("temp path", re.compile(r"(?<![\w.:/])/(?:tmp|var/tmp|dev/shm)(?:/[\w.@+-]+)+"), "<temp path>"),
+  ("tmp_check path", re.compile(r"(?<![\w.:/])(?:/[\w.@+-]+)*/(?:tmp_check|tmp_install)(?:/[\w.@+-]+)*"), "<temp path>"),
+  ("socket", re.compile(r"\.s\.PGSQL\.\d+"), ".s.PGSQL.<port>"),
+  ("port", re.compile(r"\b(port[= ]|PGPORT=|localhost:|127\.0\.0\.1:)\d+"), r"\1<port>")
+]
+
+def normalize_line(line):
+  for (name, pattern, replacement) in rules:
+    line = pattern.sub(replacement, line)
+  return line
+
+def normalize_lines(lines):
+  for line in lines:
+    yield normalize_line(line)
+
+def normalize_text(text):
+  return "".join(normalize_lines(text.splitlines(keepends=True)))
+
+#####################################################################
+# EXPECTED OUTPUT
+#####################################################################
+
+# Compares output against an expected output the way custom_script_test does
+# (expected_location "beginning", "end" or "all"), after normalization if
+# normalize is set. Only as many lines as the expected output has are kept
+# for "beginning" and "end"; the rest of the output is consumed without being
+# stored.
+def matches_expected(output_lines, expected_text, location, normalize=True):
+  if normalize:
+    expected = normalize_text(expected_text)
+    output_lines = normalize_lines(output_lines)
+  else:
+    expected = expected_text
+  num_lines = max(1, len(expected.splitlines()))
+  if location == "beginning":
+    head = []
+    for line in output_lines:
+      if len(head) < num_lines:
+        head.append(line)
+    return "".join(head).startswith(expected)
+  if location == "end":
+    return "".join(deque(output_lines, maxlen=num_lines)).endswith(expected)
+  if location == "all":
+    return "".join(output_lines) == expected
+  return False
+
+#####################################################################
+# DIFFS
+#####################################################################
+
+hunk_header = re.compile(r"^@@ -\d+(?:,(\d+))? \+\d+(?:,(\d+))? @@")
+
+# Yields (old lines, new lines) for every hunk of a unified diff (pg_regress
+# writes regression.diffs with diff -U3). Lines outside hunks have to be file
+# headers; anything else (a context diff, "No such file", ...) yields None.
+def get_hunks(diff_lines):
+  old_left = new_left = 0
+  old_lines = []
+  new_lines = []
+  for line in diff_lines:
+    if old_left > 0 or new_left > 0:
+      if line.startswith("\\"):
+        continue
+      tag, text = line[:1], line[1:]
+      if tag not in (" ", "-", "+"):
+        yield None
+        return
+      if tag in (" ", "-"):
+        old_lines.append(text)
+        old_left -= 1
+      if tag in (" ", "+"):
+        new_lines.append(text)
+        new_left -= 1
+      if old_left <= 0 and new_left <= 0:
+        yield (old_lines, new_lines)
+        old_lines = []
+        new_lines = []
+      continue
+
+    match = hunk_header.match(line)
+    if match:
+      old_left = int(match.group(1)) if match.group(1) is not None else 1
+      new_left = int(match.group(2)) if match.group(2) is not None else 1
+    elif line.startswith("\\"):
+      continue
+    elif not (line.startswith("diff ") or line.startswith("--- ") or line.startswith("+++ ") or line.strip("=\n") == ""):
+      yield None
+      return
+
+  if old_left > 0 or new_left > 0:
+    yield None
+
+# True if the diff has at least one hunk and every hunk normalizes to the same
+# old and new text.
+def diffs_are_spurious(diff_lines):
+  num_hunks = 0
+  for hunk in get_hunks(diff_lines):
+    if hunk is None:
+      return False
+    old_lines, new_lines = hunk
+    if list(normalize_lines(old_lines)) != list(normalize_lines(new_lines)):
+      return False
+    num_hunks += 1
+  return num_hunks > 0
+
+def diff_file_is_spurious(diff_path):
+  try:
+    diff_file = open(diff_path, "r", errors="replace")
+  except OSError:
+    return False
+  spurious = diffs_are_spurious(diff_file)
+  diff_file.close()
+  return spurious
+
+# Copies a diff that normalization suppressed to each of the logs, so that
+# every suppressed failure can still be reviewed.
+def log_suppressed_diff(diff_path, label, logs):
+  for log in logs:
+    log.write("==== Suppressed diff (equal after normalization) for " + label + ": " + diff_path + "\n")
+    diff_file = open(diff_path, "r", errors="replace")
+    for line in diff_file:
+      log.write(line)
+    diff_file.close()
+    log.flush()
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Normalizes run-specific values in test output.')
+  parser.add_argument('command', choices=['normalize', 'diffs'])
+  parser.add_argument('file', help='output file to normalize, or regression.diffs to check')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['command'] == 'normalize':
+    input_file = open(args_dict['file'], "r", errors="replace")
+    for line in normalize_lines(input_file):
+      sys.stdout.write(line)
+    input_file.close()
+  else:
+    if diff_file_is_spurious(args_dict['file']):
+      print("spurious: every hunk is equal after normalization")
+    else:
+      print("real: at least one hunk differs after normalization")
+      sys.exit(1)
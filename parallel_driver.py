@@ -0,0 +1,94 @@
+# Process-parallel driver for the corpus analysis scripts (extension_info.py,
+# source_code_analysis.py and function_info.py). Every extension is
+# downloaded and analyzed by one of a bounded pool of worker processes, in
+# its own work directory, and returns its CSV rows instead of writing them.
+# Once all extensions are done, the rows are written in extension name order,
+# so the output is the same no matter how the work was scheduled.
+#
+# The scripts call run_analysis from their __main__ block and take the number
+# of worker processes with --jobs, e.g.
+#   python3 extension_info.py --jobs=16
+
+from concurrent.futures import ProcessPoolExecutor, as_completed
+import csv
+import multiprocessing
+import os
+import traceback
+
+default_num_jobs = os.cpu_count()
+
+# Number of jobs that fit in the available memory when every job needs
+# job_memory_mb (e.g. a JVM for PMD), but no more than default_num_jobs.
+def get_memory_bound_num_jobs(job_memory_mb):
+  try:
+    meminfo_file = open("/proc/meminfo", "r")
+  except OSError:
+    return default_num_jobs
+  available_kb = None
+  for line in meminfo_file:
+    if line.startswith("MemAvailable:"):
+      available_kb = int(line.split()[1])
+  meminfo_file.close()
+  if available_kb is None:
+    return default_num_jobs
+  return max(1, min(default_num_jobs, available_kb // 1024 // job_memory_mb))
+
+# Stands in for a csv.writer, so analysis functions that write rows can
+# return them instead.
+class RowCollector:
+  def __init__(self):
+    self.rows = []
+
+  def writerow(self, row):
+    self.rows.append(row)
+
+# Every extension gets its own download directory, so concurrent downloads
+# never see each other's archives or clones.
+def get_extn_work_dir(work_dir, extn):
+  return work_dir + "/" + extn
+
+def run_one(analyze_extn, extn):
+  try:
+    return extn, analyze_extn(extn), None
+  except (Exception, SystemExit):
+    return extn, None, traceback.format_exc()
+
+# analyze_extn(extn) returns one list of rows per output file; output_files
+# is a list of (file name, header row). Returns the extensions that failed.
+def run_analysis(extns_list, analyze_extn, output_files, num_jobs=default_num_jobs):
+  results = {}
+  failed = []
+
+  def collect(extn, rows, error):
+    if error is not None:
+      print("Analysis of " + extn + " failed:\n" + error)
+      failed.append(extn)
+    else:
+      results[extn] = rows
+    print("Analyzed " + str(len(results) + len(failed)) + "/" + str(len(extns_list)) + " extensions")
+
+  if num_jobs <= 1:
+    for extn in extns_list:
+      collect(*run_one(analyze_extn, extn))
+  else:
+    # fork, so workers inherit the calling script's module state.
+    executor = ProcessPoolExecutor(max_workers=num_jobs, mp_context=multiprocessing.get_context("fork"))
+    futures = [executor.submit(run_one, analyze_extn, extn) for extn in extns_list]
+    for future in as_completed(futures):
+      collect(*future.result())
+    executor.shutdown()
+
+  for i in range(0, len(output_files)):
+    (file_name, header) = output_files[i]
+    output_file = open(file_name, "w")
+    writer = csv.writer(output_file)
+    writer.writerow(header)
+    for extn in sorted(results.keys()):
+      for row in results[extn][i]:
+        writer.writerow(row)
+    output_file.close()
+
+  failed.sort()
+  if len(failed) > 0:
+    print("Failed extensions: " + " ".join(failed))
+  return failed
@@ -0,0 +1,679 @@
+# Estimates how much shared memory and how many LWLocks each extension
+# takes, from its C sources, so we know in advance which extensions fit in a
+# shared memory budget together. The sources are tokenized like
+# hook_installations.py does, and the scan records:
+#   - RequestAddinShmemSpace(size) requests
+#   - ShmemInitStruct(name, size, ...) and ShmemInitHash(name, init, max, ...)
+#     allocations, with the entrysize of the hash table
+#   - RequestNamedLWLockTranche(name, count) requests
+#   - the boot values of DefineCustom*Variable GUCs, #define constants,
+#     struct definitions and functions returning a Size, which the size
+#     expressions above are evaluated with
+#
+# Allocations are carved out of the requested space, so an extension's
+# footprint is the larger of the two, plus a padded LWLock per tranche member.
+# sizeof() is computed from the struct definitions with the usual x86-64
+# alignment; GUCs are at their boot values and Postgres settings at their
+# defaults. Expressions that still can't be evaluated (sizes computed at run
+# time, types from other headers) are listed as unresolved and count as 0.
+# extension_info.py writes the estimates to shmem_footprint.csv.
+#
+# Usage:
+#   python3 shmem_footprint.py scan pgextworkdir/pg_stat_statements
+#   python3 shmem_footprint.py pairs --list=extn_lists/current_list.txt --budget=64MB
+
+import argparse
+import csv
+import itertools
+import os
+import re
+import sys
+import hook_installations
+
+default_footprint_file = "shmem_footprint.csv"
+
+footprint_header = ["Extension Name", "Requested Bytes", "Initialized Bytes", "LWLock Tranches", "LWLocks", "Estimated Bytes", "Unresolved"]
+
+# Size of an LWLock in the main LWLock array (LWLOCK_PADDED_SIZE).
+lwlock_padded_size = 128
+
+# Index of the size argument of each call.
+shmem_calls = {
+  "RequestAddinShmemSpace": 0,
+  "ShmemInitStruct": 1,
+  "ShmemInitHash": 2,
+  "RequestNamedLWLockTranche": 1
+}
+
+guc_pattern = re.compile(r"^DefineCustom(Bool|Int|Real|String|Enum)Variable$")
+
+# Postgres settings and constants at their defaults. MaxBackends is
+# max_connections + autovacuum_max_workers + 1 + max_worker_processes +
+# max_wal_senders.
+postgres_constants = {
+  "NAMEDATALEN": 64,
+  "MAXPGPATH": 1024,
+  "BLCKSZ": 8192,
+  "XLOG_BLCKSZ": 8192,
+  "PG_CACHE_LINE_SIZE": 128,
+  "MaxConnections": 100,
+  "MaxBackends": 122,
+  "max_worker_processes": 8,
+  "max_prepared_xacts": 0,
+  "NBuffers": 16384,
+  "NUM_FIXED_LWLOCKS": 196,
+  "INT_MAX": 2147483647,
+  "PG_INT32_MAX": 2147483647,
+  "true": 1,
+  "false": 0
+}
+
+# (size, alignment) of types from Postgres and C headers on x86-64.
+base_type_layouts = {
+  "char": (1, 1), "bool": (1, 1), "int8": (1, 1), "uint8": (1, 1), "slock_t": (1, 1),
+  "short": (2, 2), "int16": (2, 2), "uint16": (2, 2),
+  "int": (4, 4), "unsigned": (4, 4), "int32": (4, 4), "uint32": (4, 4), "float": (4, 4), "float4": (4, 4),
+  "Oid": (4, 4), "TransactionId": (4, 4), "BlockNumber": (4, 4), "pid_t": (4, 4), "RegProcedure": (4, 4),
+  "pg_atomic_uint32": (4, 4), "pg_atomic_flag": (4, 4), "ProcNumber": (4, 4), "BackendId": (4, 4),
+  "long": (8, 8), "int64": (8, 8), "uint64": (8, 8), "double": (8, 8), "float8": (8, 8), "Size": (8, 8), "size_t": (8, 8),
+  "Datum": (8, 8), "TimestampTz": (8, 8), "Timestamp": (8, 8), "XLogRecPtr": (8, 8), "pg_atomic_uint64": (8, 8),
+  "dsa_pointer": (8, 8), "dsm_handle": (4, 4), "LWLock": (16, 8), "LWLockPadded": (128, 128),
+  "ConditionVariable": (12, 4), "NameData": (64, 1), "Latch": (16, 8), "HTAB": (8, 8),
+  "int8_t": (1, 1), "uint8_t": (1, 1), "int16_t": (2, 2), "uint16_t": (2, 2), "int32_t": (4, 4), "uint32_t": (4, 4),
+  "int64_t": (8, 8), "uint64_t": (8, 8), "uintptr_t": (8, 8), "time_t": (8, 8)
+}
+
+type_qualifiers = ["const", "volatile", "struct", "signed", "static", "extern", "register", "union", "enum"]
+
+#####################################################################
+# SCANNING
+#####################################################################
+
+# Returns the top-level comma separated arguments of the call whose "("
+# is tokens[i], and the index after the ")".
+def get_call_args(tokens, i):
+  args = [[]]
+  depth = 0
+  for j in range(i, len(tokens)):
+    value = tokens[j][1]
+    if value in ["(", "[", "{"]:
+      depth += 1
+      if depth == 1:
+        continue
+    elif value in [")", "]", "}"]:
+      depth -= 1
+      if depth == 0:
+        return list(filter(lambda x: len(x) > 0, args)), j + 1
+    elif value == "," and depth == 1:
+      args.append([])
+      continue
+    args[-1].append(value)
+  return list(filter(lambda x: len(x) > 0, args)), len(tokens)
+
+# Turns token values back into tokens for get_call_args.
+def to_tokens(values):
+  return list(map(lambda x: (None, x), values))
+
+# Returns the tokens between tokens[i] == "{" and its closing brace, and the
+# index after it.
+def get_block(tokens, i):
+  depth = 0
+  for j in range(i, len(tokens)):
+    if tokens[j][1] == "{":
+      depth += 1
+    elif tokens[j][1] == "}":
+      depth -= 1
+      if depth == 0:
+        return list(map(lambda x: x[1], tokens[i + 1:j])), j + 1
+  return list(map(lambda x: x[1], tokens[i + 1:])), len(tokens)
+
+# Returns the tokens from tokens[i] up to the next top-level ";", and the
+# index of the ";".
+def get_until_semicolon(tokens, i):
+  values = []
+  depth = 0
+  for j in range(i, len(tokens)):
+    value = tokens[j][1]
+    if value in ["(", "[", "{"]:
+      depth += 1
+    elif value in [")", "]", "}"]:
+      depth -= 1
+      if depth < 0:
+        return values, j
+    elif value == ";" and depth == 0:
+      return values, j
+    values.append(value)
+  return values, len(tokens)
+
+# Returns the fields of a struct body as [type tokens, is pointer, array
+# dimensions (token lists)].
+def parse_struct_fields(values):
+  fields = []
+  statements = [[]]
+  depth = 0
+  for value in values:
+    if value in ["{", "("]:
+      depth += 1
+    elif value in ["}", ")"]:
+      depth -= 1
+    if value == ";" and depth == 0:
+      statements.append([])
+    else:
+      statements[-1].append(value)
+
+  for statement in filter(lambda x: len(x) > 0, statements):
+    if "{" in statement:
+      # Nested struct or union: its size isn't known.
+      fields.append([["?"], False, []])
+      continue
+    if "(" in statement:
+      # Function pointer.
+      fields.append([["void"], True, []])
+      continue
+    declarators = [[]]
+    for value in statement:
+      if value == ",":
+        declarators.append([])
+      else:
+        declarators[-1].append(value)
+    first = declarators[0]
+    if ":" in first:
+      first = first[:first.index(":")]
+    bracket = first.index("[") if "[" in first else len(first)
+    type_tokens = list(filter(lambda x: x not in type_qualifiers and x != "*", first[:bracket - 1]))
+    for declarator in [first] + declarators[1:]:
+      if ":" in declarator:
+        declarator = declarator[:declarator.index(":")]
+      dims = []
+      dim = None
+      for value in declarator:
+        if value == "[":
+          dim = []
+        elif value == "]":
+          dims.append(dim)
+          dim = None
+        elif dim is not None:
+          dim.append(value)
+      is_pointer = "*" in (declarator[:bracket] if declarator is first else declarator)
+      fields.append([type_tokens, is_pointer, dims])
+  return fields
+
+# Scans one C file. Returns a dict with:
+#   calls: [call, size tokens, entrysize tokens or None, line]
+#   defines: {macro: body tokens}
+#   variables: {variable: initial value tokens}, GUC boot values included
+#   structs: {type: fields (see parse_struct_fields)}
+#   typedefs: {type: [type tokens, is pointer]}
+#   size_functions: {function: body statements} for functions returning Size
+# tokens, if given, are the file's tokens from hook_installations.tokenize.
+def scan_c_shmem(text, tokens=None):
+  tokens = hook_installations.tokenize(text) if tokens is None else tokens
+  scan = {"calls": [], "defines": {}, "variables": {}, "structs": {}, "typedefs": {}, "size_functions": {}}
+  brace_depth = 0
+  statement_start = 0
+  candidate = None
+  candidate_type = []
+  size_function = None
+  entrysize = None
+  i = 0
+  while i < len(tokens):
+    kind, value, line = tokens[i]
+    prev_value = tokens[i - 1][1] if i > 0 else None
+    next_value = tokens[i + 1][1] if i + 1 < len(tokens) else None
+
+    if kind == "define":
+      j = i + 1
+      body = []
+      while j < len(tokens) and tokens[j][0] != "end_define":
+        body.append(tokens[j][1])
+        j += 1
+      if len(body) > 0:
+        scan["defines"][value] = body
+      i = j + 1
+      statement_start = i
+      continue
+
+    if kind == "identifier" and value in ["struct", "typedef"] and brace_depth == 0:
+      j = i + 1 if value == "struct" else i + 2
+      if value == "typedef" and next_value != "struct":
+        declaration, end = get_until_semicolon(tokens, i + 1)
+        names = list(filter(lambda x: re.match(r"^[A-Za-z_]\w*$", x), declaration))
+        if len(names) >= 2 and names[0] == "enum":
+          scan["typedefs"][names[-1]] = [["int"], False]
+        elif "(" not in declaration and "{" not in declaration and len(names) >= 2:
+          scan["typedefs"][names[-1]] = [list(filter(lambda x: x not in type_qualifiers, names[:-1])), "*" in declaration]
+        i = end + 1
+        statement_start = i
+        continue
+      tag = None
+      if j < len(tokens) and tokens[j][0] == "identifier":
+        tag = tokens[j][1]
+        j += 1
+      if j < len(tokens) and tokens[j][1] == "{":
+        body, end = get_block(tokens, j)
+        fields = parse_struct_fields(body)
+        if tag is not None:
+          scan["structs"][tag] = fields
+        declaration, end = get_until_semicolon(tokens, end)
+        if value == "typedef" and len(declaration) > 0 and re.match(r"^[A-Za-z_]\w*$", declaration[-1]):
+          if "*" in declaration:
+            scan["typedefs"][declaration[-1]] = [["void"], True]
+          else:
+            scan["structs"][declaration[-1]] = fields
+        i = end + 1
+        statement_start = i
+        continue
+
+    if value == "(" and brace_depth == 0 and i > 0 and tokens[i - 1][0] == "identifier" and candidate is None:
+      candidate = prev_value
+      candidate_type = list(map(lambda x: x[1], tokens[statement_start:i - 1]))
+    elif value == "{":
+      if brace_depth == 0 and prev_value == ")" and candidate is not None:
+        if "Size" in candidate_type or "size_t" in candidate_type:
+          size_function = candidate
+          scan["size_functions"][size_function] = [[]]
+      brace_depth += 1
+    elif value == "}":
+      brace_depth = max(0, brace_depth - 1)
+      if brace_depth == 0:
+        size_function = None
+        entrysize = None
+        candidate = None
+        statement_start = i + 1
+    elif value == ";" and brace_depth == 0:
+      declaration = list(map(lambda x: x[1], tokens[statement_start:i]))
+      if "=" in declaration and "(" not in declaration[:declaration.index("=")]:
+        name = declaration[declaration.index("=") - 1]
+        if re.match(r"^[A-Za-z_]\w*$", name):
+          scan["variables"].setdefault(name, declaration[declaration.index("=") + 1:])
+      candidate = None
+      statement_start = i + 1
+
+    if size_function is not None and brace_depth > 0:
+      statements = scan["size_functions"][size_function]
+      if value in [";", "{", "}"]:
+        if len(statements[-1]) > 0:
+          statements.append([])
+      else:
+        statements[-1].append(value)
+
+    if value == "entrysize" and prev_value in [".", "->"] and next_value == "=":
+      entrysize, _ = get_until_semicolon(tokens, i + 2)
+
+    if kind == "identifier" and next_value == "(" and value in shmem_calls:
+      args, _ = get_call_args(tokens, i + 1)
+      if len(args) > shmem_calls[value]:
+        scan["calls"].append([value, args[shmem_calls[value]], entrysize if value == "ShmemInitHash" else None, line])
+    elif kind == "identifier" and next_value == "(" and guc_pattern.match(value):
+      args, _ = get_call_args(tokens, i + 1)
+      if len(args) > 4 and args[3][0] == "&" and len(args[3]) == 2:
+        scan["variables"][args[3][1]] = args[4]
+    i += 1
+
+  for name in scan["size_functions"]:
+    scan["size_functions"][name] = list(filter(lambda x: len(x) > 0, scan["size_functions"][name]))
+  return scan
+
+#####################################################################
+# EVALUATION
+#####################################################################
+
+class Unresolved(Exception):
+  pass
+
+def align(size, alignment):
+  return (size + alignment - 1) // alignment * alignment
+
+def next_pow2(n):
+  power = 1
+  while power < n:
+    power <<= 1
+  return power
+
+# hash_estimate_size() of dynahash.c, for a hash table with the default
+# segment and directory sizes.
+def hash_estimate_size(num_entries, entry_size):
+  num_entries = max(1, num_entries)
+  num_buckets = next_pow2(num_entries)
+  num_segments = next_pow2((num_buckets - 1) // 256 + 1)
+  num_dir_entries = max(256, next_pow2(num_segments))
+  size = 896 + num_dir_entries * 8 + num_segments * 256 * 8
+  element_size = 16 + align(entry_size, 8)
+  alloc_size = 128
+  elements_per_alloc = 0
+  while elements_per_alloc < 32:
+    alloc_size <<= 1
+    elements_per_alloc = alloc_size // element_size
+  return size + ((num_entries - 1) // elements_per_alloc + 1) * elements_per_alloc * element_size
+
+binary_precedence = {"|": 1, "^": 2, "&": 3, "<<": 4, ">>": 4, "+": 5, "-": 5, "*": 6, "/": 6, "%": 6}
+
+# Evaluates size expressions (token lists) against the scans of all files of
+# an extension. constants adds to postgres_constants.
+class SizeEvaluator:
+  def __init__(self, scans, constants={}):
+    self.constants = dict(postgres_constants, **constants)
+    self.defines = {}
+    self.variables = {}
+    self.structs = {}
+    self.typedefs = {}
+    self.size_functions = {}
+    for scan in scans:
+      self.defines.update(scan["defines"])
+      self.variables.update(scan["variables"])
+      self.structs.update(scan["structs"])
+      self.typedefs.update(scan["typedefs"])
+      self.size_functions.update(scan["size_functions"])
+    self.depth = 0
+    self.values = []
+    self.pos = 0
+    self.local_vars = {}
+
+  # Evaluates values; can be called while another expression is evaluated,
+  # whose position is kept.
+  def evaluate(self, values, local_vars={}):
+    if self.depth > 50:
+      raise Unresolved("recursion")
+    saved = (self.values, self.pos, self.local_vars)
+    self.depth += 1
+    self.values = values
+    self.pos = 0
+    self.local_vars = local_vars
+    try:
+      result = self.parse_binary(0)
+      if self.pos != len(self.values):
+        raise Unresolved(" ".join(values))
+      return result
+    finally:
+      self.depth -= 1
+      (self.values, self.pos, self.local_vars) = saved
+
+  def peek(self, offset=0):
+    return self.values[self.pos + offset] if self.pos + offset < len(self.values) else None
+
+  def parse_binary(self, min_precedence):
+    left = self.parse_unary()
+    while self.peek() in binary_precedence and binary_precedence[self.peek()] >= min_precedence:
+      operator = self.peek()
+      self.pos += 1
+      right = self.parse_binary(binary_precedence[operator] + 1)
+      if operator == "+": left = left + right
+      elif operator == "-": left = left - right
+      elif operator == "*": left = left * right
+      elif operator in ["/", "%"]:
+        if right == 0:
+          raise Unresolved("division by zero")
+        left = left // right if operator == "/" else left % right
+      elif operator == "<<": left = left << right
+      elif operator == ">>": left = left >> right
+      elif operator == "&": left = left & right
+      elif operator == "^": left = left ^ right
+      else: left = left | right
+    return left
+
+  def get_parenthesized(self):
+    args, self.pos = get_call_args(to_tokens(self.values), self.pos)
+    return args
+
+  def is_type_name(self, value):
+    return value in base_type_layouts or value in self.structs or value in self.typedefs or value in type_qualifiers or value.endswith("_t")
+
+  def parse_unary(self):
+    value = self.peek()
+    if value is None:
+      raise Unresolved("empty expression")
+    if value in ["-", "+", "~"]:
+      self.pos += 1
+      operand = self.parse_unary()
+      return -operand if value == "-" else (~operand if value == "~" else operand)
+    if value == "(":
+      # (Size) casts are skipped.
+      j = self.pos + 1
+      while self.peek(j - self.pos) is not None and (self.is_type_name(self.values[j]) or self.values[j] == "*"):
+        j += 1
+      if j > self.pos + 1 and self.peek(j - self.pos) == ")":
+        self.pos = j + 1
+        return self.parse_unary()
+      self.pos += 1
+      result = self.parse_binary(0)
+      if self.peek() != ")":
+        raise Unresolved("unbalanced parentheses")
+      self.pos += 1
+      return result
+    self.pos += 1
+    if re.match(r"^\d", value):
+      number = re.sub(r"[uUlL]+$", "", value)
+      try:
+        return int(number, 0) if not re.search(r"[.eE]", number) or number.startswith("0x") else int(float(number))
+      except ValueError:
+        raise Unresolved(value)
+    if value.startswith("'") or value.startswith("\""):
+      raise Unresolved(value)
+    if self.peek() == "(":
+      args = self.get_parenthesized()
+      return self.call(value, args)
+    return self.resolve(value)
+
+  def resolve(self, name):
+    if name in self.local_vars:
+      return self.local_vars[name]
+    if name in self.constants:
+      return self.constants[name]
+    if name in self.defines:
+      return self.evaluate(self.defines[name])
+    if name in self.variables:
+      return self.evaluate(self.variables[name])
+    raise Unresolved(name)
+
+  def call(self, name, args):
+    if name == "sizeof":
+      if len(args) != 1:
+        raise Unresolved("sizeof")
+      return self.sizeof(args[0])
+    evaluated = lambda: list(map(lambda x: self.evaluate(x, self.local_vars), args))
+    if name == "add_size" and len(args) == 2:
+      return sum(evaluated())
+    if name == "mul_size" and len(args) == 2:
+      values = evaluated()
+      return values[0] * values[1]
+    if name in ["Max", "Min"] and len(args) == 2:
+      return max(evaluated()) if name == "Max" else min(evaluated())
+    if name in ["MAXALIGN", "MAXALIGN64"] and len(args) == 1:
+      return align(evaluated()[0], 8)
+    if name == "BUFFERALIGN" and len(args) == 1:
+      return align(evaluated()[0], 32)
+    if name == "CACHELINEALIGN" and len(args) == 1:
+      return align(evaluated()[0], 128)
+    if name == "TYPEALIGN" and len(args) == 2:
+      values = evaluated()
+      return align(values[1], values[0])
+    if name == "hash_estimate_size" and len(args) == 2:
+      values = evaluated()
+      return hash_estimate_size(values[0], values[1])
+    if name == "offsetof" and len(args) == 2:
+      return self.sizeof(args[0])
+    if name in self.size_functions:
+      return self.run_size_function(name)
+    raise Unresolved(name + "()")
+
+  # Runs the assignments of a function returning a Size, ignoring control
+  # flow: conditional additions are counted.
+  def run_size_function(self, name):
+    local_vars = {}
+    for statement in self.size_functions[name]:
+      while len(statement) > 0 and statement[0] in ["if", "while", "for", "else", "switch"]:
+        if len(statement) > 1 and statement[1] == "(":
+          _, end = get_call_args(to_tokens(statement), 1)
+          statement = statement[end:]
+        else:
+          statement = statement[1:]
+      if len(statement) > 1 and statement[0] == "return":
+        return self.evaluate(statement[1:], local_vars)
+      for operator in ["=", "+="]:
+        if operator in statement:
+          index = statement.index(operator)
+          target = statement[index - 1] if index > 0 else None
+          try:
+            result = self.evaluate(statement[index + 1:], local_vars)
+          except Unresolved:
+            if operator == "=" and target in local_vars:
+              raise
+            break
+          local_vars[target] = local_vars.get(target, 0) + result if operator == "+=" else result
+          break
+    raise Unresolved(name + "()")
+
+  def sizeof(self, values):
+    names = list(filter(lambda x: x not in type_qualifiers, values))
+    if "*" in names:
+      return 8
+    if len(names) == 1 and self.is_type_name(names[0]):
+      return self.get_layout([names[0]])[0]
+    if len(names) == 2 and names[0] in ["unsigned", "long", "short"]:
+      return self.get_layout([names[1]])[0]
+    if len(names) == 1 and names[0] in self.variables:
+      raise Unresolved("sizeof(" + names[0] + ")")
+    raise Unresolved("sizeof(" + " ".join(values) + ")")
+
+  # Returns (size, alignment) of a type.
+  def get_layout(self, type_tokens, seen=None):
+    seen = set() if seen is None else seen
+    names = list(filter(lambda x: x not in type_qualifiers, type_tokens))
+    if len(names) == 0:
+      raise Unresolved("type")
+    name = names[-1]
+    if name in seen:
+      raise Unresolved("recursive type " + name)
+    if name in self.typedefs:
+      (target, is_pointer) = self.typedefs[name]
+      return (8, 8) if is_pointer else self.get_layout(target, seen | {name})
+    if name in self.structs:
+      size = 0
+      alignment = 1
+      for (field_type, is_pointer, dims) in self.structs[name]:
+        (field_size, field_alignment) = (8, 8) if is_pointer else self.get_layout(field_type, seen | {name})
+        count = 1
+        for dim in dims:
+          count *= 0 if len(dim) == 0 or dim == ["FLEXIBLE_ARRAY_MEMBER"] else self.evaluate(dim)
+        size = align(size, field_alignment) + field_size * count
+        alignment = max(alignment, field_alignment)
+      return (align(size, alignment), alignment)
+    if name in base_type_layouts:
+      return base_type_layouts[name]
+    raise Unresolved("sizeof(" + name + ")")
+
+# Returns [requested bytes, initialized bytes, LWLock tranches, LWLocks,
+# estimated bytes, unresolved expressions] for the scans of an extension's
+# files.
+def estimate_footprint(scans):
+  evaluator = SizeEvaluator(scans)
+  requested = 0
+  initialized = 0
+  tranches = 0
+  lwlocks = 0
+  unresolved = []
+  for scan in scans:
+    for (call, size_values, entrysize_values, line) in scan["calls"]:
+      try:
+        size = evaluator.evaluate(size_values)
+        if call == "ShmemInitHash":
+          if entrysize_values is None:
+            raise Unresolved("entrysize")
+          size = hash_estimate_size(size, evaluator.evaluate(entrysize_values))
+      except Unresolved:
+        unresolved.append(call + "(" + " ".join(size_values) + ")")
+        continue
+      if call == "RequestAddinShmemSpace":
+        requested += size
+      elif call == "RequestNamedLWLockTranche":
+        tranches += 1
+        lwlocks += size
+      else:
+        initialized += size
+  estimated = max(requested, initialized) + lwlocks * lwlock_padded_size
+  return [requested, initialized, tranches, lwlocks, estimated, sorted(set(unresolved))]
+
+#####################################################################
+# PAIRS
+#####################################################################
+
+def parse_size(text):
+  match = re.match(r"^(\d+)\s*([kKmMgG]?)[bB]?$", text.strip())
+  if match is None:
+    sys.exit("Invalid size " + text + ".")
+  return int(match.group(1)) * {"": 1, "k": 1024, "m": 1024 ** 2, "g": 1024 ** 3}[match.group(2).lower()]
+
+def format_size(num_bytes):
+  for unit in ["B", "kB", "MB"]:
+    if num_bytes < 1024:
+      return str(round(num_bytes, 1)) + " " + unit
+    num_bytes /= 1024
+  return str(round(num_bytes, 1)) + " GB"
+
+# Returns {extension: (estimated bytes, LWLocks)} from shmem_footprint.csv.
+def load_footprints(path=default_footprint_file):
+  footprints = {}
+  if not os.path.exists(path):
+    return footprints
+  footprint_file = open(path, "r")
+  reader = csv.reader(footprint_file)
+  next(reader, [])
+  for row in reader:
+    footprints[row[0]] = (int(row[5]), int(row[4]))
+  footprint_file.close()
+  return footprints
+
+# Returns (pair, estimated bytes, LWLocks) for every pair of extns_list,
+# largest first.
+def get_pair_footprints(extns_list, footprints):
+  pairs = []
+  for (first_extn, second_extn) in itertools.combinations(extns_list, 2):
+    first = footprints.get(first_extn, (0, 0))
+    second = footprints.get(second_extn, (0, 0))
+    pairs.append(((first_extn, second_extn), first[0] + second[0], first[1] + second[1]))
+  pairs.sort(key=lambda x: x[1], reverse=True)
+  return pairs
+
+def scan_dir(source_dir):
+  scans = []
+  for root, _, files in os.walk(source_dir):
+    for name in sorted(files):
+      if os.path.splitext(name)[1] in [".c", ".h", ".cc", ".cpp", ".cxx", ".hh"]:
+        source_file = open(os.path.join(root, name), "r", errors="replace")
+        scans.append(scan_c_shmem(source_file.read()))
+        source_file.close()
+  return scans
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Estimates the shared memory and LWLocks of extensions and of their pairs.')
+  parser.add_argument('command', choices=['scan', 'pairs'])
+  parser.add_argument('args', nargs='*')
+  parser.add_argument('-f', '--footprints', action='store', default=default_footprint_file, help='shmem_footprint.csv written by extension_info.py')
+  parser.add_argument('-l', '--list', action='store', help='text file with the extensions to pair')
+  parser.add_argument('-b', '--budget', action='store', help='only print pairs above this much shared memory (e.g. 64MB)')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['command'] == 'scan':
+    for source_dir in args_dict['args']:
+      scans = scan_dir(source_dir)
+      for scan in scans:
+        for (call, size_values, entrysize_values, line) in scan["calls"]:
+          print(call + "(" + " ".join(size_values) + ")" + (" entrysize " + " ".join(entrysize_values) if entrysize_values is not None else ""))
+      requested, initialized, tranches, lwlocks, estimated, unresolved = estimate_footprint(scans)
+      print(source_dir + ": " + format_size(estimated) + " (requested " + format_size(requested) + ", initialized " + format_size(initialized) + ", " + str(lwlocks) + " LWLocks in " + str(tranches) + " tranches)")
+      for expression in unresolved:
+        print("  unresolved: " + expression)
+  else:
+    if args_dict['list'] is None:
+      sys.exit("No list argument parameter.")
+    list_file = open(args_dict['list'], "r")
+    extns_list = list(filter(lambda x: x != "", map(lambda x: x.strip("\n"), list_file.readlines())))
+    list_file.close()
+    budget = parse_size(args_dict['budget']) if args_dict['budget'] is not None else 0
+    pair_footprints = get_pair_footprints(extns_list, load_footprints(args_dict['footprints']))
+    over_budget = list(filter(lambda x: x[1] > budget, pair_footprints))
+    for ((first_extn, second_extn), num_bytes, lwlocks) in over_budget:
+      print(first_extn + " " + second_extn + ": " + format_size(num_bytes) + ", " + str(lwlocks) + " LWLocks")
+    if budget > 0:
+      print(str(len(over_budget)) + "/" + str(len(pair_footprints)) + " pairs over " + format_size(budget))
@@ -1,7 +1,11 @@
+import analysis_cache
+import argparse
 import csv
 from datetime import datetime
+import io
 import json
 import os
+import parallel_driver
 import re
 import subprocess
 import sys
@@ -18,12 +22,22 @@ postgres_version = "15.3"
 now = datetime.now()
 date_time = now.strftime("%m-%d-%Y_%H:%M")
 testing_output_dir = "testing-output-" + date_time
+postgres_source_dir = current_working_dir + "/postgresql-" + postgres_version
+
+# Scan and CPD results are cached by content (analysis_cache.py); bump the
+# version whenever an analysis below returns something different.
+analyzer_version = "1"
+analysis_cache_db = analysis_cache.default_cache_db
 pmd_cpd_dir = "pmd-bin-7.0.0-rc4"
 tmp_dir = "tmp"
 
 # PMD argument globals
 pmd_command = "./pmd-bin-7.0.0-rc4/bin/pmd cpd --minimum-tokens 100"
 pmd_options = "  --language cpp  --no-fail-on-violation"
+# Every job runs PMD CPD in its own JVM. The heap is capped (through
+# PMD_JAVA_OPTS, unless it is already set) and the default number of jobs is
+# bounded by how many such JVMs fit in the available memory.
+pmd_job_memory_mb = 2048
 
 # Common C/C++ extensions
 common_c_file_extns = ["h", "hh", "c", "cpp", "cc", "cxx", "cpp"]
@@ -65,11 +79,10 @@ def move_sca_files():
   subprocess.run("cp -R *_cpd.txt ../sca_analysis_output", shell=True, cwd=current_working_dir + "/" + testing_output_dir)
 
 # Function that downloads the extension source code
-def download_extn(extn_name, terminal_file):
+def download_extn(extn_name, terminal_file, extension_dir=current_working_dir + "/" + ext_work_dir):
   extn_entry = extn_db[extn_name]
 
   print("Downloading extension " + extn_name)
-  extension_dir = current_working_dir + "/" + ext_work_dir
   
   download_type = extn_entry["download_method"]
   if download_type == "git":
@@ -119,8 +132,14 @@ def parse_interval(line, num_lines):
 
   return key, (line_start, min(line_start + num_lines - 1, num_key_file_lines - 1))
 
+# The part of the extension's source paths that CPD output is matched against.
+def get_efolder(extn_name, extension_dir):
+  if extn_db[extn_name]["download_method"] == "contrib":
+    return "/contrib/" + extn_db[extn_name]["folder_name"] + "/"
+  return extension_dir + "/" + extn_db[extn_name]["folder_name"] + "/"
+
 # Number of lines, number of tokens
-def process_err(extn_name, err):
+def process_err(extn_name, err, extension_dir=current_working_dir + "/" + ext_work_dir):
   err_dict = {}
   list_of_lines = err.split('\n')
   first_pattern = r"Found a \d+ line \(\d+ tokens\) duplication in the following files:"
@@ -129,8 +148,7 @@ def process_err(extn_name, err):
   list_of_lines.sort()
   num_lines = parse_stats(list_of_lines[0])
 
-  parent_folder = "contrib" if extn_db[extn_name]["download_method"] == "contrib" else ext_work_dir
-  efolder = "/" + parent_folder + "/" + extn_db[extn_name]["folder_name"] + "/"
+  efolder = get_efolder(extn_name, extension_dir)
 
   for elem in list_of_lines[1:]:
     key, (ls, le) = parse_interval(elem, num_lines)
@@ -205,10 +223,7 @@ def get_total_loc(extn_name, source_dir):
     for name in files:
       _, file_ext = os.path.splitext(name)
       if (file_ext[1:] in common_c_file_extns and "rust" not in extn_entry) or (file_ext[1:] == "rs" and "rust" in extn_entry):
-        tmp_source_file = open(os.path.join(source_dir, os.path.join(root, name)), "r")
-        code_lines = tmp_source_file.readlines()
-        total_loc += len(code_lines)
-        tmp_source_file.close()
+        total_loc += analysis_cache.scan_file("source_code_analysis.loc", analyzer_version, os.path.join(source_dir, os.path.join(root, name)), lambda x: len(io.StringIO(x).readlines()), analysis_cache_db)
   return total_loc
 
 def output_error_mapping(extn_name, err_mapping):
@@ -241,14 +256,61 @@ def get_version_nums(cl : str):
         continue
   return version_nums
 
+# Returns the merged line intervals of a C file's PG_VERSION_NUM guards, and
+# the major versions they test.
+def scan_version_guards(text, name):
+  pg_version_list = []
+  # Storing tuples with indexes and bool as to whether its a pg_version if
+  pstack = []
+  code_intervals = []
+  for i, cl in enumerate(io.StringIO(text)):
+    if "#if" in cl or "# if" in cl:
+      flag = "PG_VERSION_NUM" in cl
+      pstack.append((i, flag))
+      if flag:
+        pg_version_list += get_version_nums(cl)
+    elif "#endif" in cl:
+      if len(pstack) == 0:
+        raise IndexError("No matching closing endif at line " + str(i) + " in file " + name)
+      last_entry = pstack.pop() 
+      if last_entry[1]:
+        code_intervals.append([last_entry[0], i])
+  return [get_merged_interval(code_intervals), pg_version_list]
+
 ############################################################
 # CPD ANALYSIS
 ############################################################
 
+# Runs CPD on the extension's sources, unless they, Postgres and the CPD
+# options are the same as in a cached run. The _cpd.txt and _err_mapping.txt
+# outputs are cached with the stats, and written again on a hit.
+def run_cpd_analysis(extn_name, source_dir, extension_dir=current_working_dir + "/" + ext_work_dir):
+  output_file_names = [extn_name + "_cpd.txt", extn_name + "_err_mapping.txt"]
+  output_dir = current_working_dir + "/" + testing_output_dir
+
+  def compute():
+    stats = run_pmd_cpd_analysis(extn_name, source_dir, extension_dir)
+    outputs = {}
+    for file_name in output_file_names:
+      if os.path.exists(output_dir + "/" + file_name):
+        output_file = open(output_dir + "/" + file_name, "r")
+        outputs[file_name] = output_file.read()
+        output_file.close()
+    return {"stats": stats, "outputs": outputs}
+
+  key = analysis_cache.hash_strings([postgres_version, pmd_command, pmd_options, source_dir, extension_dir, analysis_cache.get_tree_hash(source_dir)])
+  result = analysis_cache.cached("source_code_analysis.cpd", analyzer_version, key, compute, analysis_cache_db)
+  for file_name in result["outputs"]:
+    if not os.path.exists(output_dir + "/" + file_name):
+      output_file = open(output_dir + "/" + file_name, "w")
+      output_file.write(result["outputs"][file_name])
+      output_file.close()
+  return tuple(map(tuple, result["stats"]))
+
 # Return total_copied_loc/tokens, copied_postgres_loc/tokens, copied_extn_loc/tokens
-def run_cpd_analysis(extn_name, source_dir):
+def run_pmd_cpd_analysis(extn_name, source_dir, extension_dir=current_working_dir + "/" + ext_work_dir):
   print("Running CPD analysis on " + extn_name)
-  postgres_src_dir = current_working_dir + "/postgresql-" + postgres_version + "/src"
+  postgres_src_dir = postgres_source_dir + "/src"
   postgres_command = pmd_command + (" --dir " + postgres_src_dir)
   postgres_command += " --dir " + source_dir
   postgres_command += pmd_options
@@ -264,14 +326,13 @@ def run_cpd_analysis(extn_name, source_dir):
 
   total_num_instances = 0
 
-  parent_folder = "contrib" if extn_db[extn_name]["download_method"] == "contrib" else ext_work_dir
-  efolder = "/" + parent_folder + "/" + extn_db[extn_name]["folder_name"] + "/"
+  efolder = get_efolder(extn_name, extension_dir)
   postgres_err_mapping = {}
   extn_err_mapping = {}
   total_err_mapping = {}
   for err in postgres_list_of_errors:
     if efolder in err:
-      err_dict = process_err(extn_name, err)
+      err_dict = process_err(extn_name, err, extension_dir)
       if postgres_src_dir in err:
         update_error_mapping(err_dict, postgres_err_mapping)
       else:
@@ -294,7 +355,9 @@ def run_cpd_analysis(extn_name, source_dir):
   return (tc_loc, tc_tokens), (pc_loc, pc_tokens), (ec_loc, ec_tokens)
 
 # Versioning Analysis: Versioning LOC, Copied LOC between versions/tokens
-def run_version_analysis(extn_name, source_dir):
+# The versioning code is copied to files in version_source_dir, which only
+# holds this extension's files.
+def run_version_analysis(extn_name, source_dir, extension_dir=current_working_dir + "/" + ext_work_dir, version_source_dir=current_working_dir + "/" + testing_output_dir + "/" + tmp_dir):
   print("Running version analysis on " + extn_name)
   versioning_loc = 0
   versioning_files = []
@@ -303,32 +366,18 @@ def run_version_analysis(extn_name, source_dir):
     for name in files:
       _, file_ext = os.path.splitext(name)
       if file_ext[1:] in common_c_file_extns:
-        tmp_source_file = open(os.path.join(source_dir, os.path.join(root, name)), "r")
-        code_lines = tmp_source_file.readlines()
-        tmp_source_file.close()
-
-        # Storing tuples with indexes and bool as to whether its a pg_version if
-        pstack = []
-        code_intervals = []
-        for i, cl in enumerate(code_lines):
-          if "#if" in cl or "# if" in cl:
-            flag = "PG_VERSION_NUM" in cl
-            pstack.append((i, flag))
-            if flag:
-              pg_version_list += get_version_nums(cl)
-          elif "#endif" in cl:
-            if len(pstack) == 0:
-              raise IndexError("No matching closing endif at line " + str(i) + " in file " + name)
-            last_entry = pstack.pop() 
-            if last_entry[1]:
-              code_intervals.append([last_entry[0], i])
-
-        if len(code_intervals) != 0:
-          ci_stack = get_merged_interval(code_intervals)
+        source_path = os.path.join(source_dir, os.path.join(root, name))
+        ci_stack, version_nums = analysis_cache.scan_file("source_code_analysis.version_guards", analyzer_version, source_path, lambda x: scan_version_guards(x, name), analysis_cache_db)
+        pg_version_list += version_nums
+
+        if len(ci_stack) != 0:
+          tmp_source_file = open(source_path, "r")
+          code_lines = tmp_source_file.readlines()
+          tmp_source_file.close()
         
           # In the tmp directory we create a file called tmp_name and copy all the code from these
           # intervals in this code
-          tmp_version_code_file_name = current_working_dir + "/" + testing_output_dir + "/" + tmp_dir + "/" + "tmp_" + name
+          tmp_version_code_file_name = version_source_dir + "/" + "tmp_" + name
           tmp_version_code_file = open(tmp_version_code_file_name, "w")
           versioning_files.append(tmp_version_code_file_name)
         
@@ -345,30 +394,33 @@ def run_version_analysis(extn_name, source_dir):
   pg_version_list = list(set(pg_version_list))
 
   # Running CPD analysis on just versioning code
-  version_source_dir = current_working_dir + "/" + testing_output_dir + "/" + tmp_dir
-  version_command = pmd_command + (" --dir " + version_source_dir)
-  version_command += pmd_options
+  def compute():
+    version_command = pmd_command + (" --dir " + version_source_dir)
+    version_command += pmd_options
 
-  version_analysis = subprocess.run(version_command, shell=True, capture_output=True, cwd=current_working_dir)
-  version_decoded_output = version_analysis.stdout.decode('utf-8')
-  
-  if version_decoded_output == "":
-    return versioning_loc, (0, 0), pg_version_list
-
-  version_list_of_errors = version_decoded_output.split("=====================================================================")
-  err_mapping = {}
-  for err in version_list_of_errors:
-    err_dict = process_err(extn_name, err)
-    update_error_mapping(err_dict, err_mapping)
-  
-  vc_loc, vc_tokens = convert_mapping_to_stats(err_mapping)
+    version_analysis = subprocess.run(version_command, shell=True, capture_output=True, cwd=current_working_dir)
+    version_decoded_output = version_analysis.stdout.decode('utf-8')
+    
+    if version_decoded_output == "":
+      return [0, 0]
+
+    version_list_of_errors = version_decoded_output.split("=====================================================================")
+    err_mapping = {}
+    for err in version_list_of_errors:
+      err_dict = process_err(extn_name, err, extension_dir)
+      update_error_mapping(err_dict, err_mapping)
+    
+    return list(convert_mapping_to_stats(err_mapping))
+
+  key = analysis_cache.hash_strings([pmd_command, pmd_options, extension_dir, analysis_cache.get_tree_hash(version_source_dir)])
+  vc_loc, vc_tokens = analysis_cache.cached("source_code_analysis.version_cpd", analyzer_version, key, compute, analysis_cache_db)
 
   # Clear temp for other extensions
   subprocess.run("rm -rf *", shell=True, cwd=version_source_dir)
 
   return versioning_loc, (vc_loc, vc_tokens), pg_version_list
 
-def run_sca_analysis(extn_name, results_csv, versioning_csv, vers_chcklist_csv):
+def run_sca_analysis(extn_name, results_csv, versioning_csv, vers_chcklist_csv, extension_dir=current_working_dir + "/" + ext_work_dir, version_source_dir=current_working_dir + "/" + testing_output_dir + "/" + tmp_dir):
   extn_entry = extn_db[extn_name]
   download_type = extn_entry["download_method"]
   if download_type == "downloaded":
@@ -377,19 +429,18 @@ def run_sca_analysis(extn_name, results_csv, versioning_csv, vers_chcklist_csv):
   print("Running source code analysis on " + extn_name)
   source_dir ="" 
   if download_type == "contrib":
-    source_dir = current_working_dir + "/postgresql-" + postgres_version + "/contrib/" + extn_entry["folder_name"]
+    source_dir = postgres_source_dir + "/contrib/" + extn_entry["folder_name"]
   else:
-    extension_dir = current_working_dir + "/" + ext_work_dir
     source_dir = extension_dir + "/" + extn_entry["folder_name"] + "/" + extn_entry["source_dir"]
 
   # Determine Total LOC in extension codebase
   total_loc = get_total_loc(extn_name, source_dir)
 
   # Run CPD analysis
-  (tc_loc, tc_tokens), (pc_loc, pc_tokens), (ec_loc, ec_tokens) = run_cpd_analysis(extn_name, source_dir)
+  (tc_loc, tc_tokens), (pc_loc, pc_tokens), (ec_loc, ec_tokens) = run_cpd_analysis(extn_name, source_dir, extension_dir)
   print(pc_loc)
 
-  versioning_loc, (vc_loc, vc_tokens), pg_version_list = run_version_analysis(extn_name, source_dir)
+  versioning_loc, (vc_loc, vc_tokens), pg_version_list = run_version_analysis(extn_name, source_dir, extension_dir, version_source_dir)
   pg_version_list.sort()
   
   results_csv.writerow([
@@ -419,17 +470,12 @@ def run_sca_analysis(extn_name, results_csv, versioning_csv, vers_chcklist_csv):
 
   print("Finished running source code analysis on " + extn_name)
 
-if __name__ == '__main__':
-  # Download Postgres 
-  initial_setup()
-
-  # Terminal file
-  terminal_file = open(testing_output_dir + "/terminal.txt", "a")
+############################################################
+# DRIVER
+############################################################
 
-  # CSV files
-  sca_csv_file = open("source_code_analysis.csv", "w")
-  sca_csv_file_writer = csv.writer(sca_csv_file)
-  sca_csv_file_writer.writerow([
+output_files = [
+  ("source_code_analysis.csv", [
     "Extension Name", 
     "Total LOC", 
     "Total Copied LOC", 
@@ -437,53 +483,59 @@ if __name__ == '__main__':
     "Copied Extn LOC",
     "Total Copied Tokens",
     "Copied Postgres Tokens",
-    "Copied Extn Tokens"])
-
-  vers_csv_file = open("versioning.csv", "w")
-  vers_csv_file_writer = csv.writer(vers_csv_file)
-  vers_csv_file_writer.writerow([
+    "Copied Extn Tokens"]),
+  ("versioning.csv", [
     "Extension Name", 
     "Total LOC",
     "Versioning?", 
     "Versioning LOC", 
     "Copied Versioning LOC",
-    "Copied Versioning Tokens"])
+    "Copied Versioning Tokens"]),
+  ("version_checklist.csv", ["Extension Name"] + list(map(lambda x: "V" + str(x), range(1, 17))))
+]
+
+# Analyzes the sources of one extension, downloaded to extension_dir, with its
+# own tmp directory. Returns its rows for each of output_files.
+def analyze_extn_sources(extn_name, extension_dir):
+  version_source_dir = parallel_driver.get_extn_work_dir(current_working_dir + "/" + testing_output_dir + "/" + tmp_dir, extn_name)
+  subprocess.run("mkdir -p " + version_source_dir, shell=True, cwd=current_working_dir)
+  writers = [parallel_driver.RowCollector(), parallel_driver.RowCollector(), parallel_driver.RowCollector()]
+  run_sca_analysis(extn_name, writers[0], writers[1], writers[2], extension_dir, version_source_dir)
+  subprocess.run("rm -rf " + version_source_dir, shell=True, cwd=current_working_dir)
+  return list(map(lambda x: x.rows, writers))
+
+# Downloads and analyzes one extension in its own work directory.
+def analyze_extn(extn_name):
+  extension_dir = parallel_driver.get_extn_work_dir(current_working_dir + "/" + ext_work_dir, extn_name)
+  subprocess.run("mkdir -p " + extension_dir, shell=True, cwd=current_working_dir)
+  terminal_file = open(testing_output_dir + "/terminal.txt", "a")
+  download_extn(extn_name, terminal_file, extension_dir)
+  terminal_file.close()
+  rows = analyze_extn_sources(extn_name, extension_dir)
+  subprocess.run("rm -rf " + extension_dir, shell=True, cwd=current_working_dir)
+  return rows
 
-  # Version List File
-  vers_chcklist_file = open("version_checklist.csv", "w")
-  vers_chcklist_file_writer = csv.writer(vers_chcklist_file)
-  vers_chcklist_file_writer.writerow([
-    "Extension Name", 
-    "V1",
-    "V2", 
-    "V3", 
-    "V4",
-    "V5", 
-    "V6", 
-    "V7",
-    "V8", 
-    "V9", 
-    "V10",
-    "V11", 
-    "V12", 
-    "V13",
-    "V14", 
-    "V15", 
-    "V16"])
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Measures the source code every extension copies from Postgres and its versioning code.')
+  parser.add_argument('-j', '--jobs', action='store', default=str(parallel_driver.get_memory_bound_num_jobs(pmd_job_memory_mb)), help='number of extensions analyzed in parallel. Every job starts a PMD JVM with a ' + str(pmd_job_memory_mb) + ' MB heap, so the default is the number of CPUs or the number of such JVMs that fit in the available memory, whichever is lower')
+  parser.add_argument('--no-cache', action='store_true', help='scan every file again instead of using analysis_cache.db')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['no_cache']:
+    analysis_cache_db = None
+  os.environ.setdefault("PMD_JAVA_OPTS", "-Xmx" + str(pmd_job_memory_mb) + "m")
+
+  # Download Postgres 
+  initial_setup()
 
   if DEBUG:
-    download_extn("imcs", terminal_file)
-    run_sca_analysis("imcs", sca_csv_file_writer, vers_csv_file_writer, vers_chcklist_file_writer)
+    parallel_driver.run_analysis(["imcs"], analyze_extn, output_files, 1)
   else:
     # Determine the percentage of source code copied from Postgres
     extns_list = list(extn_db.keys())
     extns_list.sort()
-    for extn in extns_list:
-      download_extn(extn, terminal_file)
-      run_sca_analysis(extn, sca_csv_file_writer, vers_csv_file_writer, vers_chcklist_file_writer)
+    parallel_driver.run_analysis(extns_list, analyze_extn, output_files, int(args_dict['jobs']))
 
-  terminal_file.close()
-  sca_csv_file.close()
-  vers_csv_file.close()
   #move_sca_files()
-  cleanup()
\ No newline at end of file
+  cleanup()
@@ -0,0 +1,432 @@
+# Catalog of the SQL objects every extension's scripts create, and an index
+# of the objects two extensions both create. extension_info.py extracts the
+# objects while it scans the SQL files (see scan_sql_objects) and writes them
+# to sql_objects.csv:
+#   - functions, procedures and aggregates, with their argument types
+#   - types and domains
+#   - operators, with their left and right argument types
+#   - casts
+#   - access methods, operator classes and operator families
+#
+# Names are compared the way Postgres compares them: unquoted identifiers are
+# lowercased, type aliases (int4, integer, ...) are resolved, typmods are
+# dropped, and only the input arguments of a function are part of its
+# signature. Objects created unqualified, in public or in @extschema@ all land
+# in the default schema when the extensions are installed there, so they are
+# compared as if they were in the same schema. Casts and access methods are
+# global.
+#
+# The second CREATE of an object fails, so two extensions creating the same
+# object can't be created in one database. The collision index maps every
+# pair of extensions to the objects they share, so checking a pair is one
+# lookup; prune drops the colliding pairs from a pairwise-parallel list.
+# Objects dropped by later upgrade scripts are still in the catalog, so a
+# collision is a strong hint rather than proof.
+#
+# Usage:
+#   python3 sql_catalog.py collisions --list=extn_lists/current_list.txt
+#   python3 sql_catalog.py check pg_trgm pg_bigm
+#   python3 sql_catalog.py prune test_files/pairs.txt --output=test_files/pruned_pairs.txt
+
+import argparse
+import csv
+import itertools
+import os
+import re
+import sys
+
+default_objects_file = "sql_objects.csv"
+
+objects_header = ["Extension Name", "Kind", "Schema", "Name", "Signature", "File", "Line"]
+
+# Kinds that share a catalog, and so collide with each other.
+kind_namespaces = {
+  "Function": "routine",
+  "Procedure": "routine",
+  "Aggregate": "routine",
+  "Type": "type",
+  "Domain": "type",
+  "Operator": "operator",
+  "Cast": "cast",
+  "Access Method": "access method",
+  "Operator Class": "operator class",
+  "Operator Family": "operator family"
+}
+
+# Schemas of the database the extensions are created in.
+default_schemas = ["", "public", "@extschema@"]
+
+type_aliases = {
+  "int": "integer",
+  "int4": "integer",
+  "int2": "smallint",
+  "int8": "bigint",
+  "float4": "real",
+  "float": "double precision",
+  "float8": "double precision",
+  "bool": "boolean",
+  "varchar": "character varying",
+  "char varying": "character varying",
+  "char": "character",
+  "bpchar": "character",
+  "dec": "numeric",
+  "decimal": "numeric",
+  "timestamp": "timestamp without time zone",
+  "timestamptz": "timestamp with time zone",
+  "time": "time without time zone",
+  "timetz": "time with time zone",
+  "varbit": "bit varying"
+}
+
+# First two words of type names of several words, which are not an argument
+# name followed by a type.
+multiword_type_starts = [
+  ("double", "precision"),
+  ("character", "varying"),
+  ("char", "varying"),
+  ("bit", "varying"),
+  ("national", "character"),
+  ("national", "char"),
+  ("time", "with"),
+  ("time", "without"),
+  ("timestamp", "with"),
+  ("timestamp", "without")
+]
+
+#####################################################################
+# STATEMENT PARSING
+#####################################################################
+
+# Tokens of a statement as normalized by sql_lexer.py.
+token_pattern = re.compile(r"""
+  (?P<extschema>@\s?extschema(?:\s?:\s?[^\W\d]\w*)?\s?@)
+  |(?P<quoted>"(?:[^"]|"")*")
+  |(?P<string>[eE]?'(?:[^']|'')*')
+  |(?P<word>[^\W\d][\w$]*)
+  |(?P<number>\d[\w.]*)
+  |(?P<punct>\S)
+  """, re.VERBOSE)
+
+# Returns (kind, value) tokens. Unquoted identifiers are lowercased, quoted
+# ones unquoted.
+def tokenize(statement):
+  tokens = []
+  for match in token_pattern.finditer(statement):
+    kind = match.lastgroup
+    value = match.group()
+    if kind == "word":
+      value = value.lower()
+    elif kind == "quoted":
+      value = value[1:-1].replace("\"\"", "\"")
+    elif kind == "extschema":
+      value = re.sub(r"\s", "", value)
+      kind = "word"
+    tokens.append((kind, value))
+  return tokens
+
+def is_name(token):
+  return token[0] in ["word", "quoted"]
+
+def normalize_schema(schema):
+  return "" if schema in default_schemas else schema
+
+# Reads a possibly schema qualified name at tokens[i]. Returns (schema, name,
+# index after the name).
+def parse_qualified_name(tokens, i):
+  parts = []
+  while i < len(tokens) and is_name(tokens[i]):
+    parts.append(tokens[i][1])
+    if i + 1 < len(tokens) and tokens[i + 1][1] == ".":
+      i += 2
+    else:
+      i += 1
+      break
+  if len(parts) == 0:
+    return None, None, i
+  return normalize_schema(".".join(parts[:-1])), parts[-1], i
+
+# Returns the tokens between tokens[i] == "(" and its closing parenthesis,
+# and the index after it.
+def get_parenthesized(tokens, i):
+  depth = 0
+  for j in range(i, len(tokens)):
+    if tokens[j][1] == "(":
+      depth += 1
+    elif tokens[j][1] == ")":
+      depth -= 1
+      if depth == 0:
+        return tokens[i + 1:j], j + 1
+  return tokens[i + 1:], len(tokens)
+
+# Splits tokens at top-level commas (and at ORDER BY, for the arguments of
+# ordered-set aggregates).
+def split_list(tokens):
+  items = [[]]
+  depth = 0
+  for i in range(0, len(tokens)):
+    value = tokens[i][1]
+    if value in ["(", "["]:
+      depth += 1
+    elif value in [")", "]"]:
+      depth -= 1
+    if depth == 0 and (value == "," or (value == "order" and i + 1 < len(tokens) and tokens[i + 1][1] == "by")):
+      items.append([])
+    elif depth == 0 and value == "by" and i > 0 and tokens[i - 1][1] == "order":
+      continue
+    else:
+      items[-1].append(tokens[i])
+  return list(filter(lambda x: len(x) > 0, items))
+
+# Returns the name of the type spelled by tokens, e.g. "character varying[]"
+# for varchar(10) ARRAY.
+def normalize_type(tokens):
+  parts = []
+  is_array = False
+  quoted = False
+  i = 0
+  while i < len(tokens):
+    kind, value = tokens[i]
+    if value == "(":
+      _, i = get_parenthesized(tokens, i)
+      continue
+    if value == "[":
+      is_array = True
+      while i < len(tokens) and tokens[i][1] != "]":
+        i += 1
+    elif kind == "word" and value == "array":
+      is_array = True
+    elif kind == "string":
+      # Old-style aggregates give the base type as a string.
+      parts.append(value.strip("'").lower())
+    elif value == "%":
+      parts.append("%")
+    elif kind in ["word", "quoted", "number"] or value == ".":
+      parts.append(value)
+      quoted = quoted or kind == "quoted"
+    i += 1
+
+  name = " ".join(parts).replace(" . ", ".").replace(" % ", "%")
+  if "%" not in name and "." in name:
+    schema, name = name.rsplit(".", 1)
+    if schema not in ["pg_catalog"] + default_schemas:
+      name = schema + "." + name
+  if not quoted:
+    name = type_aliases.get(name, name)
+  return name + ("[]" if is_array else "")
+
+# Returns the type of one argument of a function, or None if it isn't part
+# of the function's signature.
+def parse_argument(tokens, include_out):
+  mode = "in"
+  if len(tokens) > 1 and tokens[0][0] == "word" and tokens[0][1] in ["in", "out", "inout", "variadic"]:
+    mode = tokens[0][1]
+    tokens = tokens[1:]
+  if mode == "out" and not include_out:
+    return None
+  for i in range(0, len(tokens)):
+    if tokens[i][1] in ["default", "="]:
+      tokens = tokens[:i]
+      break
+  if len(tokens) >= 2 and is_name(tokens[0]) and is_name(tokens[1]) and (tokens[0][1], tokens[1][1]) not in multiword_type_starts:
+    tokens = tokens[1:]
+  return normalize_type(tokens)
+
+def parse_routine(tokens, i, kind):
+  schema, name, i = parse_qualified_name(tokens, i)
+  if name is None or i >= len(tokens) or tokens[i][1] != "(":
+    return None
+  arg_tokens, _ = get_parenthesized(tokens, i)
+  args = split_list(arg_tokens)
+
+  # CREATE AGGREGATE name (BASETYPE = type, SFUNC = ...), the old syntax.
+  if kind == "Aggregate" and len(args) > 0 and len(args[0]) > 1 and args[0][1][1] == "=":
+    arg_types = []
+    for item in args:
+      if item[0][1] == "basetype":
+        arg_types.append(normalize_type(item[2:]))
+    return [kind, schema, name, ", ".join(arg_types)]
+
+  # Procedures are identified by their output arguments as well.
+  arg_types = []
+  for item in args:
+    if len(item) == 1 and item[0][1] == "*":
+      continue
+    arg_type = parse_argument(item, kind == "Procedure")
+    if arg_type is not None:
+      arg_types.append(arg_type)
+  return [kind, schema, name, ", ".join(arg_types)]
+
+def parse_operator(tokens, i):
+  schema = ""
+  if i + 1 < len(tokens) and is_name(tokens[i]) and tokens[i + 1][1] == ".":
+    schema = normalize_schema(tokens[i][1])
+    i += 2
+  name = ""
+  while i < len(tokens) and tokens[i][1] != "(":
+    name += tokens[i][1]
+    i += 1
+  if name == "" or i >= len(tokens):
+    return None
+  options, _ = get_parenthesized(tokens, i)
+  arg_types = {"leftarg": "none", "rightarg": "none"}
+  for item in split_list(options):
+    if len(item) > 2 and item[0][1] in arg_types and item[1][1] == "=":
+      arg_types[item[0][1]] = normalize_type(item[2:])
+  return ["Operator", schema, name, arg_types["leftarg"] + ", " + arg_types["rightarg"]]
+
+def parse_cast(tokens, i):
+  if i >= len(tokens) or tokens[i][1] != "(":
+    return None
+  cast_tokens, _ = get_parenthesized(tokens, i)
+  for j in range(0, len(cast_tokens)):
+    if cast_tokens[j] == ("word", "as"):
+      return ["Cast", "", normalize_type(cast_tokens[:j]) + " AS " + normalize_type(cast_tokens[j + 1:]), ""]
+  return None
+
+def parse_operator_class(tokens, i, kind):
+  schema, name, i = parse_qualified_name(tokens, i)
+  if name is None:
+    return None
+  for j in range(i, len(tokens) - 1):
+    if tokens[j] == ("word", "using"):
+      return [kind, schema, name, tokens[j + 1][1]]
+  return None
+
+# Returns [kind, schema, name, signature] for the object a statement
+# creates, or None.
+def get_statement_object(statement):
+  tokens = tokenize(statement)
+  if len(tokens) < 3 or tokens[0] != ("word", "create"):
+    return None
+  i = 1
+  if tokens[1] == ("word", "or") and tokens[2] == ("word", "replace"):
+    i = 3
+  words = list(map(lambda x: x[1] if x[0] == "word" else None, tokens[i:i + 3])) + [None, None, None]
+
+  if words[0] in ["function", "procedure", "aggregate"]:
+    return parse_routine(tokens, i + 1, words[0].capitalize())
+  if words[0] in ["type", "domain"]:
+    schema, name, _ = parse_qualified_name(tokens, i + 1)
+    return None if name is None else [words[0].capitalize(), schema, name, ""]
+  if words[0] == "operator" and words[1] == "class":
+    return parse_operator_class(tokens, i + 2, "Operator Class")
+  if words[0] == "operator" and words[1] == "family":
+    return parse_operator_class(tokens, i + 2, "Operator Family")
+  if words[0] == "operator":
+    return parse_operator(tokens, i + 1)
+  if words[0] == "cast":
+    return parse_cast(tokens, i + 1)
+  if words[0] == "access" and words[1] == "method" and len(tokens) > i + 2 and is_name(tokens[i + 2]):
+    return ["Access Method", "", tokens[i + 2][1], ""]
+  return None
+
+# Returns [kind, schema, name, signature, line] for every object created by
+# statements, (text, line) pairs from sql_lexer.iter_statements.
+def scan_sql_objects(statements):
+  objects = []
+  for (statement, line) in statements:
+    sql_object = get_statement_object(statement)
+    if sql_object is not None:
+      objects.append(sql_object + [line])
+  return objects
+
+#####################################################################
+# COLLISION INDEX
+#####################################################################
+
+def get_object_key(kind, schema, name, signature):
+  return (kind_namespaces[kind], schema, name, signature)
+
+def describe_key(key):
+  (namespace, schema, name, signature) = key
+  name = (schema + "." if schema != "" else "") + name
+  if namespace in ["routine", "operator"]:
+    return namespace + " " + name + "(" + signature + ")"
+  if namespace in ["operator class", "operator family"]:
+    return namespace + " " + name + " USING " + signature
+  return namespace + " " + name
+
+# Returns {extension: set of object keys} from sql_objects.csv.
+def load_catalog(path=default_objects_file):
+  catalog = {}
+  if not os.path.exists(path):
+    return catalog
+  objects_file = open(path, "r")
+  reader = csv.reader(objects_file)
+  next(reader, [])
+  for row in reader:
+    catalog.setdefault(row[0], set()).add(get_object_key(row[1], row[2], row[3], row[4]))
+  objects_file.close()
+  return catalog
+
+# Returns {(first extension, second extension): sorted keys of the objects
+# both create}, with the extensions of each pair in name order. Only pairs
+# that collide are in the index.
+def build_collision_index(catalog):
+  key_extns = {}
+  for extn in catalog:
+    for key in catalog[extn]:
+      key_extns.setdefault(key, []).append(extn)
+
+  index = {}
+  for key in key_extns:
+    for pair in itertools.combinations(sorted(key_extns[key]), 2):
+      index.setdefault(pair, []).append(key)
+  for pair in index:
+    index[pair].sort()
+  return index
+
+def get_pair_collisions(index, first_extn, second_extn):
+  return index.get((min(first_extn, second_extn), max(first_extn, second_extn)), [])
+
+def print_collisions(first_extn, second_extn, keys):
+  print(first_extn + " " + second_extn + ": " + str(len(keys)) + " colliding objects")
+  for key in keys:
+    print("  " + describe_key(key))
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Finds pairs of extensions whose SQL scripts create the same objects.')
+  parser.add_argument('command', choices=['collisions', 'check', 'prune'])
+  parser.add_argument('args', nargs='*')
+  parser.add_argument('-s', '--objects', action='store', default=default_objects_file, help='sql_objects.csv written by extension_info.py')
+  parser.add_argument('-l', '--list', action='store', help='with collisions, text file with the extensions to report on')
+  parser.add_argument('-o', '--output', action='store', help='with prune, where to write the pairs without collisions')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if not os.path.exists(args_dict['objects']):
+    sys.exit("No " + args_dict['objects'] + ", run extension_info.py first.")
+  index = build_collision_index(load_catalog(args_dict['objects']))
+
+  if args_dict['command'] == 'collisions':
+    extns_list = None
+    if args_dict['list'] is not None:
+      list_file = open(args_dict['list'], "r")
+      extns_list = set(filter(lambda x: x != "", map(lambda x: x.strip("\n"), list_file.readlines())))
+      list_file.close()
+    for pair in sorted(index.keys()):
+      if extns_list is None or (pair[0] in extns_list and pair[1] in extns_list):
+        print_collisions(pair[0], pair[1], index[pair])
+  elif args_dict['command'] == 'check':
+    if len(args_dict['args']) != 2:
+      sys.exit("check takes two extensions.")
+    print_collisions(args_dict['args'][0], args_dict['args'][1], get_pair_collisions(index, args_dict['args'][0], args_dict['args'][1]))
+  else:
+    if len(args_dict['args']) != 1:
+      sys.exit("prune takes a pairwise-parallel list.")
+    pairs_file = open(args_dict['args'][0], "r")
+    pairs = list(map(lambda x: x.split(" "), filter(lambda x: x != "", map(lambda x: x.strip("\n"), pairs_file.readlines()))))
+    pairs_file.close()
+    kept = []
+    for (first_extn, second_extn) in pairs:
+      keys = get_pair_collisions(index, first_extn, second_extn)
+      if len(keys) > 0:
+        print_collisions(first_extn, second_extn, keys)
+      else:
+        kept.append((first_extn, second_extn))
+    print("Pruned " + str(len(pairs) - len(kept)) + "/" + str(len(pairs)) + " pairs")
+    if args_dict['output'] is not None:
+      output_file = open(args_dict['output'], "w")
+      for (first_extn, second_extn) in kept:
+        output_file.write(first_extn + " " + second_extn + "\n")
+      output_file.close()
@@ -0,0 +1,175 @@
+# Streaming SQL statement lexer for the analyzers of extension scripts
+# (extension_info.py, function_info.py). It reads a file line by line and
+# yields one normalized statement at a time, understanding what line-based
+# substring checks can't:
+#   - statements split over several lines, or several on one line
+#   - -- and (nested) /* */ comments, which are dropped
+#   - 'strings', E'strings', "identifiers" and $tag$ dollar quoting, so
+#     semicolons and keywords inside them don't count
+#   - BEGIN ATOMIC bodies of SQL-standard functions, which contain semicolons
+#   - psql meta-commands (\echo ... \quit) and COPY ... FROM stdin data
+#
+# Statements come back as their tokens joined by single spaces. String
+# literals longer than max_literal_length and dollar-quoted bodies are
+# replaced by '' and $$, and statements are cut at max_statement_length, so
+# memory stays constant on files like postgis's spatial_ref_sys.sql.
+#
+# Usage:
+#   python3 sql_lexer.py pgextworkdir/pg_hint_plan/pg_hint_plan--1.5.sql
+
+import argparse
+import re
+
+max_literal_length = 256
+max_statement_length = 16384
+
+# Tokens outside of strings and comments.
+normal_token_pattern = re.compile(r"""
+  (?P<space>\s+)
+  |(?P<line_comment>--[^\n]*)
+  |(?P<block_comment>/\*)
+  |(?P<dollar>\$(?:[^\W\d]\w*)?\$)
+  |(?P<estring>[eE]')
+  |(?P<string>')
+  |(?P<identifier>")
+  |(?P<word>[^\W\d][\w$]*)
+  |(?P<number>\d[\w.]*)
+  |(?P<semicolon>;)
+  |(?P<other>[^\s\w'";$/-]+|[$/-])
+  """, re.VERBOSE)
+
+block_comment_pattern = re.compile(r"/\*|\*/")
+string_end_pattern = re.compile(r"(?:[^']|'')*'(?!')")
+estring_end_pattern = re.compile(r"(?:[^'\\]|''|\\.)*'(?!')", re.DOTALL)
+identifier_end_pattern = re.compile(r"(?:[^\"]|\"\")*\"(?!\")")
+
+copy_from_stdin_pattern = re.compile(r"^copy\b.*\bfrom stdin\b", re.IGNORECASE)
+routine_pattern = re.compile(r"^create (or replace )?(function|procedure)\b", re.IGNORECASE)
+
+class Statement:
+  def __init__(self):
+    self.tokens = []
+    self.length = 0
+    self.line = None
+    self.atomic_depth = 0
+
+  def add(self, token, line):
+    if self.line is None:
+      self.line = line
+    if self.length < max_statement_length:
+      self.tokens.append(token)
+      self.length += len(token) + 1
+
+  def text(self):
+    return " ".join(self.tokens)[:max_statement_length]
+
+  # In a BEGIN ATOMIC body, BEGIN and CASE open blocks that END closes.
+  def track_word(self, word):
+    word = word.lower()
+    if self.atomic_depth == 0:
+      if word == "atomic" and len(self.tokens) >= 2 and self.tokens[-2].lower() == "begin" and routine_pattern.match(self.text()):
+        self.atomic_depth = 1
+    elif word in ["begin", "case"]:
+      self.atomic_depth += 1
+    elif word == "end":
+      self.atomic_depth -= 1
+
+# Yields (statement text, line number of its first token) for every
+# statement of lines, an iterable of lines (e.g. an open file).
+def iter_statements(lines):
+  statement = Statement()
+  state = None   # None, "comment", "string", "estring", "identifier", "dollar", "copy"
+  comment_depth = 0
+  dollar_tag = None
+  literal = []
+  literal_length = 0
+
+  for line_number, line in enumerate(lines, 1):
+    if state == "copy":
+      if line.rstrip("\r\n") == "\\.":
+        state = None
+      continue
+    if state is None and len(statement.tokens) == 0 and line.lstrip().startswith("\\"):
+      continue
+
+    pos = 0
+    while pos < len(line):
+      if state == "comment":
+        match = block_comment_pattern.search(line, pos)
+        if match is None:
+          break
+        comment_depth += 1 if match.group() == "/*" else -1
+        pos = match.end()
+        if comment_depth == 0:
+          state = None
+        continue
+
+      if state in ["string", "estring", "identifier", "dollar"]:
+        if state == "dollar":
+          end = line.find(dollar_tag, pos)
+          end = -1 if end < 0 else end + len(dollar_tag)
+        else:
+          pattern = {"string": string_end_pattern, "estring": estring_end_pattern, "identifier": identifier_end_pattern}[state]
+          match = pattern.match(line, pos)
+          end = -1 if match is None else match.end()
+        chunk = line[pos:] if end < 0 else line[pos:end]
+        if literal_length <= max_literal_length:
+          literal.append(chunk)
+        literal_length += len(chunk)
+        if end < 0:
+          break
+        pos = end
+        if state == "dollar":
+          statement.add("$$", line_number)
+        elif literal_length > max_literal_length:
+          statement.add("\"\"" if state == "identifier" else "''", line_number)
+        else:
+          statement.add("".join(literal), line_number)
+        state = None
+        continue
+
+      match = normal_token_pattern.match(line, pos)
+      kind = match.lastgroup
+      token = match.group()
+      pos = match.end()
+      if kind in ["space", "line_comment"]:
+        continue
+      if kind == "block_comment":
+        state = "comment"
+        comment_depth = 1
+      elif kind in ["string", "estring", "identifier", "dollar"]:
+        state = kind
+        dollar_tag = token
+        literal = [token]
+        literal_length = len(token)
+      elif kind == "semicolon" and statement.atomic_depth <= 0:
+        text = statement.text()
+        if len(statement.tokens) > 0:
+          yield text, statement.line
+        statement = Statement()
+        if copy_from_stdin_pattern.match(text):
+          state = "copy"
+          break
+      else:
+        statement.add(token, line_number)
+        if kind == "word":
+          statement.track_word(token)
+
+  if len(statement.tokens) > 0:
+    yield statement.text(), statement.line
+
+def iter_file_statements(path):
+  sql_file = open(path, "r", errors="replace")
+  for statement in iter_statements(sql_file):
+    yield statement
+  sql_file.close()
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Prints the statements of SQL files, one per line.')
+  parser.add_argument('files', nargs='+')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  for path in args_dict['files']:
+    for (text, line) in iter_file_statements(path):
+      print(path + ":" + str(line) + ": " + text)
@@ -0,0 +1,589 @@
+# In-process runner for pg_regress style SQL tests. Instead of forking psql
+# for every test file and diffing its output with an external diff, every
+# sql/<test>.sql file is executed over one persistent libpq connection, its
+# output is rendered the way `psql -X -a -q` would print it, and the result is
+# compared in memory against expected/<test>.out and its alternatives
+# (expected/<test>_N.out).
+#
+# The runner only ever reports a pass when every test's output matches an
+# expected file exactly. Anything it can't emulate (psql meta-commands and
+# variables, COPY, lost connections, ...) or any mismatch is reported as "not
+# passed", and the caller falls back to pg_regress, so verdicts are always the
+# same as pg_regress_test's.
+#
+# Usage:
+#   python3 sql_regress.py --dist=pg-15-dist --inputdir=pgextworkdir/pg_cron --port=5432 test1 test2
+
+import argparse
+import ctypes
+import os
+import sys
+import unicodedata
+
+default_dbname = "regression"
+
+# Databases are set up the way pg_regress (create_database) sets them up.
+database_settings = [
+  "lc_messages TO 'C'",
+  "lc_monetary TO 'C'",
+  "lc_numeric TO 'C'",
+  "lc_time TO 'C'",
+  "bytea_output TO 'hex'",
+  "timezone_abbreviations TO 'Default'"
+]
+# pg_regress exports PGTZ and PGDATESTYLE, which libpq sends at startup.
+connection_options = "-c timezone=PST8PDT -c datestyle=Postgres,\\\\ MDY"
+
+# Column types psql right-aligns (column_type_alignment in print.c).
+right_aligned_types = [
+  20,    # int8
+  21,    # int2
+  23,    # int4
+  26,    # oid
+  28,    # xid
+  29,    # cid
+  700,   # float4
+  701,   # float8
+  790,   # money
+  1700,  # numeric
+  5069   # xid8
+]
+
+# Variables psql defines by itself; `:NAME` in a test would be interpolated.
+psql_variables = [
+  "AUTOCOMMIT", "COMP_KEYWORD_CASE", "DBNAME", "ECHO", "ECHO_HIDDEN",
+  "ENCODING", "ERROR", "FETCH_COUNT", "HIDE_TABLEAM",
+  "HIDE_TOAST_COMPRESSION", "HISTCONTROL", "HISTFILE", "HISTSIZE", "HOST",
+  "IGNOREEOF", "LAST_ERROR_MESSAGE", "LAST_ERROR_SQLSTATE",
+  "ON_ERROR_ROLLBACK", "ON_ERROR_STOP", "PORT", "PROMPT1", "PROMPT2",
+  "PROMPT3", "QUIET", "ROW_COUNT", "SERVER_VERSION_NAME",
+  "SERVER_VERSION_NUM", "SHOW_ALL_RESULTS", "SHOW_CONTEXT", "SINGLELINE",
+  "SINGLESTEP", "SQLSTATE", "USER", "VERBOSITY", "VERSION", "VERSION_NAME",
+  "VERSION_NUM"
+]
+
+# libpq enums
+CONNECTION_OK = 0
+PGRES_EMPTY_QUERY = 0
+PGRES_COMMAND_OK = 1
+PGRES_TUPLES_OK = 2
+PGRES_FATAL_ERROR = 7
+PQTRANS_IDLE = 0
+
+class Unsupported(Exception):
+  pass
+
+#####################################################################
+# LIBPQ BINDING
+#####################################################################
+
+notice_processor_type = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_char_p)
+
+class LibPQ:
+  def __init__(self, dist_dir):
+    lib = ctypes.CDLL(dist_dir + "/lib/libpq.so.5")
+    signatures = {
+      "PQconnectdb": (ctypes.c_void_p, [ctypes.c_char_p]),
+      "PQstatus": (ctypes.c_int, [ctypes.c_void_p]),
+      "PQerrorMessage": (ctypes.c_char_p, [ctypes.c_void_p]),
+      "PQfinish": (None, [ctypes.c_void_p]),
+      "PQsetNoticeProcessor": (ctypes.c_void_p, [ctypes.c_void_p, notice_processor_type, ctypes.c_void_p]),
+      "PQtransactionStatus": (ctypes.c_int, [ctypes.c_void_p]),
+      "PQexec": (ctypes.c_void_p, [ctypes.c_void_p, ctypes.c_char_p]),
+      "PQresultStatus": (ctypes.c_int, [ctypes.c_void_p]),
+      "PQresultErrorMessage": (ctypes.c_char_p, [ctypes.c_void_p]),
+      "PQntuples": (ctypes.c_int, [ctypes.c_void_p]),
+      "PQnfields": (ctypes.c_int, [ctypes.c_void_p]),
+      "PQfname": (ctypes.c_char_p, [ctypes.c_void_p, ctypes.c_int]),
+      "PQftype": (ctypes.c_uint, [ctypes.c_void_p, ctypes.c_int]),
+      "PQgetvalue": (ctypes.c_char_p, [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]),
+      "PQgetisnull": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]),
+      "PQclear": (None, [ctypes.c_void_p])
+    }
+    for name, (restype, argtypes) in signatures.items():
+      func = getattr(lib, name)
+      func.restype = restype
+      func.argtypes = argtypes
+      setattr(self, name, func)
+
+def decode(value):
+  return value.decode("utf-8", "surrogateescape")
+
+class Connection:
+  def __init__(self, libpq, conninfo):
+    self.libpq = libpq
+    self.messages = []
+    self.conn = libpq.PQconnectdb(conninfo.encode("utf-8"))
+    if libpq.PQstatus(self.conn) != CONNECTION_OK:
+      message = decode(libpq.PQerrorMessage(self.conn))
+      libpq.PQfinish(self.conn)
+      raise Unsupported("could not connect: " + message.strip())
+    # Notices are printed as they arrive, like psql does.
+    self.notice_processor = notice_processor_type(lambda arg, message: self.messages.append(decode(message)))
+    libpq.PQsetNoticeProcessor(self.conn, self.notice_processor, None)
+
+  def is_ok(self):
+    return self.libpq.PQstatus(self.conn) == CONNECTION_OK
+
+  # Returns (status, result); the caller must clear the result.
+  def execute(self, query):
+    res = self.libpq.PQexec(self.conn, query.encode("utf-8", "surrogateescape"))
+    return self.libpq.PQresultStatus(res), res
+
+  def execute_quietly(self, query):
+    status, res = self.execute(query)
+    error = decode(self.libpq.PQresultErrorMessage(res))
+    self.libpq.PQclear(res)
+    self.messages = []
+    if status == PGRES_FATAL_ERROR:
+      raise Unsupported(query + " failed: " + error.strip())
+
+  # Starts a test file with the session state a new psql would have.
+  def reset_session(self):
+    if self.libpq.PQtransactionStatus(self.conn) != PQTRANS_IDLE:
+      self.execute_quietly("ROLLBACK")
+    self.execute_quietly("DISCARD ALL")
+
+  def close(self):
+    self.libpq.PQfinish(self.conn)
+
+#####################################################################
+# STATEMENT SPLITTING (psqlscan.l)
+#####################################################################
+
+def is_ident_start(ch):
+  return ch.isalpha() or ch == "_" or ord(ch) >= 0x80
+
+def is_ident_cont(ch):
+  return is_ident_start(ch) or ch.isdigit() or ch == "$"
+
+# Splits psql input into statements the same way psql does: line by line,
+# sending a statement at every top-level semicolon, with the same query text
+# (leading whitespace and -- comments dropped, lines joined by newlines), so
+# that server error positions (LINE n: ...) come out identical.
+class StatementScanner:
+  def __init__(self):
+    self.buf = ""
+    self.reset()
+
+  def reset(self):
+    self.state = None          # None, "xq", "xe", "xd", "xc" or "xdolq"
+    self.comment_depth = 0
+    self.dolq_tag = ""
+    self.paren_depth = 0
+    self.begin_depth = 0
+    self.identifiers = []
+    self.identifier_count = 0
+
+  def track_identifier(self, ident):
+    # Semicolons inside CREATE FUNCTION/PROCEDURE ... BEGIN ATOMIC ... END
+    # don't end the statement.
+    lower = ident.lower()
+    if self.identifier_count == 0:
+      self.identifiers = ["", "", "", ""]
+    if lower in ["create", "function", "procedure", "or", "replace"] and self.identifier_count < 4:
+      self.identifiers[self.identifier_count] = lower[0]
+    self.identifier_count += 1
+
+    ids = self.identifiers
+    if ids[0] == "c" and (ids[1] in ["f", "p"] or (ids[1] == "o" and ids[2] == "r" and ids[3] in ["f", "p"])) and self.paren_depth == 0:
+      if lower == "begin":
+        self.begin_depth += 1
+      elif lower == "case":
+        if self.begin_depth >= 1:
+          self.begin_depth += 1
+      elif lower == "end":
+        if self.begin_depth > 0:
+          self.begin_depth -= 1
+
+  def check_variable(self, line, i):
+    # :NAME, :'NAME' and :"NAME" are interpolated if NAME is a psql variable.
+    j = i + 1
+    if j < len(line) and line[j] in ["'", '"']:
+      j += 1
+    start = j
+    while j < len(line) and (is_ident_cont(line[j]) and line[j] != "$"):
+      j += 1
+    if line[start:j] in psql_variables:
+      raise Unsupported("psql variable " + line[start:j])
+
+  # Returns the statements completed on this line.
+  def scan_line(self, line):
+    statements = []
+    if self.buf != "":
+      self.buf += "\n"
+
+    i = 0
+    while i < len(line):
+      ch = line[i]
+      if self.state == "xc":
+        if line.startswith("/*", i):
+          self.comment_depth += 1
+          self.buf += "/*"
+          i += 2
+        elif line.startswith("*/", i):
+          self.comment_depth -= 1
+          if self.comment_depth == 0:
+            self.state = None
+          self.buf += "*/"
+          i += 2
+        else:
+          self.buf += ch
+          i += 1
+      elif self.state in ["xq", "xe", "xd"]:
+        quote = '"' if self.state == "xd" else "'"
+        if self.state == "xe" and ch == "\\" and i + 1 < len(line):
+          self.buf += line[i:i + 2]
+          i += 2
+        elif ch == quote and line.startswith(quote + quote, i):
+          self.buf += quote + quote
+          i += 2
+        elif ch == quote:
+          self.buf += ch
+          self.state = None
+          i += 1
+        else:
+          self.buf += ch
+          i += 1
+      elif self.state == "xdolq":
+        if line.startswith(self.dolq_tag, i):
+          self.buf += self.dolq_tag
+          self.state = None
+          i += len(self.dolq_tag)
+        else:
+          self.buf += ch
+          i += 1
+      elif ch.isspace():
+        if self.buf != "":
+          self.buf += ch
+        i += 1
+      elif line.startswith("--", i):
+        if self.buf != "":
+          self.buf += line[i:]
+        i = len(line)
+      elif line.startswith("/*", i):
+        self.state = "xc"
+        self.comment_depth = 1
+        self.buf += "/*"
+        i += 2
+      elif ch == "'":
+        self.state = "xq"
+        self.buf += ch
+        i += 1
+      elif ch == '"':
+        self.state = "xd"
+        self.buf += ch
+        i += 1
+      elif ch == "$":
+        j = i + 1
+        if j < len(line) and is_ident_start(line[j]):
+          j += 1
+          while j < len(line) and is_ident_cont(line[j]) and line[j] != "$":
+            j += 1
+        if j < len(line) and line[j] == "$":
+          self.dolq_tag = line[i:j + 1]
+          self.state = "xdolq"
+          self.buf += self.dolq_tag
+          i = j + 1
+        else:
+          self.buf += ch
+          i += 1
+      elif ch == "\\":
+        raise Unsupported("psql meta-command")
+      elif ch == ":":
+        if line.startswith("::", i):
+          self.buf += "::"
+          i += 2
+        else:
+          self.check_variable(line, i)
+          self.buf += ch
+          i += 1
+      elif ch == "(":
+        self.paren_depth += 1
+        self.buf += ch
+        i += 1
+      elif ch == ")":
+        if self.paren_depth > 0:
+          self.paren_depth -= 1
+        self.buf += ch
+        i += 1
+      elif ch == ";":
+        self.buf += ch
+        i += 1
+        if self.paren_depth == 0 and self.begin_depth == 0:
+          statements.append(self.buf)
+          self.buf = ""
+          self.reset()
+      elif ch.isdigit():
+        j = i
+        while j < len(line) and (line[j].isdigit() or line[j] == "."):
+          j += 1
+        self.buf += line[i:j]
+        i = j
+      elif is_ident_start(ch):
+        j = i
+        while j < len(line) and is_ident_cont(line[j]):
+          j += 1
+        ident = line[i:j]
+        rest = line[j:]
+        if ident.lower() == "e" and rest.startswith("'"):
+          self.state = "xe"
+          self.buf += ident + "'"
+          i = j + 1
+        elif ident.lower() in ["b", "x", "n"] and rest.startswith("'"):
+          self.state = "xq"
+          self.buf += ident + "'"
+          i = j + 1
+        elif ident.lower() == "u" and rest.startswith("&'"):
+          self.state = "xq"
+          self.buf += ident + "&'"
+          i = j + 2
+        elif ident.lower() == "u" and rest.startswith('&"'):
+          self.state = "xd"
+          self.buf += ident + '&"'
+          i = j + 2
+        else:
+          self.track_identifier(ident)
+          self.buf += ident
+          i = j
+      else:
+        self.buf += ch
+        i += 1
+
+    return statements
+
+  # At the end of its input, psql sends whatever is left in the buffer.
+  def finish(self):
+    if self.buf != "":
+      return [self.buf]
+    return []
+
+#####################################################################
+# ALIGNED OUTPUT (print_aligned_text, border 1, ascii linestyle)
+#####################################################################
+
+# psql's pg_wcsformat: tabs expand to the next multiple of 8, \r and other
+# control characters are shown escaped.
+def format_cell_line(line):
+  out = ""
+  width = 0
+  for ch in line:
+    if ch == "\t":
+      out += " "
+      width += 1
+      while width % 8 != 0:
+        out += " "
+        width += 1
+    elif ch == "\r":
+      out += "\\r"
+      width += 2
+    elif ord(ch) < 0x20 or ord(ch) == 0x7f:
+      out += "\\x%02X" % ord(ch)
+      width += 4
+    elif unicodedata.combining(ch):
+      out += ch
+    else:
+      out += ch
+      width += 2 if unicodedata.east_asian_width(ch) in ["W", "F"] else 1
+  return out, width
+
+def format_cell(value):
+  return list(map(format_cell_line, value.split("\n")))
+
+def format_table(headers, aligns, rows):
+  num_cols = len(headers)
+  header_lines = list(map(format_cell, headers))
+  row_lines = list(map(lambda row: list(map(format_cell, row)), rows))
+
+  widths = []
+  for j in range(0, num_cols):
+    width = max(map(lambda x: x[1], header_lines[j]))
+    for row in row_lines:
+      width = max([width] + list(map(lambda x: x[1], row[j])))
+    widths.append(width)
+
+  out = ""
+  # Header, centered
+  if num_cols > 0:
+    for k in range(0, max(map(len, header_lines))):
+      line = ""
+      for j in range(0, num_cols):
+        line += " "
+        if k < len(header_lines[j]):
+          text, text_width = header_lines[j][k]
+          spaces = widths[j] - text_width
+          line += " " * (spaces // 2) + text + " " * ((spaces + 1) // 2)
+        else:
+          line += " " * widths[j]
+        line += "+" if k + 1 < len(header_lines[j]) else " "
+        if j < num_cols - 1:
+          line += "|"
+      out += line + "\n"
+
+  out += "-" + "-+-".join(map(lambda w: "-" * w, widths)) + "-\n"
+
+  # A result without columns has no row lines, only the footer.
+  for row in row_lines if num_cols > 0 else []:
+    for k in range(0, max(map(len, row))):
+      line = ""
+      for j in range(0, num_cols):
+        last = (j == num_cols - 1)
+        line += " "
+        more = False
+        if k >= len(row[j]):
+          if not last:
+            line += " " * widths[j]
+        else:
+          text, text_width = row[j][k]
+          more = k + 1 < len(row[j])
+          if aligns[j] == "r":
+            line += " " * (widths[j] - text_width) + text
+          else:
+            line += text
+            if not last or more:
+              line += " " * (widths[j] - text_width)
+        if more:
+          line += "+"
+        elif not last:
+          line += " "
+        if not last:
+          line += "|"
+      out += line + "\n"
+
+  out += "(" + str(len(rows)) + (" row)" if len(rows) == 1 else " rows)") + "\n\n"
+  return out
+
+def format_result(libpq, res):
+  num_cols = libpq.PQnfields(res)
+  headers = []
+  aligns = []
+  for j in range(0, num_cols):
+    headers.append(decode(libpq.PQfname(res, j)))
+    aligns.append("r" if libpq.PQftype(res, j) in right_aligned_types else "l")
+
+  rows = []
+  for i in range(0, libpq.PQntuples(res)):
+    row = []
+    for j in range(0, num_cols):
+      row.append("" if libpq.PQgetisnull(res, i, j) else decode(libpq.PQgetvalue(res, i, j)))
+    rows.append(row)
+  return format_table(headers, aligns, rows)
+
+#####################################################################
+# TEST EXECUTION
+#####################################################################
+
+def run_statement(conn, statement):
+  status, res = conn.execute(statement)
+  out = "".join(conn.messages)
+  conn.messages = []
+  if status == PGRES_TUPLES_OK:
+    out += format_result(conn.libpq, res)
+  elif status == PGRES_FATAL_ERROR:
+    out += decode(conn.libpq.PQresultErrorMessage(res))
+  elif status != PGRES_COMMAND_OK and status != PGRES_EMPTY_QUERY:
+    conn.libpq.PQclear(res)
+    raise Unsupported("result status " + str(status))
+  conn.libpq.PQclear(res)
+  if not conn.is_ok():
+    raise Unsupported("connection lost")
+  return out
+
+# Returns what `psql -X -a -q < sql_path` would print.
+def run_test_file(conn, sql_path):
+  sql_file = open(sql_path, "r", encoding="utf-8", errors="surrogateescape")
+  lines = sql_file.read().split("\n")
+  sql_file.close()
+  if len(lines) > 0 and lines[-1] == "":
+    lines = lines[:-1]
+
+  scanner = StatementScanner()
+  out = ""
+  for line in lines:
+    # -a echoes every line as it is read, before its statements run.
+    out += line + "\n"
+    for statement in scanner.scan_line(line):
+      out += run_statement(conn, statement)
+  for statement in scanner.finish():
+    out += run_statement(conn, statement)
+  return out
+
+def get_expected_files(expected_dir, test):
+  expected_files = [expected_dir + "/" + test + ".out"]
+  for i in range(0, 10):
+    expected_files.append(expected_dir + "/" + test + "_" + str(i) + ".out")
+  return list(filter(os.path.exists, expected_files))
+
+def matches_expected(output, expected_dir, test):
+  for expected_path in get_expected_files(expected_dir, test):
+    expected_file = open(expected_path, "r", encoding="utf-8", errors="surrogateescape")
+    expected = expected_file.read()
+    expected_file.close()
+    if expected == output:
+      return True
+  return False
+
+def create_database(libpq, port, dbname, load_extensions):
+  conn = Connection(libpq, "dbname=postgres port=" + str(port))
+  conn.execute_quietly("DROP DATABASE IF EXISTS \"" + dbname + "\"")
+  conn.execute_quietly("CREATE DATABASE \"" + dbname + "\" TEMPLATE=template0")
+  for setting in database_settings:
+    conn.execute_quietly("ALTER DATABASE \"" + dbname + "\" SET " + setting)
+  conn.close()
+
+  conn = Connection(libpq, "dbname=" + dbname + " port=" + str(port))
+  for extn in load_extensions:
+    conn.execute_quietly("CREATE EXTENSION IF NOT EXISTS \"" + extn + "\"")
+  conn.close()
+
+# Runs test_list from input_dir against the server on port. Returns True only
+# if every test's output matched an expected file; log receives one line per
+# test.
+def run_tests(dist_dir, port, input_dir, test_list, load_extensions=[], dbname=default_dbname, log=sys.stdout):
+  if os.path.isdir(input_dir + "/input") or os.path.isdir(input_dir + "/output"):
+    log.write("sql_regress: .source files are not supported\n")
+    return False
+
+  try:
+    libpq = LibPQ(dist_dir)
+    create_database(libpq, port, dbname, load_extensions)
+    conninfo = "dbname=" + dbname + " port=" + str(port) + " client_encoding=auto options='" + connection_options + "'"
+    conn = Connection(libpq, conninfo)
+  except (OSError, Unsupported) as e:
+    log.write("sql_regress: " + str(e) + "\n")
+    return False
+
+  passed = True
+  for test in test_list:
+    try:
+      conn.reset_session()
+      conn.execute_quietly("SET application_name TO 'pg_regress/" + test + "'")
+      output = run_test_file(conn, input_dir + "/sql/" + test + ".sql")
+    except Unsupported as e:
+      log.write("sql_regress: " + test + ": " + str(e) + "\n")
+      passed = False
+      break
+
+    if matches_expected(output, input_dir + "/expected", test):
+      log.write("sql_regress: " + test + " ... ok\n")
+    else:
+      log.write("sql_regress: " + test + " ... differs\n")
+      passed = False
+      break
+
+  conn.close()
+  return passed
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Runs pg_regress style SQL tests in-process.')
+  parser.add_argument('tests', nargs='+')
+  parser.add_argument('--dist', action='store', default="pg-15-dist", help='Postgres install to load libpq from')
+  parser.add_argument('--inputdir', action='store', default=".", help='directory holding sql/ and expected/')
+  parser.add_argument('--port', action='store', default="5432")
+  parser.add_argument('--dbname', action='store', default=default_dbname)
+  parser.add_argument('--load-extension', action='append', default=[])
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  passed = run_tests(os.path.abspath(args_dict['dist']), int(args_dict['port']), args_dict['inputdir'], args_dict['tests'], args_dict['load_extension'], args_dict['dbname'])
+  sys.exit(0 if passed else 1)
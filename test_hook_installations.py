@@ -0,0 +1,73 @@
+# Tests for hook_installations.py: installations are attributed to the
+# function that makes them, also when a hook implementation's signature is
+# repeated per Postgres version under #if/#else.
+#
+# Usage:
+#   python3 -m unittest test_hook_installations
+
+import unittest
+
+import hook_installations
+
+chained_planner = """
+static planner_hook_type prev_planner_hook = NULL;
+
+static PlannedStmt *
+my_planner(Query *parse, const char *query_string, int cursorOptions, ParamListInfo boundParams)
+{
+  if (prev_planner_hook)
+    return prev_planner_hook(parse, query_string, cursorOptions, boundParams);
+  return standard_planner(parse, query_string, cursorOptions, boundParams);
+}
+
+void
+_PG_init(void)
+{
+  prev_planner_hook = planner_hook;
+  planner_hook = my_planner;
+}
+"""
+
+versioned_planner = """
+static planner_hook_type prev_planner_hook = NULL;
+
+#if PG_VERSION_NUM >= 130000
+static PlannedStmt *
+my_planner(Query *parse, const char *query_string, int cursorOptions, ParamListInfo boundParams)
+{
+#else
+static PlannedStmt *
+my_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
+{
+#endif
+  if (prev_planner_hook)
+    return prev_planner_hook(parse, query_string, cursorOptions, boundParams);
+  return standard_planner(parse, query_string, cursorOptions, boundParams);
+}
+
+void
+_PG_init(void)
+{
+  prev_planner_hook = planner_hook;
+  planner_hook = my_planner;
+}
+"""
+
+def get_installations(text):
+  scan = hook_installations.scan_c_hooks(text, ["planner_hook"])
+  return hook_installations.get_installations([("sample.c", scan)])
+
+class InstallationTest(unittest.TestCase):
+  def test_chained_hook(self):
+    self.assertEqual(get_installations(chained_planner), [["planner_hook", "_PG_init", "sample.c", 16, True, True]])
+
+  def test_versioned_signature(self):
+    self.assertEqual(get_installations(versioned_planner), [["planner_hook", "_PG_init", "sample.c", 22, True, True]])
+
+  def test_nested_else_braces(self):
+    text = "#ifdef A\nvoid f(void) {\n#if B\n{\n#else\n{\n#endif\n}\n#else\nvoid f(int x) {\n#endif\n}\n"
+    values = list(map(lambda x: x[1], hook_installations.tokenize(text)))
+    self.assertEqual(values.count("{"), values.count("}"))
+
+if __name__ == '__main__':
+  unittest.main()
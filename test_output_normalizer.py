@@ -0,0 +1,72 @@
+# Tests for output_normalizer.py: diffs that only differ in log-line prefixes,
+# temporary paths and ports are spurious, while different values in result
+# rows are still real failures.
+#
+# Usage:
+#   python3 -m unittest test_output_normalizer
+
+import unittest
+
+import output_normalizer
+
+def make_diff(old_lines, new_lines):
+  diff_lines = [
+    "diff -U3 /expected/test.out /results/test.out\n",
+    "--- /expected/test.out\n",
+    "+++ /results/test.out\n",
+    "@@ -1," + str(len(old_lines)) + " +1," + str(len(new_lines)) + " @@\n"
+  ]
+  diff_lines += list(map(lambda x: "-" + x + "\n", old_lines))
+  diff_lines += list(map(lambda x: "+" + x + "\n", new_lines))
+  return diff_lines
+
+class SpuriousDiffTest(unittest.TestCase):
+  def test_log_prefix(self):
+    diff_lines = make_diff(
+      ["2024-05-01 10:00:00.123 UTC [4242] LOG:  worker started"],
+      ["2024-05-02 11:30:59.999 UTC [777] LOG:  worker started"])
+    self.assertTrue(output_normalizer.diffs_are_spurious(diff_lines))
+
+  def test_configured_log_prefixes(self):
+    diff_lines = make_diff(
+      ["2024-05-01 10:00:00.123 PDT: postgres [4242] db_1 LOG:  job started",
+       "[2024-05-01 10:00:00.123 UTC] [4242] [regression] LOG:  starting apply worker"],
+      ["2024-05-02 11:30:59.999 PDT: postgres [777] db_1 LOG:  job started",
+       "[2024-05-02 11:30:59.999 UTC] [777] [regression] LOG:  starting apply worker"])
+    self.assertTrue(output_normalizer.diffs_are_spurious(diff_lines))
+
+  def test_temp_path_and_port(self):
+    diff_lines = make_diff(
+      ["could not connect to /tmp/pg_regress-aB12/.s.PGSQL.5432", "listening on port 5432"],
+      ["could not connect to /tmp/pg_regress-Zx98/.s.PGSQL.5433", "listening on port 5433"])
+    self.assertTrue(output_normalizer.diffs_are_spurious(diff_lines))
+
+class RealDiffTest(unittest.TestCase):
+  def test_bracketed_value(self):
+    self.assertFalse(output_normalizer.diffs_are_spurious(make_diff([" [1]"], [" [7]"])))
+
+  def test_interval(self):
+    self.assertFalse(output_normalizer.diffs_are_spurious(make_diff([" @ 5 secs"], [" @ 9 secs"])))
+
+  def test_timestamp_in_row(self):
+    diff_lines = make_diff([" 2024-05-01 10:00:00 | 1"], [" 2024-05-02 10:00:00 | 1"])
+    self.assertFalse(output_normalizer.diffs_are_spurious(diff_lines))
+
+  def test_timestamp_without_pid(self):
+    diff_lines = make_diff(["2024-05-01 10:00:00"], ["2024-05-02 10:00:00"])
+    self.assertFalse(output_normalizer.diffs_are_spurious(diff_lines))
+
+  def test_log_message_after_prefix(self):
+    diff_lines = make_diff(
+      ["2024-05-01 10:00:00.123 UTC [4242] LOG:  sleeping for 5 secs"],
+      ["2024-05-02 11:30:59.999 UTC [777] LOG:  sleeping for 9 secs"])
+    self.assertFalse(output_normalizer.diffs_are_spurious(diff_lines))
+
+class ExpectedOutputTest(unittest.TestCase):
+  def test_normalize_is_opt_in(self):
+    output_lines = ["listening on port 5433\n"]
+    self.assertFalse(output_normalizer.matches_expected(iter(output_lines), "listening on port 5432\n", "all", False))
+    self.assertTrue(output_normalizer.matches_expected(iter(output_lines), "listening on port 5432\n", "all", True))
+
+if __name__ == '__main__':
+  unittest.main()
@@ -0,0 +1,110 @@
+# Usage: python3 util/hook_scan_benchmark.py [--download] [source dirs...]
+# Benchmarks extension_info.py's single-pass C keyword scanner against the
+# previous line-by-line scanner (one normalization plus the keyword substring
+# checks per line) and checks that both find the same keywords in every file.
+# Hook assignments are not compared: hooks.csv comes from hook_installations.py. Run it from the repository root. By default it scans the extension
+# sources in pgextworkdir and the contrib modules of the Postgres source tree;
+# --download first downloads the whole extension corpus the way
+# extension_info.py does.
+
+import argparse
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+import extension_info as ei
+
+#####################################################################
+# PREVIOUS LINE-BY-LINE SCANNER
+#####################################################################
+
+def does_utility_plugin_exist(cl : str):
+  for keyword in ei.misc_utility_keywords:
+    if keyword in cl:
+      return True
+  return False
+
+def does_background_worker_exist(cl : str):
+  return "RegisterBackgroundWorker" in cl or "RegisterDynamicBackgroundWorker" in cl
+
+def does_config_option_exist(cl: str):
+  for elem in ei.custom_variable_fns:
+    fn_name = "DefineCustom" + elem + "Variable"
+    if fn_name in cl:
+      return True
+  return False
+
+def legacy_scan_c_source(text):
+  kinds = set()
+  for cl in text.splitlines():
+    processed_cl = " ".join(cl.strip().split())
+    if does_utility_plugin_exist(processed_cl):
+      kinds.add("utility")
+    if does_background_worker_exist(processed_cl):
+      kinds.add("bgworker")
+    if does_config_option_exist(processed_cl):
+      kinds.add("guc")
+  return kinds
+
+#####################################################################
+# BENCHMARK
+#####################################################################
+
+def load_sources(source_dirs):
+  sources = []
+  for source_dir in source_dirs:
+    for root, _, files in os.walk(source_dir):
+      for name in sorted(files):
+        _, file_ext = os.path.splitext(name)
+        if file_ext[1:] in ei.common_c_file_extns:
+          try:
+            source_file = open(os.path.join(root, name), "r")
+            sources.append((os.path.join(root, name), source_file.read()))
+            source_file.close()
+          except (UnicodeDecodeError, OSError):
+            continue
+  return sources
+
+def time_scanner(scanner, sources):
+  results = []
+  start = time.perf_counter()
+  for (_, text) in sources:
+    results.append(scanner(text))
+  return time.perf_counter() - start, results
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Benchmarks the extension_info.py C source scanner.')
+  parser.add_argument('dirs', nargs='*', help='source directories (default: pgextworkdir and the contrib directory)')
+  parser.add_argument('--download', action='store_true', help='download all extensions in extn_info first')
+  args = parser.parse_args()
+  args_dict = vars(args)
+
+  if args_dict['download']:
+    ei.initial_setup()
+    terminal_file = open(ei.testing_output_dir + "/terminal.txt", "a")
+    for extn in sorted(ei.extn_db.keys()):
+      ei.download_extn(extn, terminal_file)
+    terminal_file.close()
+
+  source_dirs = args_dict['dirs']
+  if len(source_dirs) == 0:
+    source_dirs = [ei.ext_work_dir, "postgresql-" + ei.postgres_version + "/contrib"]
+  sources = load_sources(source_dirs)
+  num_lines = sum(map(lambda x: x[1].count("\n"), sources))
+  if num_lines == 0:
+    sys.exit("No C sources found in " + ", ".join(source_dirs))
+
+  legacy_seconds, legacy_results = time_scanner(legacy_scan_c_source, sources)
+  new_seconds, new_results = time_scanner(ei.scan_c_source, sources)
+
+  num_mismatches = 0
+  for i in range(0, len(sources)):
+    if legacy_results[i] != new_results[i]:
+      num_mismatches += 1
+      print("Mismatch in " + sources[i][0] + ": " + str(legacy_results[i]) + " vs " + str(new_results[i]))
+
+  print(str(len(sources)) + " files, " + str(num_lines) + " lines")
+  print("line-by-line: " + str(round(legacy_seconds, 2)) + "s, " + str(int(num_lines / legacy_seconds)) + " lines/s")
+  print("single pass:  " + str(round(new_seconds, 2)) + "s, " + str(int(num_lines / new_seconds)) + " lines/s")
+  print("speedup: " + str(round(legacy_seconds / new_seconds, 1)) + "x, " + str(num_mismatches) + " mismatching files")
@@ -0,0 +1,160 @@
+# Shared work queue for pairwise compatibility testing. Instead of sharding
+# pairs into static files (test_files/test1a.txt, test2.txt, ...), every worker
+# steals the next pending pair from one queue file. Pending pairs are ordered
+# longest-expected-first, using the durations recorded by earlier runs in the
+# duration store next to the queue file (see duration_store.py), so a
+# long citus or timescaledb pair doesn't end up as the straggler of a run.
+#
+# The queue is a JSON file guarded by an flock'd lock file next to it, so all
+# workers must see the same (local or shared) filesystem.
+
+import fcntl
+import json
+import os
+import time
+import duration_store
+
+# Fallback durations (seconds) for pairs that have never been run.
+default_custom_test_seconds = 1800
+default_pg_regress_seconds = 60
+default_pair_seconds = 30
+
+# A worker prefers a pair that reuses its current Postgres build if one is
+# within this many entries of the head of the queue.
+steal_window = 8
+
+#####################################################################
+# LOCKING HELPERS
+#####################################################################
+
+def lock_queue(queue_path):
+  lock_file = open(queue_path + ".lock", "a")
+  fcntl.flock(lock_file, fcntl.LOCK_EX)
+  return lock_file
+
+def unlock_queue(lock_file):
+  fcntl.flock(lock_file, fcntl.LOCK_UN)
+  lock_file.close()
+
+def read_queue(queue_path):
+  queue_file = open(queue_path, "r")
+  queue = json.load(queue_file)
+  queue_file.close()
+  return queue
+
+def write_queue(queue_path, queue):
+  # Write to a temporary file first so readers never see a partial queue.
+  tmp_path = queue_path + ".tmp"
+  queue_file = open(tmp_path, "w")
+  json.dump(queue, queue_file, indent=2)
+  queue_file.close()
+  os.replace(tmp_path, queue_path)
+
+#####################################################################
+# HISTORICAL DURATIONS
+#####################################################################
+
+def get_durations_db_path(queue_path):
+  return os.path.join(os.path.dirname(os.path.abspath(queue_path)), duration_store.default_durations_db)
+
+def get_default_extn_duration(extn_entry):
+  if "test_method" not in extn_entry:
+    return 0
+  if extn_entry["test_method"] == "custom_test_script":
+    return default_custom_test_seconds
+  return default_pg_regress_seconds
+
+def get_extns_with_dependencies(extn_list, extn_db):
+  extns = []
+  for extn in extn_list:
+    for dep in get_extns_with_dependencies(extn_db[extn].get("dependencies", []), extn_db) + [extn]:
+      if dep not in extns:
+        extns.append(dep)
+  return extns
+
+# Expected duration of a pair: the duration store's prediction for the pair's
+# Postgres build and extension versions, from the pair's own history or its
+# extensions' phases (see duration_store.py), otherwise the slower of the two
+# extensions' pair durations, otherwise a guess based on the test methods.
+# history comes from duration_store.load_history.
+def estimate_pair_duration(first_extn, second_extn, history, extn_db, pg_build=None, versions=None):
+  prediction = duration_store.predict_pair_cost(first_extn, second_extn, get_extns_with_dependencies([first_extn, second_extn], extn_db), history, pg_build, versions)
+  if prediction is not None:
+    return prediction
+
+  estimates = []
+  for extn in [first_extn, second_extn]:
+    if extn in history["extns"]:
+      estimates.append(history["extns"][extn])
+    else:
+      estimates.append(default_pair_seconds + get_default_extn_duration(extn_db[extn]))
+
+  return max(estimates)
+
+#####################################################################
+# QUEUE OPERATIONS
+#####################################################################
+
+# Creates the queue unless another worker already did. pair_options maps each
+# pair to the sorted configure options it needs, pair_builds to the Postgres
+# build it runs on, and versions maps extensions to their versions.
+def create_queue(queue_path, file_extn_pairs, pair_options, pair_builds, versions, extn_db):
+  lock_file = lock_queue(queue_path)
+  if os.path.exists(queue_path):
+    unlock_queue(lock_file)
+    return False
+
+  history = duration_store.load_history(get_durations_db_path(queue_path))
+  pending = []
+  for (first_extn, second_extn) in file_extn_pairs:
+    pending.append({
+      "first": first_extn,
+      "second": second_extn,
+      "configure_options": pair_options[(first_extn, second_extn)],
+      "expected": round(estimate_pair_duration(first_extn, second_extn, history, extn_db, pair_builds[(first_extn, second_extn)], versions), 1)
+    })
+  pending.sort(key=lambda entry: entry["expected"], reverse=True)
+
+  write_queue(queue_path, {"pending": pending, "running": [], "done": []})
+  unlock_queue(lock_file)
+  return True
+
+# Pops the next pair for a worker, or returns None once the queue is drained.
+def steal_pair(queue_path, worker_id, configure_options):
+  lock_file = lock_queue(queue_path)
+  queue = read_queue(queue_path)
+  if len(queue["pending"]) == 0:
+    unlock_queue(lock_file)
+    return None
+
+  index = 0
+  for i in range(0, min(steal_window, len(queue["pending"]))):
+    if queue["pending"][i]["configure_options"] == configure_options:
+      index = i
+      break
+
+  entry = queue["pending"].pop(index)
+  entry["worker"] = worker_id
+  entry["start"] = time.time()
+  queue["running"].append(entry)
+  write_queue(queue_path, queue)
+  unlock_queue(lock_file)
+  return entry
+
+def complete_pair(queue_path, entry, result):
+  seconds = time.time() - entry["start"]
+  lock_file = lock_queue(queue_path)
+  queue = read_queue(queue_path)
+  queue["running"] = list(filter(lambda x: not (x["first"] == entry["first"] and x["second"] == entry["second"]), queue["running"]))
+  entry["result"] = result
+  entry["seconds"] = round(seconds, 1)
+  queue["done"].append(entry)
+  write_queue(queue_path, queue)
+  unlock_queue(lock_file)
+
+def get_queue_progress(queue_path):
+  lock_file = lock_queue(queue_path)
+  queue = read_queue(queue_path)
+  unlock_queue(lock_file)
+  remaining = sum(map(lambda x: x["expected"], queue["pending"]))
+  return len(queue["pending"]), len(queue["running"]), len(queue["done"]), remaining